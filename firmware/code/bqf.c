@@ -25,11 +25,14 @@
 
 #include "bqf.h"
 
-int filter_stages = 0;
+int filter_stages_left = 0;
+int filter_stages_right = 0;
 bqf_coeff_t bqf_filters_left[MAX_FILTER_STAGES];
 bqf_coeff_t bqf_filters_right[MAX_FILTER_STAGES];
 bqf_mem_t bqf_filters_mem_left[MAX_FILTER_STAGES];
 bqf_mem_t bqf_filters_mem_right[MAX_FILTER_STAGES];
+bqf_ramp_t bqf_ramp_left;
+bqf_ramp_t bqf_ramp_right;
 
 /**
  * Configure a low-pass filter. Parameters are as follows:
@@ -42,15 +42,30 @@ typedef struct _bqf_mem_t {
 } bqf_mem_t;
 
 // More filters should be possible, but the config structure
-// might grow beyond the current 512 byte size.
+// might grow beyond CFG_BUFFER_SIZE, most of which is set aside
+// for FIR taps.
 #define MAX_FILTER_STAGES 20
-extern int filter_stages;
+extern int filter_stages_left;
+extern int filter_stages_right;
 
 extern bqf_coeff_t bqf_filters_left[MAX_FILTER_STAGES];
 extern bqf_coeff_t bqf_filters_right[MAX_FILTER_STAGES];
 extern bqf_mem_t bqf_filters_mem_left[MAX_FILTER_STAGES];
 extern bqf_mem_t bqf_filters_mem_right[MAX_FILTER_STAGES];
 
+/// @brief Spreads a change of the coefficients of a filter chain over a number of
+///        samples, so editing a running filter does not step its output.
+typedef struct _bqf_ramp_t {
+    /// @brief Samples left until the chain reaches the target coefficients.
+    int remaining;
+    bqf_coeff_t target[MAX_FILTER_STAGES];
+    /// @brief Added to the coefficients of each stage every sample.
+    bqf_coeff_t step[MAX_FILTER_STAGES];
+} bqf_ramp_t;
+
+extern bqf_ramp_t bqf_ramp_left;
+extern bqf_ramp_t bqf_ramp_right;
+
 #define Q_BUTTERWORTH 0.707106781
 #define Q_BESSEL 0.577350269
 #define Q_LINKWITZ_RILEY 0.5
@@ -66,6 +81,7 @@ void bqf_lowshelf_config(double, double, double, double, bqf_coeff_t *);
 void bqf_highshelf_config(double, double, double, double, bqf_coeff_t *);
 
 static inline fix3_28_t bqf_transform(fix3_28_t, bqf_coeff_t *, bqf_mem_t *);
+static inline fix3_28_t bqf_ramp_transform(fix3_28_t, bqf_coeff_t *, const bqf_coeff_t *, bqf_mem_t *);
 void bqf_memreset(bqf_mem_t *);
 
 #include "bqf.inl"
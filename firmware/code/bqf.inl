@@ -33,4 +33,15 @@ static inline fix3_28_t bqf_transform(fix3_28_t x, bqf_coeff_t *coefficients, bq
     memory->y_1 = y;
 
     return y;
-}
\ No newline at end of file
+}
+
+/// @brief Moves the coefficients one step along a ramp, then filters a sample with them.
+static inline fix3_28_t bqf_ramp_transform(fix3_28_t x, bqf_coeff_t *coefficients, const bqf_coeff_t *step,
+        bqf_mem_t *memory) {
+    coefficients->a1 += step->a1;
+    coefficients->a2 += step->a2;
+    coefficients->b0 += step->b0;
+    coefficients->b1 += step->b1;
+    coefficients->b2 += step->b2;
+    return bqf_transform(x, coefficients, memory);
+}
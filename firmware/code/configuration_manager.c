@@ -21,6 +21,14 @@
 #include "configuration_manager.h"
 #include "configuration_types.h"
 #include "bqf.h"
+#include "crossfeed.h"
+#include "limiter.h"
+#include "fir.h"
+#include "halfband.h"
+#include "quantizer.h"
+#include "loudness.h"
+#include "filter_response.h"
+#include "default_coefficients.h"
 #include "run.h"
 #ifndef TEST_TARGET
 #include "version.h"
@@ -31,6 +39,8 @@
 #include "hardware/flash.h"
 #include "hardware/sync.h"
 #include "hardware/i2c.h"
+#include "stats.h"
+#include "trace.h"
 #endif
 
 /**
@@ -72,8 +82,38 @@ static const default_configuration default_config = {
         .header = { PREPROCESSING_CONFIGURATION, sizeof(default_config.preprocessing) }, 
         -0.376265f,      // pre-EQ gain of -4.1dB
         0.4125f,       // post-EQ gain, set to ~3dB (1.4x, less the 1 that is added when config is applied)
-        true, 
-        {0} 
+        true,
+        0,
+        480         // 10ms at 48kHz
+    },
+    .crossfeed = {
+        .header = { CROSSFEED_CONFIGURATION, sizeof(default_config.crossfeed) },
+        false,
+        {0},
+        700.0f,     // low pass the opposite channel like a head would
+        -6.0f,      // dB
+        300.0f      // us, roughly the extra distance to the far ear
+    },
+    .limiter = {
+        .header = { LIMITER_CONFIGURATION, sizeof(default_config.limiter) },
+        false,
+        {0},
+        -0.3f,      // dBFS
+        1000.0f,    // us of lookahead
+        50.0f       // ms release
+    },
+    .quantizer = {
+        .header = { QUANTIZER_CONFIGURATION, sizeof(default_config.quantizer) },
+        QUANTIZE_TRUNCATE,
+        0,          // no noise shaping
+        {0}
+    },
+    .loudness = {
+        .header = { LOUDNESS_CONFIGURATION, sizeof(default_config.loudness) },
+        false,
+        {0},
+        0.0f,       // dB, full volume is left alone
+        1.0f
     }
 };
 
@@ -87,15 +127,81 @@ const uint8_t *user_configuration = (const uint8_t *) (XIP_BASE + USER_CONFIGURA
  * should handle merging configurations where, for example, only a new
  * filter_configuration_tlv was received.
  */
-#define CFG_BUFFER_SIZE 512
-static uint8_t working_configuration[2][CFG_BUFFER_SIZE];
+#define CFG_BUFFER_SIZE 2048
+// Aligned, the FIR taps are handed to fir_config() as a float array.
+static uint8_t working_configuration[2][CFG_BUFFER_SIZE] __attribute__((aligned(4)));
 static uint8_t inactive_working_configuration = 0;
-static uint8_t result_buffer[CFG_BUFFER_SIZE] = { U16_TO_U8S_LE(NOK), U16_TO_U8S_LE(0) };
+static uint8_t result_buffer[CFG_BUFFER_SIZE] __attribute__((aligned(4))) = { U16_TO_U8S_LE(NOK), U16_TO_U8S_LE(0) };
 
 static bool reload_config = false;
 static uint16_t write_offset = 0;
 static uint16_t read_offset = 0;
 
+/**
+ * The presets live in the flash sectors just below the user configuration, one
+ * per sector. Each sector holds the preset's TLVs, followed by the filter
+ * coefficients designed from them, so switching to a preset is a copy rather
+ * than a filter design.
+ */
+#define NO_PRESET 0xff
+
+typedef struct _preset_coefficients {
+    uint32_t fs;
+    /// @brief tlv_checksum() of the preset the coefficients were designed from.
+    uint32_t checksum;
+    int32_t filter_stages[2];
+    bqf_coeff_t filters[2][MAX_FILTER_STAGES];
+} preset_coefficients;
+
+typedef struct _preset_image {
+    uint8_t config[CFG_BUFFER_SIZE];
+    preset_coefficients coefficients;
+} preset_image;
+
+#ifndef TEST_TARGET
+#define PRESET_OFFSET(i) (USER_CONFIGURATION_OFFSET - ((i) + 1) * FLASH_SECTOR_SIZE)
+#define PRESET_IMAGE_SIZE ((sizeof(preset_image) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1))
+
+static inline const preset_image *stored_preset(uint8_t index) {
+    return (const preset_image *) (XIP_BASE + PRESET_OFFSET(index));
+}
+
+// Too big for the stack, we are running in an interrupt handler when saving.
+static union {
+    preset_image preset;
+    uint8_t bytes[PRESET_IMAGE_SIZE];
+} flash_buffer;
+#endif
+
+static uint8_t save_target = NO_PRESET;
+static char save_name[PRESET_NAME_LENGTH];
+static uint8_t reload_preset = NO_PRESET;
+static uint8_t active_preset = NO_PRESET;
+
+// If you reset the memory, you can hear it when you move the sliders on the UI,
+// so try to preserve our remembered values.
+// If a filter type changes, we do a memory reset.
+static uint8_t bqf_filter_types[2][MAX_FILTER_STAGES] = { };
+static uint32_t bqf_filter_checksum[2][MAX_FILTER_STAGES] = { };
+
+// The filters as they are listed in the configuration, compile_filter_chain() turns
+// these into the chain that actually runs. filter_stage_map says which stage of
+// that chain each of them ended up in.
+static bqf_coeff_t designed_filters[2][MAX_FILTER_STAGES];
+static int8_t designed_gain[2][MAX_FILTER_STAGES];
+static int designed_stages[2];
+static uint8_t filter_stage_map[2][MAX_FILTER_STAGES];
+
+static bqf_coeff_t *const channel_filters[2] = { bqf_filters_left, bqf_filters_right };
+static bqf_mem_t *const channel_filters_mem[2] = { bqf_filters_mem_left, bqf_filters_mem_right };
+static int *const channel_filter_stages[2] = { &filter_stages_left, &filter_stages_right };
+static fir_filter_t *const channel_fir[2] = { &fir_left, &fir_right };
+static bqf_ramp_t *const channel_ramp[2] = { &bqf_ramp_left, &bqf_ramp_right };
+// Samples to spread a change of the filter coefficients over, 0 steps straight to them.
+static uint16_t filter_ramp_samples = 0;
+// Index of the FIR filter in the configured filters of each channel, or -1.
+static int designed_fir[2] = { -1, -1 };
+
 typedef enum {
     NormalOperation,
     SaveRequested,
@@ -103,15 +209,21 @@ typedef enum {
 } State;
 static State saveState = NormalOperation;
 
+static inline bool is_filter_configuration(const tlv_header *tlv) {
+    return tlv->type == FILTER_CONFIGURATION || tlv->type == LEFT_FILTER_CONFIGURATION ||
+        tlv->type == RIGHT_FILTER_CONFIGURATION;
+}
+
 bool validate_filter_configuration(filter_configuration_tlv *filters)
 {
-    if (filters->header.type != FILTER_CONFIGURATION) {
+    if (!is_filter_configuration(&filters->header)) {
         printf("Error! Not a filter TLV (%x)..\n", filters->header.type);
         return false;
     }
     uint8_t *ptr = (uint8_t *)filters->header.value;
     const uint8_t *end = (uint8_t *)filters + filters->header.length;
     int count = 0;
+    int fir_count = 0;
     while ((ptr + 4) < end) {
         const uint32_t type = *(uint32_t *)ptr;
         const uint16_t remaining = (uint16_t)(end - ptr);
@@ -156,6 +268,34 @@ bool validate_filter_configuration(filter_configuration_tlv *filters)
             ptr += sizeof(filter6);
             break;
         }
+        case FIR: {
+            filter_fir *args = (filter_fir *)ptr;
+            if (remaining < sizeof(filter_fir)) {
+                printf("Error! Not enough data left for filter_fir (%d)\n", remaining);
+                return false;
+            }
+            if (args->taps == 0 || args->taps > FIR_MAX_TAPS) {
+                printf("Error! FIR filters must have between 1 and %d taps (%d)\n", FIR_MAX_TAPS, args->taps);
+                return false;
+            }
+            if (remaining < filter_definition_size(ptr)) {
+                printf("Error! Not enough data left for %d FIR taps (%d)\n", args->taps, remaining);
+                return false;
+            }
+            const float *taps = (const float *)(ptr + sizeof(filter_fir));
+            for (uint32_t k = 0; k < (args->taps + 1) / 2; k++) {
+                if (!(fabsf(taps[k]) <= FIR_MAX_COEFFICIENT)) {
+                    printf("Error! FIR taps must be within +-%g (%f)\n", FIR_MAX_COEFFICIENT, taps[k]);
+                    return false;
+                }
+            }
+            if (fir_count++) {
+                printf("Error! Only one FIR filter per channel is supported.\n");
+                return false;
+            }
+            ptr += filter_definition_size(ptr);
+            break;
+        }
 
         default:
             printf("Unknown filter type\n");
@@ -169,72 +309,421 @@ bool validate_filter_configuration(filter_configuration_tlv *filters)
     return true;
 }
 
-void apply_filter_configuration(filter_configuration_tlv *filters) {
+uint16_t filter_definition_size(const uint8_t *filter) {
+    switch (*filter) {
+        case LOWPASS:
+        case HIGHPASS:
+        case BANDPASSSKIRT:
+        case BANDPASSPEAK:
+        case NOTCH:
+        case ALLPASS:
+            return sizeof(filter2);
+        case PEAKING:
+        case LOWSHELF:
+        case HIGHSHELF:
+            return sizeof(filter3);
+        case CUSTOMIIR:
+            return sizeof(filter6);
+        case FIR: {
+            const uint32_t taps = ((const filter_fir *)filter)->taps;
+            if (taps == 0 || taps > FIR_MAX_TAPS) return 0;
+            return sizeof(filter_fir) + (taps + 1) / 2 * sizeof(float);
+        }
+        default:
+            return 0;
+    }
+}
+
+uint16_t design_filter(const uint8_t *filter, double fs, bqf_coeff_t *coefficients) {
+    switch (*filter) {
+        case LOWPASS: INIT_FILTER2(lowpass);
+        case HIGHPASS: INIT_FILTER2(highpass);
+        case BANDPASSSKIRT: INIT_FILTER2(bandpass_skirt);
+        case BANDPASSPEAK: INIT_FILTER2(bandpass_peak);
+        case NOTCH: INIT_FILTER2(notch);
+        case ALLPASS: INIT_FILTER2(allpass);
+        case PEAKING: INIT_FILTER3(peaking);
+        case LOWSHELF: INIT_FILTER3(lowshelf);
+        case HIGHSHELF: INIT_FILTER3(highshelf);
+        case CUSTOMIIR: {
+            filter6 *args = (filter6 *)filter;
+            coefficients->a0 = fix16_one;
+            coefficients->a1 = fix3_28_from_dbl(args->a1/args->a0);
+            coefficients->a2 = fix3_28_from_dbl(args->a2/args->a0);
+            coefficients->b0 = fix3_28_from_dbl(args->b0/args->a0);
+            coefficients->b1 = fix3_28_from_dbl(args->b1/args->a0);
+            coefficients->b2 = fix3_28_from_dbl(args->b2/args->a0);
+            return sizeof(filter6);
+        }
+        case FIR: {
+            // The taps do not fit in a biquad, apply_filter_configuration() loads them
+            // into the FIR filter and this stage is dropped from the chain.
+            memset(coefficients, 0, sizeof(bqf_coeff_t));
+            coefficients->a0 = fix16_one;
+            coefficients->b0 = fix16_one;
+            return filter_definition_size(filter);
+        }
+        default:
+            return 0;
+    }
+}
+
+static uint32_t filter_definition_checksum(const uint8_t *filter, uint16_t size) {
+    uint32_t checksum = 0;
+    for (int i = 0; i < size / 4; i++) checksum ^= ((uint32_t*) filter)[i];
+    return checksum;
+}
+
+uint32_t tlv_checksum(const tlv_header *tlv) {
+    // FNV-1a, this only has to tell two configurations apart.
+    uint32_t hash = 0x811c9dc5;
+    for (uint16_t i = 0; i < tlv->length; i++) {
+        hash ^= ((const uint8_t *)tlv)[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/// @brief FILTER_CONFIGURATION applies to both channels, the others to the channel they are named after.
+static inline bool filters_apply_to(const filter_configuration_tlv *filters, int channel) {
+    switch (filters->header.type) {
+        case LEFT_FILTER_CONFIGURATION: return channel == 0;
+        case RIGHT_FILTER_CONFIGURATION: return channel == 1;
+        default: return true;
+    }
+}
+
+/**
+ * The filter TLV that sets up a channel: the last one among the TLVs that
+ * applies to it, as each replaces the chain set up by the ones before it.
+ */
+static const filter_configuration_tlv *channel_filter_configuration(const uint8_t *ptr, const uint8_t *end, int channel) {
+    const filter_configuration_tlv *found = NULL;
+    while ((ptr + 4) < end) {
+        const filter_configuration_tlv *filters = (const filter_configuration_tlv *) ptr;
+        ptr += filters->header.length;
+        if (is_filter_configuration(&filters->header) && filters_apply_to(filters, channel)) {
+            found = filters;
+        }
+    }
+    return found;
+}
+
+const filter_configuration_tlv *default_filter_configuration() {
+    return (const filter_configuration_tlv *) &default_config.filters;
+}
+
+const tlv_header *default_configuration_tlv() {
+    return &default_config.set_configuration;
+}
+
+/**
+ * Returns the pre-generated coefficients for the factory default filters, or
+ * NULL if there are none for this sampling frequency or they are out of date
+ * with respect to default_config.
+ */
+static const bqf_coeff_t *default_coefficients_for(uint32_t fs, const filter_configuration_tlv *filters) {
+    if (filters != default_filter_configuration() ||
+        tlv_checksum(&filters->header) != DEFAULT_FILTER_CHECKSUM) {
+        return NULL;
+    }
+    for (int i = 0; i < sizeof(default_coefficients) / sizeof(default_coefficients[0]); i++) {
+        if (default_coefficients[i].fs == fs) {
+            return default_coefficients[i].coefficients;
+        }
+    }
+    return NULL;
+}
+
+// Coefficients this close to a pass through are dropped, the difference is far below
+// anything the 24-bit output can show.
+#define IDENTITY_TOLERANCE 16
+
+static inline bool is_identity(const bqf_coeff_t *c) {
+    return abs(c->b0 - fix16_one) <= IDENTITY_TOLERANCE && abs(c->b1 - c->a1) <= IDENTITY_TOLERANCE &&
+        abs(c->b2 - c->a2) <= IDENTITY_TOLERANCE;
+}
+
+static inline bool is_first_order(const bqf_coeff_t *c) {
+    return c->b2 == 0 && c->a2 == 0;
+}
+
+/// @brief Both poles inside the unit circle. Every point on the way between two
+///        stable filters is stable as well, so these can be ramped between.
+static inline bool is_stable(const bqf_coeff_t *c) {
+    return abs(c->a2) < fix16_one && abs(c->a1) < fix16_one + c->a2;
+}
+
+/// @brief -1 for a filter that only cuts, 1 for one that boosts, 0 otherwise.
+static int8_t filter_gain_class(const uint8_t *filter) {
+    if (filter_definition_size(filter) != sizeof(filter3)) return 0;
+    const float db_gain = ((const filter3 *) filter)->db_gain;
+    return db_gain < 0 ? -1 : db_gain > 0 ? 1 : 0;
+}
+
+/// @brief Two first order sections multiplied out into one biquad.
+static void merge_first_order(bqf_coeff_t *merged, const bqf_coeff_t *a, const bqf_coeff_t *b) {
+    const double one = fix16_one;
+    const double ab0 = a->b0 / one, ab1 = a->b1 / one, aa1 = a->a1 / one;
+    const double bb0 = b->b0 / one, bb1 = b->b1 / one, ba1 = b->a1 / one;
+    merged->a0 = fix16_one;
+    merged->a1 = fix3_28_from_dbl(aa1 + ba1);
+    merged->a2 = fix3_28_from_dbl(aa1 * ba1);
+    merged->b0 = fix3_28_from_dbl(ab0 * bb0);
+    merged->b1 = fix3_28_from_dbl(ab0 * bb1 + ab1 * bb0);
+    merged->b2 = fix3_28_from_dbl(ab1 * bb1);
+}
+
+/**
+ * Turns the designed filters of a channel into the chain the DSP runs, every
+ * stage removed saves 5 multiplies per sample:
+ *  - filters that are a pass through, like a peaking filter at 0dB, are dropped
+ *  - neighbouring first order sections are merged into one biquad
+ *  - cuts go first and boosts last, so the signal inside the chain stays small,
+ *    but only the biquads move, the FIR filter keeps its place in the chain
+ *
+ * The order only depends on whether each filter cuts or boosts, so dragging a
+ * slider does not shuffle the chain around until it crosses 0dB. A filter keeps
+ * its memory when it moves, a new stage starts from the input history of the
+ * one before it.
+ *
+ * A stage that carries on with its memory ramps from the coefficients it is
+ * running now to the new ones over filter_ramp_samples, rather than stepping,
+ * even if the type of the filter changed.
+ */
+static void compile_filter_chain(int channel, const bool *replay) {
+    const int count = designed_stages[channel];
+    const bqf_coeff_t *designed = designed_filters[channel];
+    uint8_t *map = filter_stage_map[channel];
+    bqf_coeff_t *chain = channel_filters[channel];
+    bqf_mem_t *memory = channel_filters_mem[channel];
+    bqf_ramp_t *ramp = channel_ramp[channel];
+    bqf_coeff_t *target = ramp->target;
+
+    bqf_mem_t previous_memory[MAX_FILTER_STAGES];
+    bqf_coeff_t previous_chain[MAX_FILTER_STAGES];
+    uint8_t previous_map[MAX_FILTER_STAGES];
+    memcpy(previous_memory, memory, sizeof(previous_memory));
+    memcpy(previous_chain, chain, sizeof(previous_chain));
+    memcpy(previous_map, map, sizeof(previous_map));
+    bool ramping = false;
+
+    // The FIR filter stays where it was configured, the biquads are sorted on
+    // either side of it.
+    const int fir = designed_fir[channel];
+    uint8_t order[MAX_FILTER_STAGES];
+    int n = 0;
+    for (int start = 0, end = fir < 0 ? count : fir; start < count; start = end + 1, end = count) {
+        for (int8_t gain = -1; gain <= 1; gain++) {
+            for (int i = start; i < end; i++) {
+                if (designed_gain[channel][i] == gain) order[n++] = i;
+            }
+        }
+        if (end < count) order[n++] = end;
+    }
+
+    int stages = 0;
+    int open_first_order = -1;
+    for (int i = 0; i < count; i++) {
+        const int filter = order[i];
+        map[filter] = FILTER_DROPPED;
+        if (filter == fir) {
+            // The FIR filter runs between two biquad stages, nothing can be merged across it.
+            map[filter] = FILTER_FIR;
+            channel_fir[channel]->position = stages;
+            open_first_order = -1;
+            continue;
+        }
+        if (is_identity(&designed[filter])) continue;
+
+        bool reset = replay[filter];
+        if (is_first_order(&designed[filter]) && open_first_order == stages - 1 && stages) {
+            merge_first_order(&target[stages - 1], &target[stages - 1], &designed[filter]);
+            chain[stages - 1] = target[stages - 1];
+            map[filter] = stages - 1;
+            open_first_order = -1;
+            // The memory of the first section does not describe the merged filter
+            fix3_28_t x[2] = { memory[stages - 1].x_2, memory[stages - 1].x_1 };
+            bqf_memreset(&memory[stages - 1]);
+            bqf_transform(x[0], &chain[stages - 1], &memory[stages - 1]);
+            bqf_transform(x[1], &chain[stages - 1], &memory[stages - 1]);
+            continue;
+        }
+
+        chain[stages] = designed[filter];
+        target[stages] = designed[filter];
+        map[filter] = stages;
+        open_first_order = is_first_order(&designed[filter]) ? stages : -1;
+
+        const uint8_t previous = previous_map[filter];
+        if (previous < MAX_FILTER_STAGES) {
+            memory[stages] = previous_memory[previous];
+            if (filter_ramp_samples && is_stable(&previous_chain[previous]) && is_stable(&designed[filter])) {
+                chain[stages] = previous_chain[previous];
+                ramping = true;
+                reset = false;
+            }
+        }
+        else {
+            // Either the start of the chain, or the output history of the stage before
+            bqf_memreset(&memory[stages]);
+            if (stages) {
+                memory[stages].x_1 = memory[stages - 1].y_1;
+                memory[stages].x_2 = memory[stages - 1].y_2;
+            }
+            else {
+                memory[stages].x_1 = previous_memory[0].x_1;
+                memory[stages].x_2 = previous_memory[0].x_2;
+            }
+            reset = true;
+        }
+
+        if (reset) {
+            // The memory structure stores the last 2 input samples, we can replay them into
+            // the new filter rather than starting again from scratch.
+            fix3_28_t x[2] = { memory[stages].x_2, memory[stages].x_1 };
+            bqf_memreset(&memory[stages]);
+            bqf_transform(x[0], &chain[stages], &memory[stages]);
+            bqf_transform(x[1], &chain[stages], &memory[stages]);
+        }
+        stages++;
+    }
+    for (int i = count; i < MAX_FILTER_STAGES; i++) {
+        map[i] = FILTER_DROPPED;
+    }
+    if (designed_fir[channel] < 0) {
+        channel_fir[channel]->taps = 0;
+    }
+
+    ramp->remaining = ramping ? filter_ramp_samples : 0;
+    for (int j = 0; j < stages; j++) {
+        bqf_coeff_t *step = &ramp->step[j];
+        step->a0 = 0;
+        step->a1 = ramping ? (target[j].a1 - chain[j].a1) / ramp->remaining : 0;
+        step->a2 = ramping ? (target[j].a2 - chain[j].a2) / ramp->remaining : 0;
+        step->b0 = ramping ? (target[j].b0 - chain[j].b0) / ramp->remaining : 0;
+        step->b1 = ramping ? (target[j].b1 - chain[j].b1) / ramp->remaining : 0;
+        step->b2 = ramping ? (target[j].b2 - chain[j].b2) / ramp->remaining : 0;
+    }
+    *channel_filter_stages[channel] = stages;
+}
+
+void apply_filter_configuration(filter_configuration_tlv *filters, uint8_t channels) {
     uint8_t *ptr = (uint8_t *)filters->header.value;
     const uint8_t *end = (uint8_t *)filters + filters->header.length;
-    filter_stages = 0;
-    bool type_changed = false;
+    int stages = 0;
+    bool type_changed[2] = { false, false };
+    bool replay[2][MAX_FILTER_STAGES] = { };
 
-    while ((ptr + 4) < end) {
+    // The factory default chain is designed at build time, so booting without a
+    // user configuration does not have to run the filter design code at all.
+    const bqf_coeff_t *precomputed = default_coefficients_for(SAMPLING_FREQ, filters);
+
+    for (int channel = 0; channel < 2; channel++) {
+        if ((channels & (1 << channel))) designed_fir[channel] = -1;
+    }
+
+    while ((ptr + 4) < end && stages < MAX_FILTER_STAGES) {
         const uint8_t type = *ptr;
-        // If you reset the memory, you can hear it when you move the sliders on the UI,
-        // so try to preserve our remembered values.
-        // If a filter type changes, we do a memory reset.
-        static uint8_t bqf_filter_types[MAX_FILTER_STAGES] = { };
-        static uint32_t bqf_filter_checksum[MAX_FILTER_STAGES] = { };
-        if (type != bqf_filter_types[filter_stages]) {
-            bqf_filter_types[filter_stages] = type;
-            type_changed = true;
+        const uint16_t size = filter_definition_size(ptr);
+        if (!size) break;
+
+        if (type == FIR) {
+            const filter_fir *args = (const filter_fir *)ptr;
+            // Every filter definition is a multiple of 4 bytes, so the taps are aligned.
+            const float *taps = (const float *)(ptr + sizeof(filter_fir));
+            for (int channel = 0; channel < 2; channel++) {
+                if (!(channels & (1 << channel))) continue;
+                fir_config(taps, args->taps, channel_fir[channel]);
+                designed_fir[channel] = stages;
+            }
         }
 
-        switch (type) {
-            case LOWPASS: INIT_FILTER2(lowpass);
-            case HIGHPASS: INIT_FILTER2(highpass);
-            case BANDPASSSKIRT: INIT_FILTER2(bandpass_skirt);
-            case BANDPASSPEAK: INIT_FILTER2(bandpass_peak);
-            case NOTCH: INIT_FILTER2(notch);
-            case ALLPASS: INIT_FILTER2(allpass);
-            case PEAKING: INIT_FILTER3(peaking);
-            case LOWSHELF: INIT_FILTER3(lowshelf);
-            case HIGHSHELF: INIT_FILTER3(highshelf);
-            case CUSTOMIIR: {
-                filter6 *args = (filter6 *)ptr;
-                uint32_t checksum = 0;
-                for (int i = 0; i < sizeof(filter6) / 4; i++) checksum ^= ((uint32_t*) args)[i];
-                if (checksum != bqf_filter_checksum[filter_stages]) {
-                    bqf_filters_left[filter_stages].a0 = fix16_one;
-                    bqf_filters_left[filter_stages].a1 = fix3_28_from_dbl(args->a1/args->a0);
-                    bqf_filters_left[filter_stages].a2 = fix3_28_from_dbl(args->a2/args->a0);
-                    bqf_filters_left[filter_stages].b0 = fix3_28_from_dbl(args->b0/args->a0);
-                    bqf_filters_left[filter_stages].b1 = fix3_28_from_dbl(args->b1/args->a0);
-                    bqf_filters_left[filter_stages].b2 = fix3_28_from_dbl(args->b2/args->a0);
-                    memcpy(&bqf_filters_right[filter_stages], &bqf_filters_left[filter_stages], sizeof(bqf_coeff_t));
-                    bqf_filter_checksum[filter_stages] = checksum;
+        const uint32_t checksum = filter_definition_checksum(ptr, size);
+        const bqf_coeff_t *designed = NULL;
+        for (int channel = 0; channel < 2; channel++) {
+            if (!(channels & (1 << channel))) continue;
+            bqf_coeff_t *coefficients = &designed_filters[channel][stages];
+
+            if (type != bqf_filter_types[channel][stages]) {
+                bqf_filter_types[channel][stages] = type;
+                type_changed[channel] = true;
+            }
+            if (type == CUSTOMIIR) {
+                type_changed[channel] = true; // Always flush our memory
+            }
+            replay[channel][stages] = type_changed[channel];
+
+            if (checksum != bqf_filter_checksum[channel][stages]) {
+                // Design each filter once, even when it is used by both channels.
+                if (designed) {
+                    *coefficients = *designed;
                 }
-                ptr += sizeof(filter6);
-                type_changed = true; // Always flush our memory
-                break;
+                else if (precomputed) {
+                    *coefficients = precomputed[stages];
+                }
+                else {
+                    design_filter(ptr, SAMPLING_FREQ, coefficients);
+                }
+                designed = coefficients;
+                bqf_filter_checksum[channel][stages] = checksum;
             }
-            default:
-                break;
+            designed_gain[channel][stages] = filter_gain_class(ptr);
         }
-        if (type_changed) {
-            // The memory structure stores the last 2 input samples, we can replay them into
-            // the new filter rather than starting again from scratch.
-            fix3_28_t left[2] = { bqf_filters_mem_left[filter_stages].x_2, bqf_filters_mem_left[filter_stages].x_1 };
-            fix3_28_t right[2] = { bqf_filters_mem_right[filter_stages].x_2, bqf_filters_mem_right[filter_stages].x_1 };
+        ptr += size;
+        stages++;
+    }
+
+    for (int channel = 0; channel < 2; channel++) {
+        if ((channels & (1 << channel))) {
+            designed_stages[channel] = stages;
+            compile_filter_chain(channel, replay[channel]);
+        }
+    }
+}
 
-            bqf_memreset(&bqf_filters_mem_left[filter_stages]);
-            bqf_memreset(&bqf_filters_mem_right[filter_stages]);
+#ifndef TEST_TARGET
+// Rough Cortex-M0+ cycles for the inner loops of the filter chain. Each fix16_mul()
+// is three single cycle 32 bit multiplies with the shifts and masks around them, a
+// biquad does five and an FIR tap pair one, plus the loads, stores and loop.
+#define BIQUAD_SAMPLE_CYCLES 100
+#define FIR_PAIR_CYCLES 30
+// The 2x interpolator runs after the filters on the same core, its inner loop is
+// the same as the FIR filter's.
+#if OUTPUT_OVERSAMPLING == 2
+#define HALFBAND_SAMPLE_CYCLES (HALFBAND_PAIRS * FIR_PAIR_CYCLES)
+#else
+#define HALFBAND_SAMPLE_CYCLES 0
+#endif
+// The share of a core's packet budget the filters of its channel may take, the rest
+// is for the crossfeed, loudness, limiter, quantizer and moving the samples around.
+#define FILTER_BUDGET_PERCENT 70
+// The host sends an extra frame now and then to keep up with the feedback.
+#define MAX_PACKET_FRAMES (SAMPLING_FREQ / 1000 + 1)
 
-            left[0] = bqf_transform(left[0], &bqf_filters_left[filter_stages], &bqf_filters_mem_left[filter_stages]);
-            left[1] = bqf_transform(left[1], &bqf_filters_left[filter_stages], &bqf_filters_mem_left[filter_stages]);
-            right[0] = bqf_transform(right[0], &bqf_filters_right[filter_stages], &bqf_filters_mem_right[filter_stages]);
-            right[1] = bqf_transform(right[1], &bqf_filters_right[filter_stages], &bqf_filters_mem_right[filter_stages]);
+/// @brief Estimated cycles a core spends running one channel's filters, and the
+///        interpolator if there is one, over the largest packet.
+/// @param fir_taps Receives the taps of the channel's FIR filter, or 0.
+static uint32_t filter_chain_cycles(const filter_configuration_tlv *filters, uint32_t *fir_taps) {
+    const uint8_t *ptr = filters->filters;
+    const uint8_t *end = (const uint8_t *)filters + filters->header.length;
+    uint32_t sample_cycles = HALFBAND_SAMPLE_CYCLES;
+    *fir_taps = 0;
+    while ((ptr + 4) < end) {
+        const uint16_t size = filter_definition_size(ptr);
+        if (!size) break;
+        if (*ptr == FIR) {
+            *fir_taps = ((const filter_fir *)ptr)->taps;
+            sample_cycles += (*fir_taps + 1) / 2 * FIR_PAIR_CYCLES;
         }
-        filter_stages++;
+        else {
+            sample_cycles += BIQUAD_SAMPLE_CYCLES;
+        }
+        ptr += size;
     }
+    return sample_cycles * MAX_PACKET_FRAMES;
 }
+#endif
 
 bool validate_configuration(tlv_header *config) {
     uint8_t *ptr = NULL; 
@@ -260,10 +749,26 @@ bool validate_configuration(tlv_header *config) {
             ptr = (uint8_t *) header->tlvs;
             break;
         }
+        case PRESET_HEADER: {
+            preset_header_tlv* header = (preset_header_tlv*) config;
+            if (header->magic != FLASH_MAGIC || header->header.length > CFG_BUFFER_SIZE) {
+                printf("Not a valid preset\n");
+                return false;
+            }
+            if (header->version > CONFIG_VERSION || header->version < MINIMUM_CONFIG_VERSION) {
+                printf("Unsupported preset version (%d)\n", header->version);
+                return false;
+            }
+            ptr = (uint8_t *) header->tlvs;
+            break;
+        }
         default:
             printf("Unexpected Config type: %d\n", config->type);
             return false;
     }
+#ifndef TEST_TARGET
+    const uint8_t *tlvs = ptr;
+#endif
     const uint8_t *end = (uint8_t *)config + config->length;
     while (ptr < end) {
         tlv_header* tlv = (tlv_header*) ptr;
@@ -273,6 +778,8 @@ bool validate_configuration(tlv_header *config) {
         }
         switch (tlv->type) {
             case FILTER_CONFIGURATION:
+            case LEFT_FILTER_CONFIGURATION:
+            case RIGHT_FILTER_CONFIGURATION:
                 if (!validate_filter_configuration((filter_configuration_tlv*) tlv)) {
                     return false;
                 }
@@ -293,15 +800,120 @@ bool validate_configuration(tlv_header *config) {
                 }
                 break;
             }
+            case CROSSFEED_CONFIGURATION: {
+                crossfeed_configuration_tlv* crossfeed_config = (crossfeed_configuration_tlv*) tlv;
+                if (tlv->length != sizeof(crossfeed_configuration_tlv)) {
+                    printf("Crossfeed config size missmatch: %u != %zu\n", tlv->length, sizeof(crossfeed_configuration_tlv));
+                    return false;
+                }
+                if (crossfeed_config->enabled && (crossfeed_config->f0 <= 0 || crossfeed_config->f0 >= SAMPLING_FREQ / 2)) {
+                    printf("Crossfeed f0 out of range: %f\n", crossfeed_config->f0);
+                    return false;
+                }
+                break;
+            }
+            case LIMITER_CONFIGURATION: {
+                if (tlv->length != sizeof(limiter_configuration_tlv)) {
+                    printf("Limiter config size missmatch: %u != %zu\n", tlv->length, sizeof(limiter_configuration_tlv));
+                    return false;
+                }
+                break;
+            }
+            case QUANTIZER_CONFIGURATION: {
+                quantizer_configuration_tlv* quantizer_config = (quantizer_configuration_tlv*) tlv;
+                if (tlv->length != sizeof(quantizer_configuration_tlv)) {
+                    printf("Quantizer config size missmatch: %u != %zu\n", tlv->length, sizeof(quantizer_configuration_tlv));
+                    return false;
+                }
+                if (quantizer_config->mode > QUANTIZE_TPDF_DITHER || quantizer_config->noise_shaping > 2) {
+                    printf("Unknown quantizer mode: %u/%u\n", quantizer_config->mode, quantizer_config->noise_shaping);
+                    return false;
+                }
+                break;
+            }
+            case LOUDNESS_CONFIGURATION: {
+                loudness_configuration_tlv* loudness_config = (loudness_configuration_tlv*) tlv;
+                if (tlv->length != sizeof(loudness_configuration_tlv)) {
+                    printf("Loudness config size missmatch: %u != %zu\n", tlv->length, sizeof(loudness_configuration_tlv));
+                    return false;
+                }
+                if (loudness_config->reference > 0 || loudness_config->reference < -LOUDNESS_MAX_DB ||
+                    loudness_config->strength < 0 || loudness_config->strength > 1) {
+                    printf("Loudness out of range: %f/%f\n", loudness_config->reference, loudness_config->strength);
+                    return false;
+                }
+                break;
+            }
             default:
                 // Unknown TLVs are not invalid, just ignored.
                 break;
         }
         ptr += tlv->length;
     }
+#ifndef TEST_TARGET
+    // A chain that cannot keep up with the audio would underrun, each core only has so long per packet.
+    // Long FIR filters and many biquads trade off against each other, which a fixed limit on either
+    // could not express. GET_STATS shows what a chain really takes.
+    for (int channel = 0; channel < 2; channel++) {
+        const filter_configuration_tlv *filters = channel_filter_configuration(tlvs, end, channel);
+        uint32_t fir_taps = 0;
+        const uint32_t cycles = filters ? filter_chain_cycles(filters, &fir_taps) : 0;
+        const uint32_t budget = stats_packet_cycles / 100 * FILTER_BUDGET_PERCENT;
+        if (cycles > budget && fir_taps) {
+            // FIR_MAX_TAPS is only the room in the filter, say how many taps the budget leaves.
+            const uint32_t fir_cycles = (fir_taps + 1) / 2 * FIR_PAIR_CYCLES * MAX_PACKET_FRAMES;
+            const uint32_t others = cycles - fir_cycles;
+            const uint32_t room = others < budget ? (budget - others) / (FIR_PAIR_CYCLES * MAX_PACKET_FRAMES) * 2 : 0;
+            printf("Error! The other filters of this channel leave room for a FIR filter of %" PRIu32
+                " taps, not %" PRIu32 ".\n", room, fir_taps);
+            return false;
+        }
+        if (cycles > budget) {
+            printf("Error! The filters would take about %" PRIu32 " of the %" PRIu32 " cycles per packet.\n",
+                cycles, stats_packet_cycles);
+            return false;
+        }
+    }
+#endif
     return true;
 }
 
+static void apply_crossfeed_configuration(crossfeed_configuration_tlv *config) {
+    crossfeed_t *crossfeeds[2] = { &crossfeed_left, &crossfeed_right };
+    for (int channel = 0; channel < 2; channel++) {
+        crossfeed_t *crossfeed = crossfeeds[channel];
+        if (config->enabled) {
+            // Only the coefficients change, the filter memory and delay line
+            // carry on so adjusting a running crossfeed does not click.
+            crossfeed_config(SAMPLING_FREQ, config->f0, config->db_gain, config->delay, crossfeed);
+            if (!crossfeed->enabled) crossfeed_memreset(crossfeed);
+        }
+        crossfeed->enabled = config->enabled;
+    }
+}
+
+static void apply_limiter_configuration(limiter_configuration_tlv *config) {
+    limiter_t *limiters[2] = { &limiter_left, &limiter_right };
+    for (int channel = 0; channel < 2; channel++) {
+        limiter_t *limiter = limiters[channel];
+        if (config->enabled) {
+            limiter_config(SAMPLING_FREQ, config->threshold, config->lookahead, config->release, limiter);
+            if (!limiter->enabled) limiter_reset(limiter);
+        }
+        limiter->enabled = config->enabled;
+    }
+}
+
+static void apply_quantizer_configuration(quantizer_configuration_tlv *config) {
+    quantizer_config(config->mode, config->noise_shaping, &quantizer_left);
+    quantizer_config(config->mode, config->noise_shaping, &quantizer_right);
+}
+
+static void apply_loudness_configuration(loudness_configuration_tlv *config) {
+    // The shelves themselves follow on the next volume update.
+    loudness_config(config->enabled, config->reference, config->strength);
+}
+
 bool apply_configuration(tlv_header *config) {
     uint8_t *ptr = NULL; 
     switch (config->type)
@@ -313,17 +925,47 @@ bool apply_configuration(tlv_header *config) {
             ptr = (uint8_t *) ((flash_header_tlv*) config)->tlvs;
             break;
         }
+        case PRESET_HEADER: {
+            ptr = (uint8_t *) ((preset_header_tlv*) config)->tlvs;
+            break;
+        }
         default:
             printf("Unexpected Config type: %d\n", config->type);
             return false;
     }
 
     const uint8_t *end = (uint8_t *)config + config->length;
+    const filter_configuration_tlv *channel_filters[2] = {
+        channel_filter_configuration(ptr, end, 0),
+        channel_filter_configuration(ptr, end, 1)
+    };
     while ((ptr + 4) < end) {
         tlv_header* tlv = (tlv_header*) ptr;
         switch (tlv->type) {
             case FILTER_CONFIGURATION:
-                apply_filter_configuration((filter_configuration_tlv*) tlv);
+            case LEFT_FILTER_CONFIGURATION:
+            case RIGHT_FILTER_CONFIGURATION: {
+                // Filters a later TLV replaces are never designed, only each channel's own chain is.
+                uint8_t channels = 0;
+                for (int channel = 0; channel < 2; channel++) {
+                    if (channel_filters[channel] == (filter_configuration_tlv*) tlv) channels |= 1 << channel;
+                }
+                if (channels) {
+                    apply_filter_configuration((filter_configuration_tlv*) tlv, channels);
+                }
+                break;
+            }
+            case CROSSFEED_CONFIGURATION:
+                apply_crossfeed_configuration((crossfeed_configuration_tlv*) tlv);
+                break;
+            case LIMITER_CONFIGURATION:
+                apply_limiter_configuration((limiter_configuration_tlv*) tlv);
+                break;
+            case QUANTIZER_CONFIGURATION:
+                apply_quantizer_configuration((quantizer_configuration_tlv*) tlv);
+                break;
+            case LOUDNESS_CONFIGURATION:
+                apply_loudness_configuration((loudness_configuration_tlv*) tlv);
                 break;
 #ifndef TEST_TARGET
             case PREPROCESSING_CONFIGURATION: {
@@ -331,6 +973,8 @@ bool apply_configuration(tlv_header *config) {
                 preprocessing.preamp = fix3_28_from_flt(1.0f + preprocessing_config->preamp);
                 preprocessing.postEQGain = fix3_28_from_flt(1.0f + preprocessing_config->postEQGain);
                 preprocessing.reverse_stereo = preprocessing_config->reverse_stereo;
+                preprocessing.mid_side = preprocessing_config->mid_side;
+                filter_ramp_samples = preprocessing_config->filter_ramp;
                 break;
             }
             case PCM3060_CONFIGURATION: {
@@ -364,6 +1008,81 @@ void load_config() {
 }
 
 #ifndef TEST_TARGET
+/**
+ * Runs the filter design for the filter TLV each channel of a preset ends up
+ * with, as apply_configuration() would, so the cache matches what applying it gives.
+ */
+static void design_preset_coefficients(const tlv_header *preset, preset_coefficients *coefficients) {
+    coefficients->fs = SAMPLING_FREQ;
+    coefficients->checksum = tlv_checksum(preset);
+
+    const uint8_t *tlvs = (const uint8_t *) ((const preset_header_tlv*) preset)->tlvs;
+    const uint8_t *tlvs_end = (const uint8_t *)preset + preset->length;
+    const filter_configuration_tlv *channel_filters[2] = { NULL, NULL };
+    for (int channel = 0; channel < 2; channel++) {
+        const filter_configuration_tlv *filters = channel_filter_configuration(tlvs, tlvs_end, channel);
+        channel_filters[channel] = filters;
+        coefficients->filter_stages[channel] = 0;
+        if (!filters) continue;
+        if (channel == 1 && filters == channel_filters[0]) {
+            // Shared by both channels, design it once.
+            coefficients->filter_stages[1] = coefficients->filter_stages[0];
+            memcpy(coefficients->filters[1], coefficients->filters[0], sizeof(coefficients->filters[0]));
+            continue;
+        }
+
+        const uint8_t *ptr = filters->filters;
+        const uint8_t *end = (const uint8_t *)filters + filters->header.length;
+        int stages = 0;
+        while ((ptr + 4) < end && stages < MAX_FILTER_STAGES) {
+            const uint16_t size = design_filter(ptr, SAMPLING_FREQ, &coefficients->filters[channel][stages]);
+            if (!size) break;
+            ptr += size;
+            stages++;
+        }
+        coefficients->filter_stages[channel] = stages;
+    }
+}
+
+static bool validate_preset(uint8_t index) {
+    if (index >= PRESET_COUNT) {
+        return false;
+    }
+    const tlv_header *preset = (const tlv_header *) stored_preset(index)->config;
+    return preset->type == PRESET_HEADER && validate_configuration((tlv_header *) preset);
+}
+
+/**
+ * Loads the cached coefficients of a preset into the filter chains. The per
+ * stage checksums are updated to match, so the apply_configuration() call that
+ * follows only has to take care of the filter memory and the other TLVs.
+ */
+static void load_preset_coefficients(uint8_t index) {
+    const preset_image *image = stored_preset(index);
+    const preset_coefficients *cache = &image->coefficients;
+    const tlv_header *preset = (const tlv_header *) image->config;
+    if (cache->fs != SAMPLING_FREQ || cache->checksum != tlv_checksum(preset)) {
+        // Stale cache, apply_configuration() will design the filters instead.
+        return;
+    }
+
+    const uint8_t *tlvs = (const uint8_t *) ((const preset_header_tlv*) preset)->tlvs;
+    const uint8_t *tlvs_end = (const uint8_t *)preset + preset->length;
+    for (int channel = 0; channel < 2; channel++) {
+        const filter_configuration_tlv *filters = channel_filter_configuration(tlvs, tlvs_end, channel);
+        if (!filters) continue;
+        const uint8_t *ptr = filters->filters;
+        const uint8_t *end = (const uint8_t *)filters + filters->header.length;
+        for (int i = 0; i < cache->filter_stages[channel] && (ptr + 4) < end; i++) {
+            const uint16_t size = filter_definition_size(ptr);
+            if (!size) break;
+            designed_filters[channel][i] = cache->filters[channel][i];
+            bqf_filter_checksum[channel][i] = filter_definition_checksum(ptr, size);
+            ptr += size;
+        }
+    }
+}
+
 bool __no_inline_not_in_flash_func(save_config)() {
     const uint8_t active_configuration = inactive_working_configuration ? 0 : 1;
     tlv_header* config = (tlv_header*) working_configuration[active_configuration];
@@ -377,17 +1096,32 @@ bool __no_inline_not_in_flash_func(save_config)() {
 
                 const size_t config_length = config->length - ((size_t)config->value - (size_t)config);
                 // Write data to flash
-                uint8_t flash_buffer[CFG_BUFFER_SIZE];
-                flash_header_tlv* flash_header = (flash_header_tlv*) flash_buffer;
-                flash_header->header.type = FLASH_HEADER;
-                flash_header->header.length = sizeof(flash_header_tlv) + config_length;
-                flash_header->magic = FLASH_MAGIC;
-                flash_header->version = CONFIG_VERSION;
-                memcpy((void*)(flash_header->tlvs), config->value, config_length);
+                size_t offset = USER_CONFIGURATION_OFFSET;
+                size_t length = CFG_BUFFER_SIZE;
+                if (save_target == NO_PRESET) {
+                    flash_header_tlv* flash_header = (flash_header_tlv*) flash_buffer.bytes;
+                    flash_header->header.type = FLASH_HEADER;
+                    flash_header->header.length = sizeof(flash_header_tlv) + config_length;
+                    flash_header->magic = FLASH_MAGIC;
+                    flash_header->version = CONFIG_VERSION;
+                    memcpy((void*)(flash_header->tlvs), config->value, config_length);
+                }
+                else {
+                    preset_header_tlv* preset_header = (preset_header_tlv*) flash_buffer.preset.config;
+                    preset_header->header.type = PRESET_HEADER;
+                    preset_header->header.length = sizeof(preset_header_tlv) + config_length;
+                    preset_header->magic = FLASH_MAGIC;
+                    preset_header->version = CONFIG_VERSION;
+                    memcpy(preset_header->name, save_name, PRESET_NAME_LENGTH);
+                    memcpy((void*)(preset_header->tlvs), config->value, config_length);
+                    design_preset_coefficients((tlv_header*) preset_header, &flash_buffer.preset.coefficients);
+                    offset = PRESET_OFFSET(save_target);
+                    length = PRESET_IMAGE_SIZE;
+                }
 
                 uint32_t ints = save_and_disable_interrupts();
-                flash_range_erase(USER_CONFIGURATION_OFFSET, FLASH_SECTOR_SIZE);
-                flash_range_program(USER_CONFIGURATION_OFFSET, flash_buffer, CFG_BUFFER_SIZE);
+                flash_range_erase(offset, FLASH_SECTOR_SIZE);
+                flash_range_program(offset, flash_buffer.bytes, length);
                 restore_interrupts(ints);
                 saveState = Saving;
 
@@ -419,6 +1153,61 @@ bool __no_inline_not_in_flash_func(factory_reset)() {
     return true;
 }
 
+/**
+ * Evaluating the response takes a while in soft float, far too long for the USB
+ * interrupt the audio packets come in on, so GET_FREQUENCY_RESPONSE only takes a
+ * copy of the filters. The points are worked out one at a time from the idle loop
+ * by config_idle_task(), and each response returns the ones ready so far. The
+ * client sends the same request again until it has them all.
+ *
+ * The generation is bumped by every new request, a point the idle loop was
+ * working on for an earlier one is thrown away.
+ */
+static struct {
+    uint32_t generation;
+    uint16_t points;
+    volatile uint16_t next;
+    uint8_t channel;
+    int stages;
+    bqf_coeff_t filters[MAX_FILTER_STAGES];
+    int fir_taps;
+    fix3_28_t fir_coefficients[(FIR_MAX_TAPS + 1) / 2];
+    float frequencies[FREQUENCY_RESPONSE_MAX_POINTS];
+    frequency_response_point results[FREQUENCY_RESPONSE_MAX_POINTS];
+} response_request;
+
+static void evaluate_response_point(uint16_t point, frequency_response_point *result) {
+    double magnitude, phase;
+    chain_response(response_request.filters, response_request.stages, SAMPLING_FREQ,
+        response_request.frequencies[point], &magnitude, &phase);
+    if (response_request.fir_taps) {
+        double fir_magnitude, fir_phase;
+        fir_response(response_request.fir_coefficients, response_request.fir_taps, SAMPLING_FREQ,
+            response_request.frequencies[point], &fir_magnitude, &fir_phase);
+        magnitude += fir_magnitude;
+        phase = remainder(phase + fir_phase, 360.0);
+    }
+    result->magnitude = (float) magnitude;
+    result->phase = (float) phase;
+}
+
+bool config_idle_task() {
+    const uint32_t generation = response_request.generation;
+    const uint16_t point = response_request.next;
+    if (point >= response_request.points) return false;
+
+    frequency_response_point result;
+    evaluate_response_point(point, &result);
+
+    uint32_t ints = save_and_disable_interrupts();
+    if (response_request.generation == generation && response_request.next == point) {
+        response_request.results[point] = result;
+        response_request.next = point + 1;
+    }
+    restore_interrupts(ints);
+    return true;
+}
+
 bool process_cmd(tlv_header* cmd) {
     tlv_header* result = ((tlv_header*) result_buffer);
     switch (cmd->type) {
@@ -426,6 +1215,7 @@ bool process_cmd(tlv_header* cmd) {
             if (validate_configuration(cmd)) {
                 inactive_working_configuration = inactive_working_configuration ? 0 : 1;
                 reload_config = true;
+                reload_preset = NO_PRESET;
                 result->type = OK;
                 result->length = 4;
                 return true;
@@ -433,6 +1223,7 @@ bool process_cmd(tlv_header* cmd) {
             break;
         case SAVE_CONFIGURATION: {
             if (cmd->length == 4) {
+                save_target = NO_PRESET;
                 saveState = SaveRequested;
                 if (audio_state.interface == 0) {
                     // The OS will configure the alternate "zero" interface when the device is not in use
@@ -446,6 +1237,233 @@ bool process_cmd(tlv_header* cmd) {
             }
             break;
         }
+        case SAVE_PRESET: {
+            const save_preset_cmd* save = (const save_preset_cmd*) cmd;
+            const uint8_t active_configuration = inactive_working_configuration ? 0 : 1;
+            tlv_header* config = (tlv_header*) working_configuration[active_configuration];
+            if (cmd->length == sizeof(save_preset_cmd) && save->index < PRESET_COUNT &&
+                config->type == SET_CONFIGURATION && validate_configuration(config)) {
+                save_target = save->index;
+                memcpy(save_name, save->name, PRESET_NAME_LENGTH);
+                saveState = SaveRequested;
+                if (audio_state.interface == 0) {
+                    save_config();
+                }
+                result->type = OK;
+                result->length = 4;
+                return true;
+            }
+            break;
+        }
+        case SELECT_PRESET: {
+            const select_preset_cmd* select = (const select_preset_cmd*) cmd;
+            if (cmd->length == sizeof(select_preset_cmd) && validate_preset(select->index)) {
+                const uint8_t index = select->index;
+                const preset_header_tlv* preset = (const preset_header_tlv*) stored_preset(index)->config;
+                const uint16_t payload_length = preset->header.length - sizeof(preset_header_tlv);
+
+                // The preset becomes the working configuration, as if the client had sent it. The
+                // command is overwritten, it lives in the same buffer.
+                tlv_header* config = (tlv_header*) working_configuration[inactive_working_configuration];
+                memcpy((void*)config->value, preset->tlvs, payload_length);
+                config->type = SET_CONFIGURATION;
+                config->length = sizeof(tlv_header) + payload_length;
+
+                inactive_working_configuration = inactive_working_configuration ? 0 : 1;
+                reload_config = true;
+                reload_preset = index;
+                result->type = OK;
+                result->length = 4;
+                return true;
+            }
+            break;
+        }
+        case GET_PRESETS: {
+            if (cmd->length == 4) {
+                preset_status_tlv* status = (preset_status_tlv*) result->value;
+                for (uint8_t i = 0; i < PRESET_COUNT; i++, status++) {
+                    status->header.type = PRESET_STATUS;
+                    status->header.length = sizeof(preset_status_tlv);
+                    status->index = i;
+                    status->valid = validate_preset(i);
+                    status->active = (i == active_preset);
+                    status->reserved = 0;
+                    if (status->valid) {
+                        memcpy(status->name, ((const preset_header_tlv*) stored_preset(i)->config)->name, PRESET_NAME_LENGTH);
+                    }
+                    else {
+                        memset(status->name, 0, PRESET_NAME_LENGTH);
+                    }
+                }
+                result->type = OK;
+                result->length = 4 + PRESET_COUNT * sizeof(preset_status_tlv);
+                return true;
+            }
+            break;
+        }
+        case GET_STATUS: {
+            if (cmd->length == 4) {
+                limiter_t *limiters[2] = { &limiter_left, &limiter_right };
+                limiter_status_tlv* status = (limiter_status_tlv*) result->value;
+                for (uint8_t i = 0; i < 2; i++, status++) {
+                    limiter_t *limiter = limiters[i];
+                    status->header.type = LIMITER_STATUS;
+                    status->header.length = sizeof(limiter_status_tlv);
+                    status->channel = i;
+                    status->enabled = limiter->enabled;
+                    status->reserved[0] = status->reserved[1] = 0;
+                    status->clipped_samples = limiter->clipped_samples;
+                    status->limited_packets = limiter->limited_packets;
+                    // The core that owns the limiter restarts the peak, so nothing here writes to it.
+                    status->gain_reduction = -20.0f * log10f((float) limiter->gain / fix16_one);
+                    status->peak_gain_reduction = -20.0f * log10f((float) limiter->min_gain / fix16_one);
+                    limiter->reset_peak = true;
+                }
+                uint8_t *ptr = (uint8_t *) status;
+                for (uint8_t i = 0; i < 2; i++) {
+                    filter_chain_status_tlv* chain = (filter_chain_status_tlv*) ptr;
+                    chain->header.type = FILTER_CHAIN_STATUS;
+                    chain->header.length = sizeof(filter_chain_status_tlv) + designed_stages[i];
+                    chain->channel = i;
+                    chain->filters = designed_stages[i];
+                    chain->stages = *channel_filter_stages[i];
+                    chain->reserved = 0;
+                    memcpy((void*) chain->stage_map, filter_stage_map[i], designed_stages[i]);
+                    ptr += chain->header.length;
+                }
+#ifndef TEST_TARGET
+                _Static_assert(sizeof(((ring_status_tlv*) 0)->histogram) == RING_HISTOGRAM_BINS * sizeof(uint32_t),
+                    "ring_status_tlv histogram size");
+                // The filter chain status can leave ptr unaligned.
+                ring_status_tlv ring;
+                ring.header.type = RING_STATUS;
+                ring.header.length = sizeof(ring_status_tlv);
+                ring.capacity = RINGBUF_LEN_IN_BYTES;
+                ring.samples = ring_stats.samples;
+                ring.current = ring_stats.current;
+                ring.min = ring_stats.min;
+                ring.mean = ring_stats.time ? ring_stats.weighted_total / ring_stats.time : ring_stats.current;
+                ring.max = ring_stats.max;
+                ring.min_latency = stats_ring_latency(ring.min);
+                ring.mean_latency = stats_ring_latency(ring.mean);
+                ring.max_latency = stats_ring_latency(ring.max);
+                memcpy(ring.histogram, ring_stats.histogram, sizeof(ring.histogram));
+                memcpy(ptr, &ring, sizeof(ring));
+                ptr += sizeof(ring);
+                stats_ring_reset();
+#endif
+                result->type = OK;
+                result->length = ptr - result_buffer;
+                return true;
+            }
+            break;
+        }
+#ifndef TEST_TARGET
+        case GET_STATS: {
+            if (cmd->length == 4) {
+                // Which phases each core runs, the others are never recorded.
+                static const uint8_t core_phases[2][STATS_PHASES] = {
+                    { STATS_PACKET, STATS_COPY_IN, STATS_FILTER, STATS_HANDSHAKE, STATS_CONFIG, STATS_PHASES },
+                    { STATS_PACKET, STATS_FILTER, STATS_HANDSHAKE, STATS_RING_WRITE, STATS_PHASES }
+                };
+                _Static_assert(sizeof(((cycle_stats_tlv*) 0)->histogram) == STATS_HISTOGRAM_BINS * sizeof(uint32_t),
+                    "cycle_stats_tlv histogram size");
+                cycle_stats_tlv* stats = (cycle_stats_tlv*) result->value;
+                for (uint8_t core = 0; core < 2; core++) {
+                    // Core 1 may be halfway through a packet, one of its phases can be a
+                    // packet ahead of the others.
+                    const core_stats_t *source = &core_stats[core];
+                    for (int i = 0; core_phases[core][i] != STATS_PHASES; i++, stats++) {
+                        const phase_stats_t *phase = &source->phases[core_phases[core][i]];
+                        stats->header.type = CYCLE_STATS;
+                        stats->header.length = sizeof(cycle_stats_tlv);
+                        stats->core = core;
+                        stats->phase = core_phases[core][i];
+                        stats->reserved[0] = stats->reserved[1] = 0;
+                        stats->packets = phase->packets;
+                        stats->budget = stats_packet_cycles;
+                        stats->min = phase->packets ? phase->min : 0;
+                        stats->mean = phase->packets ? phase->total / phase->packets : 0;
+                        stats->max = phase->max;
+                        memcpy(stats->histogram, phase->histogram, sizeof(stats->histogram));
+                    }
+                    core_stats[core].reset = true;
+                }
+                result->type = OK;
+                result->length = (uint8_t *) stats - result_buffer;
+                return true;
+            }
+            break;
+        }
+        case GET_TRACE: {
+            const trace_cmd* request = (const trace_cmd*) cmd;
+            if (cmd->length == sizeof(trace_cmd) && request->core < 2) {
+                _Static_assert(sizeof(tlv_header) + sizeof(trace_tlv) + TRACE_CHUNK_EVENTS * sizeof(trace_event_t) <=
+                    CFG_BUFFER_SIZE, "trace chunk does not fit in the result buffer");
+                trace_tlv* trace = (trace_tlv*) result->value;
+                const uint8_t core = request->core;
+                const uint32_t first = request->first;
+                trace->header.type = TRACE;
+                trace->core = core;
+                trace->reserved[0] = trace->reserved[1] = trace->reserved[2] = 0;
+                uint32_t start;
+                // The events land word aligned, the result buffer is.
+                const uint32_t count = trace_read(core, first, (trace_event_t*) trace->events, &start);
+                trace->first = start;
+                trace->head = trace_rings[core].head;
+                trace->now = time_us_32();
+                trace->header.length = sizeof(trace_tlv) + count * sizeof(trace_event_t);
+                result->type = OK;
+                result->length = sizeof(tlv_header) + trace->header.length;
+                return true;
+            }
+            break;
+        }
+#endif
+        case GET_FREQUENCY_RESPONSE: {
+            const frequency_response_cmd* request = (const frequency_response_cmd*) cmd;
+            const uint16_t points = (cmd->length - sizeof(frequency_response_cmd)) / sizeof(float);
+            if (cmd->length > sizeof(frequency_response_cmd) && request->channel < 2 &&
+                (cmd->length - sizeof(frequency_response_cmd)) % sizeof(float) == 0 &&
+                points <= FREQUENCY_RESPONSE_MAX_POINTS) {
+                const int stages = *channel_filter_stages[request->channel];
+                // Where a ramp is heading, not somewhere along the way.
+                const bqf_coeff_t *filters = channel_ramp[request->channel]->target;
+                const fir_filter_t *fir = channel_fir[request->channel];
+
+                // Carry on with the points of the last request if this one repeats it and the filters
+                // have not changed since, otherwise start over.
+                if (request->channel != response_request.channel || points != response_request.points ||
+                    stages != response_request.stages || fir->taps != response_request.fir_taps ||
+                    memcmp(response_request.filters, filters, stages * sizeof(bqf_coeff_t)) ||
+                    memcmp(response_request.fir_coefficients, fir->coefficients, sizeof(fir->coefficients)) ||
+                    memcmp(response_request.frequencies, request->frequencies, points * sizeof(float))) {
+                    response_request.generation++;
+                    response_request.channel = request->channel;
+                    response_request.stages = stages;
+                    memcpy(response_request.filters, filters, stages * sizeof(bqf_coeff_t));
+                    response_request.fir_taps = fir->taps;
+                    memcpy(response_request.fir_coefficients, fir->coefficients, sizeof(fir->coefficients));
+                    memcpy(response_request.frequencies, request->frequencies, points * sizeof(float));
+                    response_request.next = 0;
+                    response_request.points = points;
+                }
+
+                // The idle loop only adds points with interrupts disabled, so these are all complete.
+                const uint16_t ready = response_request.next;
+                frequency_response_tlv* response = (frequency_response_tlv*) result->value;
+                response->header.type = FREQUENCY_RESPONSE;
+                response->header.length = sizeof(frequency_response_tlv) + ready * sizeof(frequency_response_point);
+                response->channel = request->channel;
+                response->ready = ready;
+                memset(response->reserved, 0, sizeof(response->reserved));
+                memcpy(response->points, response_request.results, ready * sizeof(frequency_response_point));
+                result->type = OK;
+                result->length = 4 + response->header.length;
+                return true;
+            }
+            break;
+        }
         case GET_ACTIVE_CONFIGURATION: {
             const uint8_t active_configuration = inactive_working_configuration ? 0 : 1;
             tlv_header* config = (tlv_header*) working_configuration[active_configuration];
@@ -587,11 +1605,18 @@ void configuration_ep_on_cancel(struct usb_endpoint *ep) {
     request->length = 0;
 }
 
-void apply_config_changes() {
+bool apply_config_changes() {
     if (reload_config) {
         reload_config = false;
+        active_preset = reload_preset;
+        if (reload_preset != NO_PRESET) {
+            load_preset_coefficients(reload_preset);
+            reload_preset = NO_PRESET;
+        }
         const uint8_t active_configuration = inactive_working_configuration ? 0 : 1;
         apply_configuration((tlv_header*) working_configuration[active_configuration]);
+        return true;
     }
+    return false;
 }
 #endif
@@ -14,6 +14,8 @@
  */
 #ifndef CONFIGURATION_MANAGER_H
 #define CONFIGURATION_MANAGER_H
+#include "bqf.h"
+#include "configuration_types.h"
 struct usb_endpoint;
 
 // TODO: Duplicated from os_descriptors.h
@@ -23,29 +25,15 @@ struct usb_endpoint;
 #define U16_TO_U8S_LE(_u16)     U16_LOW(_u16), U16_HIGH(_u16)
 
 #define INIT_FILTER2(T) { \
-    filter2 *args = (filter2 *)ptr; \
-    uint32_t checksum = 0; \
-    for (int i = 0; i < sizeof(filter2) / 4; i++) checksum ^= ((uint32_t*) args)[i]; \
-    if (checksum != bqf_filter_checksum[filter_stages]) { \
-        bqf_##T##_config(SAMPLING_FREQ, args->f0, args->Q, &bqf_filters_left[filter_stages]); \
-        memcpy(&bqf_filters_right[filter_stages], &bqf_filters_left[filter_stages], sizeof(bqf_coeff_t)); \
-        bqf_filter_checksum[filter_stages] = checksum; \
-    } \
-    ptr += sizeof(filter2); \
-    break; \
+    filter2 *args = (filter2 *)filter; \
+    bqf_##T##_config(fs, args->f0, args->Q, coefficients); \
+    return sizeof(filter2); \
     }
 
 #define INIT_FILTER3(T) { \
-    filter3 *args = (filter3 *)ptr; \
-    uint32_t checksum = 0; \
-    for (int i = 0; i < sizeof(filter3) / 4; i++) checksum ^= ((uint32_t*) args)[i]; \
-    if (checksum != bqf_filter_checksum[filter_stages]) { \
-        bqf_##T##_config(SAMPLING_FREQ, args->f0, args->db_gain, args->Q, &bqf_filters_left[filter_stages]); \
-        memcpy(&bqf_filters_right[filter_stages], &bqf_filters_left[filter_stages], sizeof(bqf_coeff_t)); \
-        bqf_filter_checksum[filter_stages] = checksum; \
-    } \
-    ptr += sizeof(filter3); \
-    break; \
+    filter3 *args = (filter3 *)filter; \
+    bqf_##T##_config(fs, args->f0, args->db_gain, args->Q, coefficients); \
+    return sizeof(filter3); \
     }
 
 void config_in_packet(struct usb_endpoint *ep);
@@ -53,6 +41,15 @@ void config_out_packet(struct usb_endpoint *ep);
 void configuration_ep_on_cancel(struct usb_endpoint *ep);
 extern void load_config();
 extern bool save_config();
-extern void apply_config_changes();
+extern bool apply_config_changes();
+extern bool config_idle_task();
+extern bool validate_configuration(tlv_header *config);
+extern bool apply_configuration(tlv_header *config);
+
+uint16_t filter_definition_size(const uint8_t *filter);
+uint16_t design_filter(const uint8_t *filter, double fs, bqf_coeff_t *coefficients);
+uint32_t tlv_checksum(const tlv_header *tlv);
+const filter_configuration_tlv *default_filter_configuration();
+const tlv_header *default_configuration_tlv();
 
 #endif // CONFIGURATION_MANAGER_H
\ No newline at end of file
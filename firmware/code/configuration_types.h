@@ -33,17 +33,43 @@ enum structure_types {
     GET_STORED_CONFIGURATION,   // Retrieves the current stored configuration TLVs from Flash
     SAVE_CONFIGURATION,         // Writes the active configuration to Flash
     FACTORY_RESET,              // Invalidates the flash memory
+    GET_PRESETS,                // Lists the presets stored in Flash
+    SAVE_PRESET,                // Writes the active configuration to one of the preset slots in Flash
+    SELECT_PRESET,              // Makes a stored preset the active configuration
+    PRESET_HEADER,              // A special container for a preset stored in flash, see FLASH_HEADER
+    GET_STATUS,                 // Returns status TLVs describing what the DSP is doing right now
+    GET_FREQUENCY_RESPONSE,     // Evaluates the response of the filters the DSP is running at the requested frequencies
+    GET_STATS,                  // Returns how many cycles each core spends on each part of a packet, then starts counting again
+    GET_TRACE,                  // Returns a chunk of the recent events traced by one of the cores
 
     // Configuration structures, these are returned in the body of a command/response
     PREPROCESSING_CONFIGURATION = 0x200,
     FILTER_CONFIGURATION,
     PCM3060_CONFIGURATION,
+    LEFT_FILTER_CONFIGURATION,  // Same as FILTER_CONFIGURATION, but only applied to one channel
+    RIGHT_FILTER_CONFIGURATION,
+    CROSSFEED_CONFIGURATION,
+    LIMITER_CONFIGURATION,
+    QUANTIZER_CONFIGURATION,
+    LOUDNESS_CONFIGURATION,
 
     // Status structures, these are returned in the body of a command/response but they are
     // not persisted as part of the configuration
     VERSION_STATUS = 0x400,
+    PRESET_STATUS,
+    LIMITER_STATUS,
+    FREQUENCY_RESPONSE,
+    FILTER_CHAIN_STATUS,
+    CYCLE_STATS,
+    TRACE,
+    RING_STATUS,
 };
 
+#define PRESET_COUNT 8
+#define PRESET_NAME_LENGTH 16
+// Limited by the size of the result buffer
+#define FREQUENCY_RESPONSE_MAX_POINTS 60
+
 typedef struct __attribute__((__packed__)) _tlv_header {
     uint16_t type;
     uint16_t length;
@@ -78,6 +104,17 @@ typedef struct __attribute__((__packed__)) _filter6 {
     double b2;
 } filter6;
 
+// A linear phase (symmetric) FIR filter. Only the first (taps + 1) / 2
+// coefficients are sent, the rest are their mirror image. Limited to
+// FIR_MAX_TAPS taps, fewer if the rest of the chain leaves no room for them,
+// and one FIR filter per channel.
+typedef struct __attribute__((__packed__)) _filter_fir {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t taps;
+    float coefficients[0];
+} filter_fir;
+
 enum filter_type {
     LOWPASS = 0,
     HIGHPASS,
@@ -88,7 +125,8 @@ enum filter_type {
     PEAKING,
     LOWSHELF,
     HIGHSHELF,
-    CUSTOMIIR
+    CUSTOMIIR,
+    FIR
 };
 
 typedef struct __attribute__((__packed__)) _flash_header_tlv {
@@ -98,6 +136,21 @@ typedef struct __attribute__((__packed__)) _flash_header_tlv {
     const uint8_t tlvs[0];
 } flash_header_tlv;
 
+typedef struct __attribute__((__packed__)) _preset_header_tlv {
+    tlv_header header;
+    uint32_t magic;
+    uint32_t version;
+    char name[PRESET_NAME_LENGTH];
+    const uint8_t tlvs[0];
+} preset_header_tlv;
+
+enum mid_side_flags {
+    /// @brief Convert L/R to M/S before the filters, the left chain then filters mid and the right chain side.
+    MID_SIDE_ENCODE = 1,
+    /// @brief Convert the output of the filters from M/S back to L/R.
+    MID_SIDE_DECODE = 2
+};
+
 /// @brief Holds values relating to processing surrounding the EQ calculation.
 typedef struct __attribute__((__packed__)) _preprocessing_configuration_tlv {
     tlv_header header;
@@ -106,9 +159,63 @@ typedef struct __attribute__((__packed__)) _preprocessing_configuration_tlv {
     /// @brief Gain applied to the output of the EQ chain. Used to set output volume.
     float postEQGain;
     uint8_t reverse_stereo;
-    uint8_t reserved[3];
+    /// @brief A combination of mid_side_flags.
+    uint8_t mid_side;
+    /// @brief Samples over which changes to the filter coefficients are spread, 0 to step
+    ///        straight to the new ones.
+    uint16_t filter_ramp;
 } preprocessing_configuration_tlv;
 
+/// @brief Mixes a low passed and delayed copy of each channel into the other, like speakers in a room.
+typedef struct __attribute__((__packed__)) _crossfeed_configuration_tlv {
+    tlv_header header;
+    uint8_t enabled;
+    uint8_t reserved[3];
+    /// @brief Cutoff frequency in Hz of the low pass applied to the opposite channel.
+    float f0;
+    /// @brief Level of the opposite channel in dB, relative to the channel itself.
+    float db_gain;
+    /// @brief Delay of the opposite channel in microseconds.
+    float delay;
+} crossfeed_configuration_tlv;
+
+/// @brief A lookahead peak limiter on the output of each filter chain, before the conversion
+///        to 24-bit. The channels are limited independently, and with M/S enabled this is
+///        the mid and side before they are decoded.
+typedef struct __attribute__((__packed__)) _limiter_configuration_tlv {
+    tlv_header header;
+    uint8_t enabled;
+    uint8_t reserved[3];
+    /// @brief Highest output level in dB relative to full scale, 0 or below.
+    float threshold;
+    /// @brief How far ahead to look for peaks in microseconds, this is also the added latency.
+    float lookahead;
+    /// @brief Release time constant in milliseconds.
+    float release;
+} limiter_configuration_tlv;
+
+/// @brief How the output is cut down to the 24 bits the DAC takes.
+typedef struct __attribute__((__packed__)) _quantizer_configuration_tlv {
+    tlv_header header;
+    /// @brief One of quantizer_mode, see quantizer.h.
+    uint8_t mode;
+    /// @brief Order of the noise shaping, 0 (off), 1 or 2.
+    uint8_t noise_shaping;
+    uint8_t reserved[2];
+} quantizer_configuration_tlv;
+
+/// @brief Bass and treble shelves that follow the host volume, so the balance
+///        of the sound holds up as it is turned down.
+typedef struct __attribute__((__packed__)) _loudness_configuration_tlv {
+    tlv_header header;
+    uint8_t enabled;
+    uint8_t reserved[3];
+    /// @brief Volume in dB at which there is no compensation, 0 or below.
+    float reference;
+    /// @brief How much of the attenuation below the reference to compensate for, 0 to 1.
+    float strength;
+} loudness_configuration_tlv;
+
 typedef struct __attribute__((__packed__)) _filter_configuration_tlv {
     tlv_header header;
     const uint8_t filters[0];
@@ -131,6 +238,148 @@ typedef struct __attribute__((__packed__)) _version_status_tlv {
     const char version_strings[0];  // Firmware version\0Pico SDK version\0
 } version_status_tlv;
 
+typedef struct __attribute__((__packed__)) _preset_status_tlv {
+    tlv_header header;
+    uint8_t index;
+    uint8_t valid;
+    uint8_t active;
+    uint8_t reserved;
+    char name[PRESET_NAME_LENGTH];
+} preset_status_tlv;
+
+typedef struct __attribute__((__packed__)) _limiter_status_tlv {
+    tlv_header header;
+    uint8_t channel;            // 0 left, 1 right
+    uint8_t enabled;
+    uint8_t reserved[2];
+    /// @brief Samples that hit the 24-bit limits on the way out, these are clipped.
+    uint32_t clipped_samples;
+    /// @brief Packets during which the limiter was reducing the gain.
+    uint32_t limited_packets;
+    /// @brief Gain reduction in dB right now, and the most since the last GET_STATUS.
+    float gain_reduction;
+    float peak_gain_reduction;
+} limiter_status_tlv;
+
+/// @brief How full the I2S ring buffer has been since the last GET_STATUS, sampled on every
+///        USB packet and every DMA interrupt. The latencies are from a packet going into
+///        the ring to it reaching the DAC, at the lowest, mean and highest fill.
+typedef struct __attribute__((__packed__)) _ring_status_tlv {
+    tlv_header header;
+    /// @brief Size of the ring buffer in bytes, 8 bytes to a frame.
+    uint32_t capacity;
+    uint32_t samples;
+    uint32_t current;
+    uint32_t min;
+    /// @brief Weighted by how long each fill lasted.
+    uint32_t mean;
+    uint32_t max;
+    uint32_t min_latency;       // us
+    uint32_t mean_latency;      // us
+    uint32_t max_latency;       // us
+    /// @brief Samples by fill, each bin is capacity / 16 bytes wide.
+    uint32_t histogram[16];
+} ring_status_tlv;
+
+typedef struct __attribute__((__packed__)) _frequency_response_point {
+    float magnitude;            // dB
+    float phase;                // degrees
+} frequency_response_point;
+
+/// @brief Response of one filter chain, one point per requested frequency. This is the chain
+///        only, without the preamp or post-EQ gain. With M/S enabled the left chain filters mid.
+///        The points are worked out in the background, this has the first ready of them, and
+///        sending the same request again returns more until all of them are there.
+typedef struct __attribute__((__packed__)) _frequency_response_tlv {
+    tlv_header header;
+    uint8_t channel;            // 0 left, 1 right
+    uint8_t ready;              // Points that follow, fewer than requested while they are being worked out
+    uint8_t reserved[2];
+    frequency_response_point points[0];
+} frequency_response_tlv;
+
+/// @brief The body of a GET_FREQUENCY_RESPONSE command, up to FREQUENCY_RESPONSE_MAX_POINTS
+///        frequencies in Hz.
+typedef struct __attribute__((__packed__)) _frequency_response_cmd {
+    tlv_header header;
+    uint8_t channel;
+    uint8_t reserved[3];
+    float frequencies[0];
+} frequency_response_cmd;
+
+// A filter that does nothing, like a peaking filter at 0dB, does not get a stage
+#define FILTER_DROPPED 0xff
+#define FILTER_FIR 0xfe
+
+/// @brief How the filters in the configuration were compiled into the chain that runs.
+typedef struct __attribute__((__packed__)) _filter_chain_status_tlv {
+    tlv_header header;
+    uint8_t channel;            // 0 left, 1 right
+    uint8_t filters;            // Filters in the configuration
+    uint8_t stages;             // Biquads actually running
+    uint8_t reserved;
+    const uint8_t stage_map[0]; // For each filter in the configuration, the stage running it, FILTER_DROPPED or FILTER_FIR
+} filter_chain_status_tlv;
+
+/// @brief Cycles one core spent in one phase of the packets since the last GET_STATS.
+typedef struct __attribute__((__packed__)) _cycle_stats_tlv {
+    tlv_header header;
+    uint8_t core;
+    /// @brief One of stats_phase, see stats.h.
+    uint8_t phase;
+    uint8_t reserved[2];
+    uint32_t packets;
+    /// @brief Cycles each core has per packet, past this the audio drops out.
+    uint32_t budget;
+    uint32_t min;
+    uint32_t mean;
+    uint32_t max;
+    /// @brief Packets by cycles taken, each bin is budget / STATS_HISTOGRAM_BINS cycles wide and
+    ///        the last one also counts every packet that took longer.
+    uint32_t histogram[16];
+} cycle_stats_tlv;
+
+/// @brief The body of a GET_TRACE command.
+typedef struct __attribute__((__packed__)) _trace_cmd {
+    tlv_header header;
+    uint8_t core;
+    uint8_t reserved[3];
+    /// @brief Sequence number of the first event wanted. Events that have already been
+    ///        overwritten are skipped, so 0 starts from the oldest one still there.
+    uint32_t first;
+} trace_cmd;
+
+/// @brief Up to TRACE_CHUNK_EVENTS events traced by one core, ask again from first + the
+///        number of events for the next chunk.
+typedef struct __attribute__((__packed__)) _trace_tlv {
+    tlv_header header;
+    uint8_t core;
+    uint8_t reserved[3];
+    /// @brief Sequence number of the first event in this chunk.
+    uint32_t first;
+    /// @brief Events the core has traced so far.
+    uint32_t head;
+    /// @brief time_us_32() when the chunk was read.
+    uint32_t now;
+    /// @brief The time and event of each, see trace_event_t in trace.h. Bytes, as taking the
+    ///        address of a wider member of a packed struct is not allowed to assume alignment.
+    uint8_t events[0];
+} trace_tlv;
+
+/// @brief The body of a SAVE_PRESET command, the name does not need to be NULL terminated.
+typedef struct __attribute__((__packed__)) _save_preset_cmd {
+    tlv_header header;
+    uint8_t index;
+    uint8_t reserved[3];
+    char name[PRESET_NAME_LENGTH];
+} save_preset_cmd;
+
+typedef struct __attribute__((__packed__)) _select_preset_cmd {
+    tlv_header header;
+    uint8_t index;
+    uint8_t reserved[3];
+} select_preset_cmd;
+
 typedef struct __attribute__((__packed__)) _default_configuration {
     tlv_header set_configuration;
     const struct __attribute__((__packed__)) {
@@ -152,6 +401,10 @@ typedef struct __attribute__((__packed__)) _default_configuration {
         filter3 f15;
     } filters;
     preprocessing_configuration_tlv preprocessing;
+    crossfeed_configuration_tlv crossfeed;
+    limiter_configuration_tlv limiter;
+    quantizer_configuration_tlv quantizer;
+    loudness_configuration_tlv loudness;
 } default_configuration;
 
 #endif // __CONFIGURATION_TYPES_H__
\ No newline at end of file
@@ -0,0 +1,61 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "crossfeed.h"
+
+crossfeed_t crossfeed_left;
+crossfeed_t crossfeed_right;
+
+/**
+ * Configure a crossfeed. Parameters are as follows:
+ *
+ * fs: The sampling frequency.
+ *
+ * f0: The cutoff frequency of the low pass applied to the opposite channel.
+ * Your head shadows high frequencies, something like 700Hz works well.
+ *
+ * dBgain: The level of the opposite channel relative to the channel itself.
+ * Somewhere between -4.5dB and -9.5dB is typical.
+ *
+ * delay_us: How late the opposite channel arrives, in microseconds. This is
+ * the extra distance to the far ear, about 300us.
+ *
+ * The channel itself is attenuated so the low frequencies of a mono signal
+ * come out at the same level as they went in.
+ */
+void crossfeed_config(double fs, double f0, double dBgain, double delay_us, crossfeed_t *crossfeed) {
+    const double gain = pow(10.0, dBgain / 20.0);
+    const double direct = 1.0 / (1.0 + gain);
+
+    bqf_lowpass_config(fs, f0, Q_LINKWITZ_RILEY, &crossfeed->filter);
+    crossfeed->filter.b0 = fix3_28_from_dbl(gain * direct * crossfeed->filter.b0 / (double)fix16_one);
+    crossfeed->filter.b1 = fix3_28_from_dbl(gain * direct * crossfeed->filter.b1 / (double)fix16_one);
+    crossfeed->filter.b2 = fix3_28_from_dbl(gain * direct * crossfeed->filter.b2 / (double)fix16_one);
+    crossfeed->direct_gain = fix3_28_from_dbl(direct);
+
+    long delay = lround(delay_us * fs / 1000000.0);
+    if (delay < 0) delay = 0;
+    if (delay > CROSSFEED_MAX_DELAY - 1) delay = CROSSFEED_MAX_DELAY - 1;
+    crossfeed->delay = (uint32_t)delay;
+}
+
+void crossfeed_memreset(crossfeed_t *crossfeed) {
+    bqf_memreset(&crossfeed->filter_mem);
+    memset(crossfeed->delay_line, 0, sizeof(crossfeed->delay_line));
+    crossfeed->position = 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CROSSFEED_H
+#define CROSSFEED_H
+
+#include <stdbool.h>
+#include "fix16.h"
+#include "bqf.h"
+
+// Must be a power of two. 32 samples is ~660us at 48kHz, a crossfeed delay is
+// usually somewhere around 300us.
+#define CROSSFEED_MAX_DELAY 32
+
+/// @brief Mixes a low passed and delayed copy of the opposite channel into a
+///        channel. Each core owns one of these, for the channel it processes.
+typedef struct _crossfeed_t {
+    bool enabled;
+    /// @brief Gain applied to the channel itself, so a mono signal keeps its level.
+    fix3_28_t direct_gain;
+    /// @brief Low pass for the opposite channel, with the crossfeed gain folded in.
+    bqf_coeff_t filter;
+    bqf_mem_t filter_mem;
+    uint32_t delay;
+    uint32_t position;
+    fix3_28_t delay_line[CROSSFEED_MAX_DELAY];
+} crossfeed_t;
+
+extern crossfeed_t crossfeed_left;
+extern crossfeed_t crossfeed_right;
+
+void crossfeed_config(double, double, double, double, crossfeed_t *);
+void crossfeed_memreset(crossfeed_t *);
+
+static inline fix3_28_t crossfeed_transform(fix3_28_t, fix3_28_t, crossfeed_t *);
+
+#include "crossfeed.inl"
+#endif
@@ -0,0 +1,28 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// @brief Applies the crossfeed to one sample.
+/// @param x The sample of the channel being processed.
+/// @param opposite The sample of the other channel, at the same point in time.
+/// @param crossfeed The crossfeed state for the channel being processed.
+/// @return x with the crossfeed mixed in.
+static inline fix3_28_t crossfeed_transform(fix3_28_t x, fix3_28_t opposite, crossfeed_t *crossfeed) {
+    crossfeed->delay_line[crossfeed->position] = bqf_transform(opposite, &crossfeed->filter,
+        &crossfeed->filter_mem);
+    fix3_28_t delayed = crossfeed->delay_line[(crossfeed->position - crossfeed->delay) & (CROSSFEED_MAX_DELAY - 1)];
+    crossfeed->position = (crossfeed->position + 1) & (CROSSFEED_MAX_DELAY - 1);
+
+    return fix16_mul(x, crossfeed->direct_gain) + delayed;
+}
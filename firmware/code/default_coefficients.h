@@ -0,0 +1,91 @@
+/**
+ * This file is generated by tools/coeff_gen from default_config in
+ * configuration_manager.c, do not edit it by hand. Rebuild the
+ * default_coefficients target in the tools directory after changing the
+ * default filters.
+ */
+#ifndef DEFAULT_COEFFICIENTS_H
+#define DEFAULT_COEFFICIENTS_H
+
+#include "bqf.h"
+
+#define DEFAULT_FILTER_STAGES 15
+
+// Checksum of the default filter TLV these tables were generated from, if
+// they no longer match the firmware falls back to designing the filters.
+#define DEFAULT_FILTER_CHECKSUM 0x1c590e9a
+
+typedef struct _default_coefficients_t {
+    uint32_t fs;
+    bqf_coeff_t coefficients[DEFAULT_FILTER_STAGES];
+} default_coefficients_t;
+
+// { a0, a1, a2, b0, b1, b2 } in Q3.28
+static const default_coefficients_t default_coefficients[] = {
+    { 44100, {
+        // PEAKING f0=38.5 gain=-21dB Q=1.4
+        { 268435456, -533362863, 264935431, 266841414, -533362863, 266529474 },
+        // PEAKING f0=60 gain=-6.7dB Q=0.5
+        { 268435456, -530186059, 261769976, 266643712, -530186059, 263561720 },
+        // LOWSHELF f0=105 gain=2dB Q=0.71
+        { 268435456, -531531003, 263148562, 268761437, -531524140, 262829444 },
+        // PEAKING f0=280 gain=-3.5dB Q=1.1
+        { 268435456, -524806242, 256788670, 266504092, -524806242, 258720034 },
+        // PEAKING f0=350 gain=-1.6dB Q=6
+        { 268435456, -533772431, 266001322, 268230701, -533772431, 266206077 },
+        // PEAKING f0=425 gain=7.8dB Q=1.3
+        { 268435456, -528042563, 260576641, 274151600, -528042563, 254860497 },
+        // PEAKING f0=500 gain=-2dB Q=7
+        { 268435456, -532471747, 265390259, 268122301, -532471747, 265703415 },
+        // PEAKING f0=690 gain=-5.5dB Q=3
+        { 268435456, -522546899, 256646736, 265670320, -522546899, 259411872 },
+        // PEAKING f0=1000 gain=-2.2dB Q=5
+        { 268435456, -523002085, 259920207, 267482800, -523002085, 260872863 },
+        // PEAKING f0=1530 gain=-4dB Q=2.5
+        { 268435456, -497097423, 240711157, 263319732, -497097423, 245826881 },
+        // PEAKING f0=2250 gain=6dB Q=2
+        { 268435456, -482605568, 240075840, 282548084, -482605568, 225963212 },
+        // PEAKING f0=3430 gain=-12.2dB Q=2
+        { 268435456, -383242118, 165613089, 229644222, -383242118, 204404323 },
+        // PEAKING f0=4800 gain=4dB Q=2
+        { 268435456, -369750745, 208585614, 285938338, -369750745, 191082732 },
+        // PEAKING f0=6200 gain=-15dB Q=3
+        { 268435456, -260965182, 142814827, 216794570, -260965182, 194455713 },
+        // HIGHSHELF f0=12000 gain=-3dB Q=0.71
+        { 268435456, 16695323, 46770801, 229061566, 60286012, 42554002 },
+    } },
+    { 48000, {
+        // PEAKING f0=38.5 gain=-21dB Q=1.4
+        { 268435456, -533646781, 265218102, 266970152, -533646781, 266683405 },
+        // PEAKING f0=60 gain=-6.7dB Q=0.5
+        { 268435456, -530724438, 262305351, 266787626, -530724438, 263953182 },
+        // LOWSHELF f0=105 gain=2dB Q=0.71
+        { 268435456, -531964879, 263574209, 268734936, -531959081, 263280527 },
+        // PEAKING f0=280 gain=-3.5dB Q=1.1
+        { 268435456, -525797733, 257715643, 266657810, -525797733, 259493289 },
+        // PEAKING f0=350 gain=-1.6dB Q=6
+        { 268435456, -534072583, 266198128, 268247256, -534072583, 266386328 },
+        // PEAKING f0=425 gain=7.8dB Q=1.3
+        { 268435456, -528821951, 261205893, 273693911, -528821951, 255947437 },
+        // PEAKING f0=500 gain=-2dB Q=7
+        { 268435456, -532927992, 265636024, 268147574, -532927992, 265923906 },
+        // PEAKING f0=690 gain=-5.5dB Q=3
+        { 268435456, -523873868, 257582540, 265889820, -523873868, 260128176 },
+        // PEAKING f0=1000 gain=-2.2dB Q=5
+        { 268435456, -524507401, 260597899, 267558618, -524507401, 261474737 },
+        // PEAKING f0=1530 gain=-4dB Q=2.5
+        { 268435456, -501042403, 242826250, 263710011, -501042403, 247551694 },
+        // PEAKING f0=2250 gain=6dB Q=2
+        { 268435456, -488648409, 242200777, 281490649, -488648409, 229145584 },
+        // PEAKING f0=3430 gain=-12.2dB Q=2
+        { 268435456, -396761964, 171976769, 232045013, -396761964, 208367213 },
+        // PEAKING f0=4800 gain=4dB Q=2
+        { 268435456, -388939295, 212319951, 284846244, -388939295, 195909163 },
+        // PEAKING f0=6200 gain=-15dB Q=3
+        { 268435456, -287215918, 148814503, 219260953, -287215918, 197989005 },
+        // HIGHSHELF f0=12000 gain=-3dB Q=0.71
+        { 268435456, -27175641, 47072488, 225860289, 22865452, 39606562 },
+    } },
+};
+
+#endif // DEFAULT_COEFFICIENTS_H
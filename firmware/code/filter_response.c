@@ -0,0 +1,182 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+
+#include "filter_response.h"
+
+/// @brief Frequency of point i on the log grid, stopping short of Nyquist at low sample rates.
+double response_frequency(double fs, int i) {
+    const double max_freq = fmin(RESPONSE_MAX_FREQ, 0.45 * fs);
+    return RESPONSE_MIN_FREQ * pow(max_freq / RESPONSE_MIN_FREQ, (double) i / (RESPONSE_POINTS - 1));
+}
+
+/// @brief Linear magnitude of one biquad at frequency f, using the fixed point
+///        coefficients the DSP actually runs with.
+double bqf_magnitude(const bqf_coeff_t *coefficients, double fs, double f) {
+    const double w = 2.0 * M_PI * f / fs;
+    const double c1 = cos(w), s1 = sin(w);
+    const double c2 = cos(2.0 * w), s2 = sin(2.0 * w);
+    const double b0 = (double) coefficients->b0 / fix16_one;
+    const double b1 = (double) coefficients->b1 / fix16_one;
+    const double b2 = (double) coefficients->b2 / fix16_one;
+    const double a1 = (double) coefficients->a1 / fix16_one;
+    const double a2 = (double) coefficients->a2 / fix16_one;
+
+    // H(e^jw) = (b0 + b1 e^-jw + b2 e^-2jw) / (1 + a1 e^-jw + a2 e^-2jw)
+    const double num_re = b0 + b1 * c1 + b2 * c2;
+    const double num_im = -(b1 * s1 + b2 * s2);
+    const double den_re = 1.0 + a1 * c1 + a2 * c2;
+    const double den_im = -(a1 * s1 + a2 * s2);
+    return sqrt((num_re * num_re + num_im * num_im) / (den_re * den_re + den_im * den_im));
+}
+
+/// @brief Linear magnitude of a chain of biquads at frequency f.
+double chain_magnitude(const bqf_coeff_t *filters, int stages, double fs, double f) {
+    double magnitude = 1.0;
+    for (int j = 0; j < stages; j++) {
+        magnitude *= bqf_magnitude(&filters[j], fs, f);
+    }
+    return magnitude;
+}
+
+static double to_db(double magnitude) {
+    return 20.0 * log10(magnitude);
+}
+
+/**
+ * Works out how much the signal can grow inside a filter chain. The peak is
+ * taken over the RESPONSE_POINTS grid, so a very narrow peak between grid
+ * points can be underestimated slightly.
+ *
+ * The order is picked greedily: at each step the stage that keeps the running
+ * peak lowest goes next, which tends to put the cuts before the boosts. The
+ * response of the whole chain does not depend on the order.
+ */
+void analyse_gain_staging(const bqf_coeff_t *filters, int stages, double fs, gain_staging_t *result) {
+    double magnitude[MAX_FILTER_STAGES][RESPONSE_POINTS];
+    double running[RESPONSE_POINTS];
+    bool used[MAX_FILTER_STAGES] = { false };
+
+    result->stages = stages;
+    for (int j = 0; j < stages; j++) {
+        for (int i = 0; i < RESPONSE_POINTS; i++) {
+            magnitude[j][i] = bqf_magnitude(&filters[j], fs, response_frequency(fs, i));
+        }
+    }
+
+    // As configured
+    for (int i = 0; i < RESPONSE_POINTS; i++) running[i] = 1.0;
+    double chain_peak = 1.0, peak = 1.0;
+    for (int j = 0; j < stages; j++) {
+        peak = 0.0;
+        for (int i = 0; i < RESPONSE_POINTS; i++) {
+            running[i] *= magnitude[j][i];
+            peak = fmax(peak, running[i]);
+        }
+        result->stage_peak[j] = to_db(peak);
+        chain_peak = fmax(chain_peak, peak);
+    }
+    result->chain_peak = to_db(chain_peak);
+    result->output_peak = to_db(peak);
+
+    // Greedy reorder
+    for (int i = 0; i < RESPONSE_POINTS; i++) running[i] = 1.0;
+    chain_peak = 1.0;
+    for (int n = 0; n < stages; n++) {
+        int best = -1;
+        double best_peak = INFINITY;
+        for (int j = 0; j < stages; j++) {
+            if (used[j]) continue;
+            double candidate = 0.0;
+            for (int i = 0; i < RESPONSE_POINTS; i++) {
+                candidate = fmax(candidate, running[i] * magnitude[j][i]);
+            }
+            if (candidate < best_peak) {
+                best = j;
+                best_peak = candidate;
+            }
+        }
+        used[best] = true;
+        for (int i = 0; i < RESPONSE_POINTS; i++) running[i] *= magnitude[best][i];
+        result->order[n] = best;
+        result->ordered_stage_peak[n] = to_db(best_peak);
+        chain_peak = fmax(chain_peak, best_peak);
+    }
+    result->ordered_chain_peak = to_db(chain_peak);
+}
+
+/**
+ * Magnitude in dB and phase in degrees of a chain of biquads at frequency f.
+ * The numerators and denominators are multiplied out separately so there is
+ * only one divide and one atan2 per call, whatever the number of stages.
+ */
+void chain_response(const bqf_coeff_t *filters, int stages, double fs, double f,
+        double *magnitude_db, double *phase_deg) {
+    const double w = 2.0 * M_PI * f / fs;
+    const double c1 = cos(w), s1 = sin(w);
+    const double c2 = cos(2.0 * w), s2 = sin(2.0 * w);
+    double num_re = 1.0, num_im = 0.0;
+    double den_re = 1.0, den_im = 0.0;
+
+    for (int j = 0; j < stages; j++) {
+        const bqf_coeff_t *c = &filters[j];
+        const double b0 = (double) c->b0 / fix16_one;
+        const double b1 = (double) c->b1 / fix16_one;
+        const double b2 = (double) c->b2 / fix16_one;
+        const double a1 = (double) c->a1 / fix16_one;
+        const double a2 = (double) c->a2 / fix16_one;
+
+        const double n_re = b0 + b1 * c1 + b2 * c2;
+        const double n_im = -(b1 * s1 + b2 * s2);
+        const double d_re = 1.0 + a1 * c1 + a2 * c2;
+        const double d_im = -(a1 * s1 + a2 * s2);
+
+        double re = num_re * n_re - num_im * n_im;
+        num_im = num_re * n_im + num_im * n_re;
+        num_re = re;
+        re = den_re * d_re - den_im * d_im;
+        den_im = den_re * d_im + den_im * d_re;
+        den_re = re;
+    }
+
+    // H = N / D = N * conj(D) / |D|^2
+    const double re = num_re * den_re + num_im * den_im;
+    const double im = num_im * den_re - num_re * den_im;
+    *magnitude_db = 10.0 * log10((num_re * num_re + num_im * num_im) / (den_re * den_re + den_im * den_im));
+    *phase_deg = atan2(im, re) * 180.0 / M_PI;
+}
+
+/**
+ * Magnitude in dB and phase in degrees of a symmetric FIR filter at frequency f,
+ * given the first (taps + 1) / 2 coefficients, doubled as fir_config() stores them.
+ * The response is a real amplitude times a pure delay of (taps - 1) / 2 samples.
+ */
+void fir_response(const fix3_28_t *coefficients, int taps, double fs, double f,
+        double *magnitude_db, double *phase_deg) {
+    const double w = 2.0 * M_PI * f / fs;
+    const double centre = (taps - 1) / 2.0;
+    double amplitude = 0.0;
+    for (int k = 0; k < taps / 2; k++) {
+        amplitude += (double) coefficients[k] / fix16_one * cos(w * (centre - k));
+    }
+    if (taps & 1) {
+        amplitude += 0.5 * coefficients[taps / 2] / fix16_one;
+    }
+    double phase = -w * centre + (amplitude < 0 ? M_PI : 0.0);
+    *magnitude_db = 20.0 * log10(fabs(amplitude));
+    *phase_deg = remainder(phase, 2.0 * M_PI) * 180.0 / M_PI;
+}
@@ -0,0 +1,51 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FILTER_RESPONSE_H
+#define FILTER_RESPONSE_H
+
+#include "bqf.h"
+
+// Points on the log frequency grid the response is evaluated at.
+#define RESPONSE_POINTS 64
+#define RESPONSE_MIN_FREQ 20.0
+#define RESPONSE_MAX_FREQ 20000.0
+
+/// @brief Headroom needed by a filter chain, worked out from its magnitude response.
+///        Gains are in dB and include every stage up to and including that one.
+typedef struct _gain_staging_t {
+    int stages;
+    /// @brief Peak gain after each stage, in the order they are configured.
+    double stage_peak[MAX_FILTER_STAGES];
+    /// @brief Peak gain anywhere inside the chain, this is what the preamp has to make room for.
+    double chain_peak;
+    /// @brief Peak gain of the output of the whole chain.
+    double output_peak;
+    /// @brief A stage order that keeps the peak inside the chain as low as possible, as
+    ///        indexes into the configured order, and the peak gain after each stage.
+    int order[MAX_FILTER_STAGES];
+    double ordered_stage_peak[MAX_FILTER_STAGES];
+    double ordered_chain_peak;
+} gain_staging_t;
+
+double response_frequency(double, int);
+double bqf_magnitude(const bqf_coeff_t *, double, double);
+double chain_magnitude(const bqf_coeff_t *, int, double, double);
+void analyse_gain_staging(const bqf_coeff_t *, int, double, gain_staging_t *);
+void chain_response(const bqf_coeff_t *, int, double, double, double *, double *);
+void fir_response(const fix3_28_t *, int, double, double, double *, double *);
+
+#endif
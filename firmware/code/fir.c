@@ -0,0 +1,38 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "fir.h"
+
+fir_filter_t fir_left;
+fir_filter_t fir_right;
+
+void fir_memreset(fir_filter_t *fir) {
+    memset(fir->history, 0, sizeof(fir->history));
+}
+
+/// @brief Loads the first (taps + 1) / 2 coefficients of a symmetric FIR filter. The
+///        history is kept when only the coefficients change.
+void fir_config(const float *coefficients, int taps, fir_filter_t *fir) {
+    if (taps != fir->taps) {
+        fir_memreset(fir);
+    }
+    for (int k = 0; k < (taps + 1) / 2; k++) {
+        fir->coefficients[k] = fix3_28_from_dbl(2.0 * coefficients[k]);
+    }
+    fir->taps = taps;
+}
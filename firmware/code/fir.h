@@ -0,0 +1,58 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FIR_H
+#define FIR_H
+
+#include "fix16.h"
+#include "bqf.h"
+
+// Linear phase FIR filters are symmetric, only the first half of the taps are
+// stored and each multiply covers a pair of samples. This is the room in the
+// filter, how many taps a channel can run is down to its cycle budget, see
+// validate_configuration().
+#define FIR_MAX_TAPS 256
+// The taps are stored doubled, see fir_filter_t, so they have to fit in half the Q3.28 range.
+#define FIR_MAX_COEFFICIENT 3.99
+
+// Samples per channel in the largest USB packet, with some to spare. The DSP
+// runs each packet through the chain one stage at a time, in blocks of this size.
+#define MAX_BLOCK_SAMPLES 64
+
+typedef struct _fir_filter_t {
+    /// @brief Zero when the chain has no FIR filter.
+    int taps;
+    /// @brief Biquad stages that run before the FIR filter.
+    int position;
+    /// @brief Twice the first (taps + 1) / 2 taps. Each pair of samples is added at half
+    ///        scale, so the sum cannot overflow even at the edges of the Q3.28 range.
+    fix3_28_t coefficients[(FIR_MAX_TAPS + 1) / 2];
+    /// @brief The last FIR_MAX_TAPS - 1 inputs, followed by the block being filtered.
+    fix3_28_t history[FIR_MAX_TAPS - 1 + MAX_BLOCK_SAMPLES];
+} fir_filter_t;
+
+extern fir_filter_t fir_left;
+extern fir_filter_t fir_right;
+
+void fir_config(const float *, int, fir_filter_t *);
+void fir_memreset(fir_filter_t *);
+
+static inline void fir_transform_block(fix3_28_t *, int, fir_filter_t *);
+static inline void filter_chain_transform(fix3_28_t *, int, bqf_coeff_t *, bqf_mem_t *, int, fir_filter_t *,
+    bqf_ramp_t *);
+
+#include "fir.inl"
+#endif
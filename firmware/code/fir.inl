@@ -0,0 +1,73 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+/// @brief Filters a block of samples in place.
+/// @param block The samples, they are replaced with the filter output.
+/// @param samples Number of samples in the block, at most MAX_BLOCK_SAMPLES.
+/// @param fir The filter.
+static inline void fir_transform_block(fix3_28_t *block, int samples, fir_filter_t *fir) {
+    fix3_28_t *const input = &fir->history[FIR_MAX_TAPS - 1];
+    const int taps = fir->taps;
+    const int pairs = taps / 2;
+    const fix3_28_t *const coefficients = fir->coefficients;
+
+    memcpy(input, block, samples * sizeof(fix3_28_t));
+
+    for (int n = 0; n < samples; n++) {
+        // oldest and newest sample under the filter
+        const fix3_28_t *first = &input[n - (taps - 1)];
+        const fix3_28_t *last = &input[n];
+        fix3_28_t y = 0;
+        // The samples are halved before they are added, the coefficients are doubled to make up for it.
+        for (int k = 0; k < pairs; k++) {
+            y += fix16_mul(coefficients[k], (*first++ >> 1) + (*last-- >> 1));
+        }
+        if (taps & 1) {
+            y += fix16_mul(coefficients[pairs], *first >> 1);
+        }
+        block[n] = y;
+    }
+
+    memmove(fir->history, &fir->history[samples], (FIR_MAX_TAPS - 1) * sizeof(fix3_28_t));
+}
+
+/// @brief Runs a block of samples through a whole filter chain, one stage at a time.
+///        While the chain is ramping to new coefficients the first samples of the
+///        block move them along, the stages land on their targets together.
+static inline void filter_chain_transform(fix3_28_t *block, int samples, bqf_coeff_t *filters,
+        bqf_mem_t *memory, int stages, fir_filter_t *fir, bqf_ramp_t *ramp) {
+    const int ramping = ramp->remaining < samples ? ramp->remaining : samples;
+    for (int j = 0; j <= stages; j++) {
+        if (fir->taps && j == fir->position) {
+            fir_transform_block(block, samples, fir);
+        }
+        if (j == stages) break;
+        int n = 0;
+        if (ramping) {
+            for (; n < ramping; n++) {
+                block[n] = bqf_ramp_transform(block[n], &filters[j], &ramp->step[j], &memory[j]);
+            }
+            // The steps are rounded, finish exactly on the target.
+            if (ramping == ramp->remaining) filters[j] = ramp->target[j];
+        }
+        for (; n < samples; n++) {
+            block[n] = bqf_transform(block[n], &filters[j], &memory[j]);
+        }
+    }
+    ramp->remaining -= ramping;
+}
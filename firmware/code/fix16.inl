@@ -63,7 +63,7 @@ static inline int32_t norm_fix3_28_to_s16sample(fix3_28_t a) {
         }
     } else {
         if (upper) {
-            return 0x00efffff;
+            return 0x007fffff;
         }
     }
     /* When we converted the USB audio sample to a fixed point number, we applied
@@ -72,6 +72,19 @@ static inline int32_t norm_fix3_28_to_s16sample(fix3_28_t a) {
     return (a >> 6);
 }
 
+/// @brief Clamps a sample to the range of the signed 24-bit samples we send to the DAC.
+/// @param a
+/// @return Signed 24-bit integer.
+static inline int32_t saturate_s24sample(int32_t a) {
+    if (a > 0x007fffff) {
+        return 0x007fffff;
+    }
+    if (a < (int32_t)0xff800000) {
+        return 0xff800000;
+    }
+    return a;
+}
+
 static inline fix3_28_t fix3_28_from_flt(float a) {
     float temp = a * fix16_one;
     temp += ((temp >= 0) ? 0.5f : -0.5f);
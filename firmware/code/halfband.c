@@ -0,0 +1,66 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "halfband.h"
+
+halfband_t halfband_left;
+halfband_t halfband_right;
+
+// Kaiser window shape. 8 puts the images 82dB down with 16 pairs, the
+// Blackman window of the same length only gets them 75dB down.
+#define HALFBAND_KAISER_BETA 8.0
+
+/// @brief Modified Bessel function of the first kind and order zero, by its power series.
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/**
+ * Designs the interpolation filter, a Kaiser windowed sinc. The taps that are
+ * not zero sit half way between the input samples, the window spans
+ * 4 * HALFBAND_PAIRS - 1 taps at the output rate. At 48kHz the response is
+ * within 0.001dB to 20kHz and the images of everything below 19kHz are more
+ * than 82dB down.
+ */
+void halfband_config(halfband_t *halfband) {
+    double taps[HALFBAND_PAIRS];
+    double sum = 0.0;
+    for (int k = 0; k < HALFBAND_PAIRS; k++) {
+        // Distance from the centre, in input samples.
+        const double d = HALFBAND_PAIRS - 0.5 - k;
+        const double x = d / HALFBAND_PAIRS;
+        const double window = bessel_i0(HALFBAND_KAISER_BETA * sqrt(1.0 - x * x)) /
+            bessel_i0(HALFBAND_KAISER_BETA);
+        taps[k] = sin(M_PI * d) / (M_PI * d) * window;
+        sum += 2.0 * taps[k];
+    }
+    for (int k = 0; k < HALFBAND_PAIRS; k++) {
+        halfband->coefficients[k] = fix3_28_from_dbl(taps[k] / sum);
+    }
+    halfband_memreset(halfband);
+}
+
+void halfband_memreset(halfband_t *halfband) {
+    memset(halfband->history, 0, sizeof(halfband->history));
+}
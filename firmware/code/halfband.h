@@ -0,0 +1,45 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+#include "fix16.h"
+#include "fir.h"
+
+// Pairs of taps in the half band filter. Every other tap of a half band
+// filter is zero and the centre one is 0.5, so doubling the sample rate only
+// takes HALFBAND_PAIRS multiplies per input sample: one output sample is a
+// copy of the input, the other is the symmetric sum in between.
+#define HALFBAND_PAIRS 16
+#define HALFBAND_HISTORY (2 * HALFBAND_PAIRS - 1)
+
+typedef struct _halfband_t {
+    fix3_28_t coefficients[HALFBAND_PAIRS];
+    /// @brief The last HALFBAND_HISTORY inputs, followed by the block being interpolated.
+    fix3_28_t history[HALFBAND_HISTORY + MAX_BLOCK_SAMPLES];
+} halfband_t;
+
+extern halfband_t halfband_left;
+extern halfband_t halfband_right;
+
+void halfband_config(halfband_t *);
+void halfband_memreset(halfband_t *);
+
+static inline void halfband_interpolate(const fix3_28_t *, int, fix3_28_t *, halfband_t *);
+
+#include "halfband.inl"
+#endif
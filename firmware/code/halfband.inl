@@ -0,0 +1,43 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+/// @brief Doubles the sample rate of a block.
+/// @param block The input samples.
+/// @param samples Number of input samples, at most MAX_BLOCK_SAMPLES.
+/// @param output Receives 2 * samples samples. The output lags the input by
+///        HALFBAND_PAIRS - 0.5 input samples.
+/// @param halfband The filter.
+static inline void halfband_interpolate(const fix3_28_t *block, int samples, fix3_28_t *output, halfband_t *halfband) {
+    fix3_28_t *const input = &halfband->history[HALFBAND_HISTORY];
+    const fix3_28_t *const coefficients = halfband->coefficients;
+
+    memcpy(input, block, samples * sizeof(fix3_28_t));
+
+    for (int n = 0; n < samples; n++) {
+        const fix3_28_t *first = &input[n - HALFBAND_HISTORY];
+        const fix3_28_t *last = &input[n];
+        fix3_28_t y = 0;
+        for (int k = 0; k < HALFBAND_PAIRS; k++) {
+            y += fix16_mul(coefficients[k], *first++ + *last--);
+        }
+        *output++ = y;
+        *output++ = input[n - HALFBAND_PAIRS + 1];
+    }
+
+    memmove(halfband->history, &halfband->history[samples], HALFBAND_HISTORY * sizeof(fix3_28_t));
+}
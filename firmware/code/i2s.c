@@ -37,6 +37,8 @@
 #include "ringbuf.h"
 #include "i2s.h"
 #include "i2s.pio.h"
+#include "trace.h"
+#include "stats.h"
 
 void i2s_write_init(i2s_obj_t *self) {
     self->pio = pio1;
@@ -107,6 +109,7 @@ void dma_irq_write_handler() {
     }
 
     feed_dma(self, dma_buffer);
+    stats_ring_sample(ringbuf_available_data(&self->ring_buffer));
     dma_irqn_acknowledge_channel(1, dma_channel);
     dma_channel_set_read_addr(dma_channel, dma_buffer, false);
 }
@@ -173,6 +176,7 @@ void feed_dma(i2s_obj_t *self, uint8_t *dma_buffer_p) {
             ringbuf_pop(&self->ring_buffer, &dma_buffer_p[i]);
     } else {
         // underflow.  clear buffer to transmit "silence" on the I2S bus
+        trace(TRACE_UNDERRUN, ringbuf_available_data(&self->ring_buffer));
         memset(dma_buffer_p, 0, SIZEOF_HALF_DMA_BUFFER_IN_BYTES);
     }
 }
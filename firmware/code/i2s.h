@@ -31,7 +31,14 @@
 
 #define SAMPLES_PER_FRAME 2
 #define PIO_INSTRUCTIONS_PER_BIT 2
-#define RINGBUF_LEN_IN_BYTES 16384
+// Set OUTPUT_OVERSAMPLING to 2 to run the DAC at twice the USB sampling rate,
+// see run.h. The EQ still runs at the USB rate, the output is interpolated.
+#ifndef OUTPUT_OVERSAMPLING
+#define OUTPUT_OVERSAMPLING 1
+#endif
+
+// Holds the same length of audio whatever the output rate.
+#define RINGBUF_LEN_IN_BYTES (16384 * OUTPUT_OVERSAMPLING)
 #define I2S_NUM_DMA_CHANNELS 2
 
 #define SIZEOF_DMA_BUFFER_IN_BYTES 768
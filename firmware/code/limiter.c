@@ -0,0 +1,63 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "limiter.h"
+
+// Start at unity gain, 0x10000000 is fix16_one.
+limiter_t limiter_left = { .gain = 0x10000000, .target = 0x10000000, .min_gain = 0x10000000 };
+limiter_t limiter_right = { .gain = 0x10000000, .target = 0x10000000, .min_gain = 0x10000000 };
+
+/**
+ * Configure a limiter. Parameters are as follows:
+ *
+ * fs: The sampling frequency.
+ *
+ * threshold_db: The highest level let through, in dB relative to the full
+ * scale of the DAC. Keep it a little under 0dB, the filters after the
+ * limiter in the DAC can overshoot.
+ *
+ * lookahead_us: How far ahead the limiter looks for peaks, in microseconds.
+ * This is also the latency it adds. Longer gives a gentler attack.
+ *
+ * release_ms: Time constant of the return to unity gain once the peak has
+ * passed, in milliseconds.
+ */
+void limiter_config(double fs, double threshold_db, double lookahead_us, double release_ms, limiter_t *limiter) {
+    if (threshold_db > 0.0) threshold_db = 0.0;
+    limiter->threshold = fix3_28_from_dbl(2.0 * pow(10.0, threshold_db / 20.0));
+    if (limiter->threshold > OUTPUT_FULL_SCALE - 1) limiter->threshold = OUTPUT_FULL_SCALE - 1;
+
+    long lookahead = lround(lookahead_us * fs / 1000000.0);
+    if (lookahead < 1) lookahead = 1;
+    if (lookahead > LIMITER_MAX_LOOKAHEAD - 1) lookahead = LIMITER_MAX_LOOKAHEAD - 1;
+    limiter->lookahead = (uint32_t)lookahead;
+
+    const double release_samples = fs * release_ms / 1000.0;
+    limiter->release = fix3_28_from_dbl(release_samples > 1.0 ? 1.0 - exp(-1.0 / release_samples) : 1.0);
+}
+
+/// @brief Clears the delay line and returns to unity gain, the statistics are kept.
+void limiter_reset(limiter_t *limiter) {
+    memset(limiter->delay_line, 0, sizeof(limiter->delay_line));
+    limiter->position = 0;
+    limiter->gain = fix16_one;
+    limiter->target = fix16_one;
+    limiter->step = 0;
+    limiter->hold = 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <stdbool.h>
+#include "fix16.h"
+
+// Must be a power of two. 64 samples is ~1.3ms at 48kHz.
+#define LIMITER_MAX_LOOKAHEAD 64
+
+// Full scale of the DAC in Q3.28. Samples are normalised to ]-1,1[ on the way
+// in but norm_fix3_28_to_s16sample() outputs 24 bits, so it clips at +/-2.0.
+#define OUTPUT_FULL_SCALE 0x20000000
+
+/// @brief A lookahead peak limiter that runs just before the output conversion.
+///        Each core owns one of these, for the channel it processes.
+typedef struct _limiter_t {
+    bool enabled;
+    fix3_28_t threshold;
+    /// @brief Per sample coefficient of the exponential release back to unity gain.
+    fix3_28_t release;
+    uint32_t lookahead;
+    uint32_t position;
+    fix3_28_t delay_line[LIMITER_MAX_LOOKAHEAD];
+
+    fix3_28_t gain;
+    /// @brief The gain we are ramping down to, and how fast, so it is reached by the time
+    ///        the sample that asked for it leaves the delay line.
+    fix3_28_t target;
+    fix3_28_t step;
+    /// @brief Samples left before we are allowed to release.
+    uint32_t hold;
+
+    // Statistics, reported by GET_STATUS. The counters only ever go up.
+    uint32_t clipped_samples;
+    uint32_t limited_packets;
+    fix3_28_t min_gain;
+    /// @brief Set by whoever read min_gain, the core restarts it from the current
+    ///        gain at the end of its next packet.
+    volatile bool reset_peak;
+} limiter_t;
+
+extern limiter_t limiter_left;
+extern limiter_t limiter_right;
+
+void limiter_config(double, double, double, double, limiter_t *);
+void limiter_reset(limiter_t *);
+
+static inline fix3_28_t limiter_transform(fix3_28_t, limiter_t *);
+static inline void limiter_check_clip(fix3_28_t, limiter_t *);
+static inline void limiter_packet_done(limiter_t *);
+
+#include "limiter.inl"
+#endif
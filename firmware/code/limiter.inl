@@ -0,0 +1,77 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/// @brief Runs one sample through the limiter. The output is delayed by the lookahead.
+/// @param x The sample going in.
+/// @param limiter The limiter state for the channel being processed.
+/// @return The sample from lookahead samples ago, with the gain reduction applied.
+static inline fix3_28_t limiter_transform(fix3_28_t x, limiter_t *limiter) {
+    const fix3_28_t delayed = limiter->delay_line[(limiter->position - limiter->lookahead) & (LIMITER_MAX_LOOKAHEAD - 1)];
+    limiter->delay_line[limiter->position] = x;
+    limiter->position = (limiter->position + 1) & (LIMITER_MAX_LOOKAHEAD - 1);
+
+    const fix3_28_t level = x < 0 ? -x : x;
+    if (level > limiter->threshold) {
+        limiter->hold = limiter->lookahead;
+        // Only work out the new gain (and pay for the divide) if the gain we
+        // are already heading for is not enough.
+        if (fix16_mul(level, limiter->target) > limiter->threshold) {
+            const fix3_28_t target = (fix3_28_t) (((int64_t) limiter->threshold << 28) / level);
+            const fix3_28_t lookahead = (fix3_28_t) limiter->lookahead;
+            const fix3_28_t step = (limiter->gain - target + lookahead - 1) / lookahead;
+            if (step > limiter->step) limiter->step = step;
+            limiter->target = target;
+            if (target < limiter->min_gain) limiter->min_gain = target;
+        }
+    }
+
+    if (limiter->gain > limiter->target) {
+        limiter->gain -= limiter->step;
+        if (limiter->gain <= limiter->target) {
+            limiter->gain = limiter->target;
+            limiter->step = 0;
+        }
+    }
+    else if (limiter->hold) {
+        limiter->hold--;
+    }
+    else if (limiter->gain < fix16_one) {
+        const fix3_28_t delta = fix16_mul(fix16_one - limiter->gain, limiter->release);
+        // Snap to unity once the steps are too small to get us there.
+        limiter->gain = delta ? limiter->gain + delta : fix16_one;
+        limiter->target = limiter->gain;
+    }
+
+    return fix16_mul(delayed, limiter->gain);
+}
+
+/// @brief Counts the sample if it will be saturated by norm_fix3_28_to_s16sample().
+static inline void limiter_check_clip(fix3_28_t x, limiter_t *limiter) {
+    if ((uint32_t) x + OUTPUT_FULL_SCALE >= 2u * OUTPUT_FULL_SCALE) {
+        limiter->clipped_samples++;
+    }
+}
+
+/// @brief Called once per packet, counts the packets where we were reducing the gain.
+static inline void limiter_packet_done(limiter_t *limiter) {
+    if (limiter->gain < fix16_one || limiter->hold) {
+        limiter->limited_packets++;
+    }
+    if (limiter->reset_peak) {
+        limiter->min_gain = limiter->gain;
+        limiter->reset_peak = false;
+    }
+}
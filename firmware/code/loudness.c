@@ -0,0 +1,132 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "loudness.h"
+
+loudness_t loudness_left;
+loudness_t loudness_right;
+
+/**
+ * Both shelves for every row, designed once at boot. Rather than lifting the
+ * bass, the first shelf cuts everything above LOUDNESS_BASS_FREQ and the DAC
+ * attenuation is backed off by the same amount, see loudness_set_volume(). The
+ * treble lift never outgrows the bass one, so the pair never adds gain and
+ * cannot clip.
+ *
+ * Any point on the line between two stable biquads is stable, so
+ * interpolating between rows is safe.
+ */
+static bqf_coeff_t loudness_table[LOUDNESS_ROWS][2];
+// The deepest cut, LOUDNESS_BASS_MAX_DB, in DAC steps of 0.5dB, and one over.
+#define LOUDNESS_HEADROOM_STEPS 31
+// The gains of 0, 1, 2... DAC steps down. Each is a millionth low, so a cut of
+// exactly so many steps that the Q3.28 coefficients make a hair deeper still
+// gets that many.
+static fix3_28_t loudness_step_gain[LOUDNESS_HEADROOM_STEPS + 1];
+
+static bool loudness_enabled = false;
+// Volume, in 1/256dB, at which there is no compensation.
+static int32_t loudness_reference = 0;
+// How much of the attenuation is compensated for, in 1/256.
+static int32_t loudness_strength = 256;
+static bool loudness_dirty = true;
+
+void loudness_init(double fs) {
+    for (int row = 0; row < LOUDNESS_ROWS; row++) {
+        const double attenuation = row * LOUDNESS_STEP_DB;
+        const double bass = fmin(LOUDNESS_BASS_SLOPE * attenuation, LOUDNESS_BASS_MAX_DB);
+        const double treble = fmin(LOUDNESS_TREBLE_SLOPE * attenuation, LOUDNESS_TREBLE_MAX_DB);
+        bqf_highshelf_config(fs, LOUDNESS_BASS_FREQ, -bass, 0.71, &loudness_table[row][0]);
+        bqf_highshelf_config(fs, LOUDNESS_TREBLE_FREQ, treble, 0.71, &loudness_table[row][1]);
+    }
+    for (int step = 0; step <= LOUDNESS_HEADROOM_STEPS; step++) {
+        loudness_step_gain[step] = fix3_28_from_dbl(pow(10.0, -step / 40.0) * (1.0 - 1e-6));
+    }
+    for (int j = 0; j < 2; j++) {
+        loudness_left.filters[j] = loudness_table[0][j];
+        loudness_right.filters[j] = loudness_table[0][j];
+        bqf_memreset(&loudness_left.filters_mem[j]);
+        bqf_memreset(&loudness_right.filters_mem[j]);
+    }
+}
+
+void loudness_config(bool enabled, double reference_db, double strength) {
+    loudness_enabled = enabled;
+    loudness_reference = (int32_t) lround(reference_db * 256.0);
+    loudness_strength = (int32_t) lround(fmin(fmax(strength, 0.0), 1.0) * 256.0);
+    loudness_dirty = true;
+}
+
+/// @brief True once after the configuration changed, the shelves need updating
+///        even if the volume has not.
+bool loudness_changed() {
+    const bool changed = loudness_dirty;
+    loudness_dirty = false;
+    return changed;
+}
+
+static inline fix3_28_t interpolate(fix3_28_t a, fix3_28_t b, int32_t fraction) {
+    return a + (fix3_28_t) (((int64_t) (b - a) * fraction) >> 16);
+}
+
+/**
+ * Moves the shelves of a channel to a new volume. Only interpolates between two
+ * rows of the table, no filters are designed, so this is cheap enough to run
+ * whenever the host moves the volume.
+ * @param volume The UAC volume in 1/256dB, 0x8000 is mute.
+ * @return How far to back off the DAC attenuation, in steps of 0.5dB.
+ */
+uint8_t loudness_set_volume(int16_t volume, loudness_t *loudness) {
+    loudness->enabled = loudness_enabled;
+    if (!loudness_enabled || volume == (int16_t) 0x8000) {
+        return 0;
+    }
+
+    int32_t attenuation = (loudness_reference - volume) * loudness_strength / 256;
+    if (attenuation < 0) attenuation = 0;
+    if (attenuation > LOUDNESS_MAX_DB * 256) attenuation = LOUDNESS_MAX_DB * 256;
+
+    // Row and 16 bit fraction of the way to the next one.
+    const int32_t position = (attenuation << 16) / (LOUDNESS_STEP_DB * 256);
+    const int row = position >> 16;
+    const int32_t fraction = position & 0xffff;
+    const int next = row + 1 < LOUDNESS_ROWS ? row + 1 : row;
+
+    for (int j = 0; j < 2; j++) {
+        const bqf_coeff_t *a = &loudness_table[row][j];
+        const bqf_coeff_t *b = &loudness_table[next][j];
+        bqf_coeff_t *c = &loudness->filters[j];
+        c->a0 = fix16_one;
+        c->a1 = interpolate(a->a1, b->a1, fraction);
+        c->a2 = interpolate(a->a2, b->a2, fraction);
+        c->b0 = interpolate(a->b0, b->b0, fraction);
+        c->b1 = interpolate(a->b1, b->b1, fraction);
+        c->b2 = interpolate(a->b2, b->b2, fraction);
+    }
+
+    // The headroom comes from the shelf that is actually running, so it is the
+    // cut the listener hears. That is the shelf's gain at Nyquist, rounded up
+    // to whole DAC steps so the attenuation never comes back short of it.
+    const bqf_coeff_t *shelf = &loudness->filters[0];
+    const int64_t gain = (int64_t) (shelf->b0 - shelf->b1 + shelf->b2) * fix16_one;
+    const int64_t scale = fix16_one - shelf->a1 + shelf->a2;
+    uint8_t steps = 0;
+    while (steps < LOUDNESS_HEADROOM_STEPS && (int64_t) loudness_step_gain[steps] * scale > gain) steps++;
+    return steps;
+}
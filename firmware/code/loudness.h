@@ -0,0 +1,60 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "fix16.h"
+#include "bqf.h"
+
+// The compensation is worked out for every LOUDNESS_STEP_DB of attenuation
+// below the reference volume, up to LOUDNESS_MAX_DB, and interpolated in
+// between. Volumes are in the UAC units of 1/256dB.
+#define LOUDNESS_STEP_DB 2
+#define LOUDNESS_MAX_DB 60
+#define LOUDNESS_ROWS (LOUDNESS_MAX_DB / LOUDNESS_STEP_DB + 1)
+
+// Bass is lifted below LOUDNESS_BASS_FREQ and treble above LOUDNESS_TREBLE_FREQ,
+// by these many dB per dB of attenuation, up to the maximum.
+#define LOUDNESS_BASS_FREQ 100.0
+#define LOUDNESS_BASS_SLOPE 0.35
+#define LOUDNESS_BASS_MAX_DB 15.0
+#define LOUDNESS_TREBLE_FREQ 10000.0
+#define LOUDNESS_TREBLE_SLOPE 0.1
+#define LOUDNESS_TREBLE_MAX_DB 6.0
+
+/// @brief Equal loudness compensation for one channel, the shelves follow the
+///        volume of that channel. Each core owns the one for its channel.
+typedef struct _loudness_t {
+    bool enabled;
+    bqf_coeff_t filters[2];
+    bqf_mem_t filters_mem[2];
+} loudness_t;
+
+extern loudness_t loudness_left;
+extern loudness_t loudness_right;
+
+void loudness_init(double);
+void loudness_config(bool, double, double);
+bool loudness_changed();
+uint8_t loudness_set_volume(int16_t, loudness_t *);
+
+static inline void loudness_transform_block(fix3_28_t *, int, loudness_t *);
+
+#include "loudness.inl"
+#endif
@@ -0,0 +1,24 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/// @brief Runs a block through the two shelves.
+static inline void loudness_transform_block(fix3_28_t *block, int samples, loudness_t *loudness) {
+    for (int j = 0; j < 2; j++) {
+        for (int n = 0; n < samples; n++) {
+            block[n] = bqf_transform(block[n], &loudness->filters[j], &loudness->filters_mem[j]);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "quantizer.h"
+
+// Different seeds, so the dither on the two channels is not correlated.
+quantizer_t quantizer_left = { .mode = QUANTIZE_TRUNCATE, .random = 0x9e3779b9 };
+quantizer_t quantizer_right = { .mode = QUANTIZE_TRUNCATE, .random = 0x7f4a7c15 };
+
+void quantizer_config(uint8_t mode, uint8_t noise_shaping, quantizer_t *q) {
+    if (noise_shaping != q->noise_shaping) {
+        q->error[0] = q->error[1] = 0;
+    }
+    q->mode = mode;
+    q->noise_shaping = noise_shaping;
+}
@@ -0,0 +1,53 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include <stdint.h>
+#include "fix16.h"
+
+// How the Q3.28 samples are cut down to the 24 bits the DAC takes, see
+// quantizer_configuration_tlv.
+enum quantizer_mode {
+    QUANTIZE_TRUNCATE = 0,
+    QUANTIZE_ROUND,
+    QUANTIZE_TPDF_DITHER
+};
+
+// One LSB of the 24-bit output in Q3.28.
+#define QUANTIZER_LSB (1 << 6)
+
+/// @brief Output quantizer state, each core owns the one for its channel.
+typedef struct _quantizer_t {
+    uint8_t mode;
+    /// @brief Order of the error feedback filter, 0 turns noise shaping off.
+    uint8_t noise_shaping;
+    /// @brief xorshift32 state of the dither generator, must not be zero.
+    uint32_t random;
+    /// @brief The last two quantization errors, newest first.
+    int32_t error[2];
+} quantizer_t;
+
+extern quantizer_t quantizer_left;
+extern quantizer_t quantizer_right;
+
+void quantizer_config(uint8_t, uint8_t, quantizer_t *);
+
+static inline void quantize_block(const fix3_28_t *, int, int32_t *, int, quantizer_t *);
+
+#include "quantizer.inl"
+#endif
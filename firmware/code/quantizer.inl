@@ -0,0 +1,83 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Largest quantization error fed back, clipping would otherwise feed back the
+// whole overshoot and the noise shaping filter would ring.
+#define QUANTIZER_MAX_ERROR (2 * QUANTIZER_LSB)
+// Twice the DAC full scale, anything past it clips anyway.
+#define QUANTIZER_MAX_INPUT 0x40000000
+
+/**
+ * Converts a block of samples to signed 24-bit integers for the DAC.
+ * @param input Q3.28 samples, +/-2.0 is full scale.
+ * @param samples Number of samples.
+ * @param output Where the samples go, every stride-th int32_t.
+ * @param stride Distance between output samples, the channels are interleaved.
+ * @param q The quantizer of the channel.
+ *
+ * QUANTIZE_TRUNCATE matches norm_fix3_28_to_s16sample(). The dither is
+ * triangular, two uniform values of one LSB each out of a single xorshift32
+ * step. With noise shaping the error of the previous samples is subtracted
+ * before quantizing, which pushes the noise up in frequency: (1 - z^-1) for
+ * first order and (1 - z^-1)^2 for second order.
+ */
+static inline void quantize_block(const fix3_28_t *input, int samples, int32_t *output, int stride, quantizer_t *q) {
+    if (q->mode == QUANTIZE_TRUNCATE && !q->noise_shaping) {
+        for (int i = 0; i < samples; i++) {
+            output[i * stride] = norm_fix3_28_to_s16sample(input[i]);
+        }
+        return;
+    }
+
+    const int32_t round = q->mode == QUANTIZE_TRUNCATE ? 0 : QUANTIZER_LSB / 2;
+    const bool dither = q->mode == QUANTIZE_TPDF_DITHER;
+    uint32_t random = q->random;
+    int32_t e1 = q->error[0], e2 = q->error[1];
+
+    for (int i = 0; i < samples; i++) {
+        // Way outside of what the DAC takes, but it keeps the sums below from overflowing.
+        fix3_28_t x = input[i];
+        if (x > QUANTIZER_MAX_INPUT) x = QUANTIZER_MAX_INPUT;
+        if (x < -QUANTIZER_MAX_INPUT) x = -QUANTIZER_MAX_INPUT;
+
+        switch (q->noise_shaping) {
+            case 1: x -= e1; break;
+            case 2: x -= 2 * e1 - e2; break;
+        }
+
+        int32_t v = x + round;
+        if (dither) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            v += (int32_t) (random & (QUANTIZER_LSB - 1)) +
+                (int32_t) ((random >> 6) & (QUANTIZER_LSB - 1)) - (QUANTIZER_LSB - 1);
+        }
+
+        const int32_t y = saturate_s24sample(v >> 6);
+        output[i * stride] = y;
+
+        int32_t e = y * QUANTIZER_LSB - x;
+        if (e > QUANTIZER_MAX_ERROR) e = QUANTIZER_MAX_ERROR;
+        if (e < -QUANTIZER_MAX_ERROR) e = -QUANTIZER_MAX_ERROR;
+        e2 = e1;
+        e1 = e;
+    }
+
+    q->random = random;
+    q->error[0] = e1;
+    q->error[1] = e2;
+}
@@ -43,12 +43,128 @@
 #include "ringbuf.h"
 #include "i2s.h"
 #include "bqf.h"
+#include "crossfeed.h"
+#include "limiter.h"
+#include "fir.h"
+#include "halfband.h"
+#include "quantizer.h"
+#include "loudness.h"
+#include "stats.h"
+#include "trace.h"
 #include "os_descriptors.h"
 #include "configuration_manager.h"
 
 i2s_obj_t i2s_write_obj;
 static uint8_t *userbuf;
 
+// Largest isochronous packet the host may send us, in bytes.
+#define AUDIO_MAX_PACKET_SIZE 0xC4
+
+// The current packet after the stereo swap and M/S encode. The cores only read
+// from this while filtering and write their results to userbuf, so each of them
+// can mix in the other channel for the crossfeed without waiting for the other.
+static int32_t packet_input[AUDIO_MAX_PACKET_SIZE / 2];
+
+// Each core runs its channel of the packet through the filter chain as a block,
+// one stage at a time, so the FIR filter can work on the whole packet at once.
+static fix3_28_t block_left[MAX_BLOCK_SAMPLES];
+static fix3_28_t block_right[MAX_BLOCK_SAMPLES];
+
+// The filtered block at the DAC rate, ready for the quantizer.
+#if OUTPUT_OVERSAMPLING == 2
+static fix3_28_t oversampled_left[2 * MAX_BLOCK_SAMPLES];
+static fix3_28_t oversampled_right[2 * MAX_BLOCK_SAMPLES];
+static fix3_28_t *const output_left = oversampled_left;
+static fix3_28_t *const output_right = oversampled_right;
+#else
+static fix3_28_t *const output_left = block_left;
+static fix3_28_t *const output_right = block_right;
+#endif
+
+// Set when every sample in packet_input is zero, hosts often keep the stream
+// open and send digital silence. Once a channel has settled, the core skips its
+// DSP and repeats the settled output without touching the state. When audio
+// comes back processing picks up from exactly the state it stopped in. The
+// repeated output is not dithered, so settled silence is digital silence.
+static bool packet_silent = false;
+static bool settled_left = false;
+static bool settled_right = false;
+static int32_t settled_output_left;
+static int32_t settled_output_right;
+
+// One LSB of the 24-bit output, see norm_fix3_28_to_s16sample().
+#define SETTLED_THRESHOLD (1 << 6)
+
+static inline bool within_lsb(fix3_28_t a, fix3_28_t b) {
+    return a - b < SETTLED_THRESHOLD && b - a < SETTLED_THRESHOLD;
+}
+
+/**
+ * Works out whether a channel that has just processed a silent packet has
+ * settled: its output held within one LSB for the whole packet and nothing in
+ * its state moves by more than one LSB per sample.
+ *
+ * This is not the same as the state decaying to zero. The truncation in
+ * fix16_mul() biases every multiply and the low frequency filters have a lot
+ * of gain at DC, so with silence going in they sit on a small DC offset, or
+ * drift around it very slowly, rather than ever getting below one LSB.
+ */
+static bool __no_inline_not_in_flash_func(channel_settled)(const fix3_28_t *output, int samples, const bqf_mem_t *memory,
+        int stages, const fir_filter_t *fir, const loudness_t *loudness, const crossfeed_t *crossfeed,
+        const limiter_t *limiter, const halfband_t *halfband) {
+    // Checked before the quantizer, the dither keeps the output itself moving.
+    // One LSB either way of the last sample, like the rounded output used to be.
+    const fix3_28_t last = output[samples - 1];
+    for (int i = 0; i < samples; i++) {
+        if (output[i] - last >= 2 * SETTLED_THRESHOLD || last - output[i] >= 2 * SETTLED_THRESHOLD)
+            return false;
+    }
+    for (int j = 0; j < stages; j++) {
+        if (!within_lsb(memory[j].x_1, memory[j].x_2) || !within_lsb(memory[j].y_1, memory[j].y_2))
+            return false;
+    }
+    if (fir->taps) {
+        const fix3_28_t latest = fir->history[FIR_MAX_TAPS - 2];
+        for (int i = FIR_MAX_TAPS - fir->taps; i < FIR_MAX_TAPS - 1; i++) {
+            if (!within_lsb(fir->history[i], latest))
+                return false;
+        }
+    }
+    if (loudness->enabled) {
+        for (int j = 0; j < 2; j++) {
+            const bqf_mem_t *shelf = &loudness->filters_mem[j];
+            if (!within_lsb(shelf->x_1, shelf->x_2) || !within_lsb(shelf->y_1, shelf->y_2))
+                return false;
+        }
+    }
+#if OUTPUT_OVERSAMPLING == 2
+    // The last few samples into the interpolator are not in the output yet.
+    for (int i = 0; i < HALFBAND_HISTORY; i++) {
+        if (!within_lsb(halfband->history[i], halfband->history[HALFBAND_HISTORY - 1]))
+            return false;
+    }
+#endif
+    if (crossfeed->enabled) {
+        const fix3_28_t latest = crossfeed->filter_mem.y_1;
+        if (!within_lsb(latest, crossfeed->filter_mem.y_2))
+            return false;
+        for (int i = 0; i < CROSSFEED_MAX_DELAY; i++) {
+            if (!within_lsb(crossfeed->delay_line[i], latest))
+                return false;
+        }
+    }
+    if (limiter->enabled) {
+        if (limiter->gain != fix16_one || limiter->hold)
+            return false;
+        const fix3_28_t latest = limiter->delay_line[(limiter->position - 1) & (LIMITER_MAX_LOOKAHEAD - 1)];
+        for (int i = 0; i < LIMITER_MAX_LOOKAHEAD; i++) {
+            if (!within_lsb(limiter->delay_line[i], latest))
+                return false;
+        }
+    }
+    return true;
+}
+
 audio_state_config audio_state = {
     .freq = 48000,
     .de_emphasis_frequency = 0x1, // 48khz
@@ -58,7 +174,8 @@ audio_state_config audio_state = {
 preprocessing_config preprocessing = {
     .preamp = fix16_one,
     .postEQGain = fix16_one,
-    .reverse_stereo = false
+    .reverse_stereo = false,
+    .mid_side = 0
 };
 
 static char spi_serial_number[17] = "";
@@ -74,6 +191,8 @@ int main(void) {
     // Ask the configuration_manager to load a user config from flash,
     // or use the defaults.
     load_config();
+    stats_init(&core_stats[0]);
+    stats_ring_reset();
 
     // start second core (called "core 1" in the SDK)
     multicore_launch_core1(core1_entry);
@@ -86,22 +205,36 @@ int main(void) {
 
     usb_sound_card_init();
 
-    while (true)
-        __wfi();
+    // Work through any slow config requests, then sleep until the next interrupt.
+    while (true) {
+        if (!config_idle_task())
+            __wfi();
+    }
 }
 
-static void update_volume()
+/// @brief Returns true if the loudness shelves were moved, the channels have
+///        to settle again before they can be skipped.
+static bool update_volume()
 {
-    if (audio_state._volume != audio_state._target_volume) {
+    const bool loudness_update = loudness_changed();
+    bool moved = false;
+    if (audio_state._volume != audio_state._target_volume || loudness_update) {
+        // The loudness shelves cut the midrange and up rather than boosting
+        // the bass, back the DAC attenuation off by the same amount.
+        const uint8_t headroom_left = loudness_set_volume(audio_state.target_volume[0], &loudness_left);
+        const uint8_t headroom_right = loudness_set_volume(audio_state.target_volume[1], &loudness_right);
+        moved = loudness_left.enabled || loudness_update;
+
         // PCM3060 volume attenuation:
         //  0: 0db (default)
         //  55: -100db
         //  56..: Mute
         uint8_t buf[3];
         buf[0] = 65;    // register addr
-        buf[1] = 255 + (audio_state.target_volume[0] / 128); // data left
-        buf[2] = 255 + (audio_state.target_volume[1] / 128); // data right
+        buf[1] = 255 + (audio_state.target_volume[0] / 128) + headroom_left; // data left
+        buf[2] = 255 + (audio_state.target_volume[1] / 128) + headroom_right; // data right
         i2c_write_blocking(i2c0, PCM_I2C_ADDR, buf, 3, false);
+        trace(TRACE_VOLUME, buf[1] | (buf[2] << 8));
 
         audio_state._volume = audio_state._target_volume;
     }
@@ -114,6 +247,7 @@ static void update_volume()
         i2c_write_blocking(i2c0, PCM_I2C_ADDR, buf, 3, false);
         audio_state.pcm3060_registers = audio_state._target_pcm3060_registers;
     }
+    return moved;
 }
 
 // Here's the meat. It's where the data buffer from USB gets transformed from
@@ -124,12 +258,18 @@ static void __no_inline_not_in_flash_func(_as_audio_packet)(struct usb_endpoint
     struct usb_buffer *usb_buffer = usb_current_out_packet_buffer(ep);
     int16_t *in = (int16_t *) usb_buffer->data;
     int32_t *out = (int32_t *) userbuf;
-    int samples = usb_buffer->data_len / 2;
+    int samples = MIN(usb_buffer->data_len / 2, count_of(packet_input));
+    const int output_samples = samples * OUTPUT_OVERSAMPLING;
+
+    stats_packet_begin(&core_stats[0]);
+    trace(TRACE_PACKET, usb_buffer->data_len);
+    stats_ring_sample(ringbuf_available_data(&i2s_write_obj.ring_buffer));
 
     // Make sure core 1 is ready for us.
     multicore_fifo_pop_blocking();
 
     if (save_config()) {
+        trace(TRACE_FLASH_SAVE, 0);
         // Skip processing while we are writing to flash
         multicore_fifo_push_blocking(CORE0_ABORTED);
         // keep on truckin'
@@ -138,46 +278,108 @@ static void __no_inline_not_in_flash_func(_as_audio_packet)(struct usb_endpoint
         return;
     }
 
+    int32_t nonzero = 0;
     if (preprocessing.reverse_stereo) {
         for (int i = 0; i < samples; i+=2) {
-            out[i] = in[i+1];
-            out[i+1] = in[i];
+            packet_input[i] = in[i+1];
+            packet_input[i+1] = in[i];
+            nonzero |= in[i] | in[i+1];
         }
     }
     else {
-        for (int i = 0; i < samples; i++)
-            out[i] = in[i];
+        for (int i = 0; i < samples; i++) {
+            packet_input[i] = in[i];
+            nonzero |= in[i];
+        }
     }
- 
+    packet_silent = !nonzero;
+
+    // The M/S encode is done here and the decode on core 1, so the matrix
+    // costs both cores about the same.
+    if (preprocessing.mid_side & MID_SIDE_ENCODE) {
+        for (int i = 0; i < samples; i += 2) {
+            const int32_t left = packet_input[i];
+            const int32_t right = packet_input[i+1];
+            packet_input[i] = (left + right) >> 1;
+            packet_input[i+1] = (left - right) >> 1;
+        }
+    }
+
     multicore_fifo_push_blocking(CORE0_READY);
     multicore_fifo_push_blocking(samples);
+    stats_phase_done(&core_stats[0], STATS_COPY_IN);
 
 
     // Left channel filter
-    for (int i = 0; i < samples; i += 2) {
-        fix3_28_t x_f16 = fix16_mul(norm_fix3_28_from_s16sample((int16_t) out[i]), preprocessing.preamp);
-        for (int j = 0; j < filter_stages; j++) {
-            x_f16 = bqf_transform(x_f16, &bqf_filters_left[j],
-                &bqf_filters_mem_left[j]);
+    const bool bypass = packet_silent && settled_left;
+    if (bypass) {
+        for (int i = 0; i < output_samples; i += 2)
+            out[i] = settled_output_left;
+    }
+    else {
+        for (int i = 0; i < samples; i += 2) {
+            fix3_28_t x_f16 = norm_fix3_28_from_s16sample((int16_t) packet_input[i]);
+            if (crossfeed_left.enabled) {
+                x_f16 = crossfeed_transform(x_f16, norm_fix3_28_from_s16sample((int16_t) packet_input[i+1]),
+                    &crossfeed_left);
+            }
+            block_left[i/2] = fix16_mul(x_f16, preprocessing.preamp);
         }
 
-        /* Apply post-EQ gain. */
-        x_f16 = fix16_mul( x_f16, preprocessing.postEQGain);
+        filter_chain_transform(block_left, samples / 2, bqf_filters_left, bqf_filters_mem_left,
+            filter_stages_left, &fir_left, &bqf_ramp_left);
+        if (loudness_left.enabled)
+            loudness_transform_block(block_left, samples / 2, &loudness_left);
+
+        for (int i = 0; i < samples; i += 2) {
+            /* Apply post-EQ gain. */
+            fix3_28_t x_f16 = fix16_mul(block_left[i/2], preprocessing.postEQGain);
+
+            if (limiter_left.enabled) {
+                x_f16 = limiter_transform(x_f16, &limiter_left);
+            }
+            limiter_check_clip(x_f16, &limiter_left);
 
-        out[i] = (int32_t) norm_fix3_28_to_s16sample(x_f16);
+            block_left[i/2] = x_f16;
+        }
+
+#if OUTPUT_OVERSAMPLING == 2
+        halfband_interpolate(block_left, samples / 2, output_left, &halfband_left);
+#endif
+        quantize_block(output_left, output_samples / 2, out, 2, &quantizer_left);
+
+        limiter_packet_done(&limiter_left);
+        settled_left = packet_silent && samples && !bqf_ramp_left.remaining &&
+            channel_settled(output_left, output_samples / 2, bqf_filters_mem_left, filter_stages_left, &fir_left,
+                &loudness_left, &crossfeed_left, &limiter_left, &halfband_left);
+        if (settled_left)
+            settled_output_left = out[output_samples - 2];
     }
 
+    stats_phase_done(&core_stats[0], STATS_FILTER);
+
     // Block until core 1 has finished transforming the data
+    const uint32_t wait_start = time_us_32();
     uint32_t ready = multicore_fifo_pop_blocking();
     multicore_fifo_push_blocking(CORE0_READY);
+    trace(TRACE_HANDSHAKE, time_us_32() - wait_start);
+    stats_phase_done(&core_stats[0], STATS_HANDSHAKE);
 
     // Update the volume if required. We do this from core1 as
     // core0 is more heavily loaded, doing this from core0 can
     // lead to audio crackling.
-    update_volume();
-
-    // Update filters if required
-    apply_config_changes();
+    const bool loudness_moved = update_volume();
+
+    // Update filters if required. The channels have to settle again with the
+    // new coefficients before they can be skipped.
+    const bool config_applied = apply_config_changes();
+    if (config_applied) trace(TRACE_CONFIG_APPLY, 0);
+    if (config_applied || loudness_moved) {
+        settled_left = false;
+        settled_right = false;
+    }
+    stats_phase_done(&core_stats[0], STATS_CONFIG);
+    stats_packet_done(&core_stats[0]);
 
     // keep on truckin'
     usb_grow_transfer(ep->current_transfer, 1);
@@ -188,6 +390,8 @@ void __no_inline_not_in_flash_func(core1_entry)() {
     uint8_t *userbuf = (uint8_t *) multicore_fifo_pop_blocking();
     int32_t *out = (int32_t *) userbuf;
 
+    stats_init(&core_stats[1]);
+
     // Signal that the thread has started
     multicore_fifo_push_blocking(CORE1_READY);
 
@@ -200,33 +404,90 @@ void __no_inline_not_in_flash_func(core1_entry)() {
         if (ready == CORE0_ABORTED) continue;
         
         const uint32_t samples = multicore_fifo_pop_blocking();
+        const uint32_t output_samples = samples * OUTPUT_OVERSAMPLING;
+        stats_packet_begin(&core_stats[1]);
 
         /* Right channel EQ. */
-        for (int i = 1; i < samples; i += 2) {
-            /* Apply EQ pre-filter gain to avoid clipping. */
-            fix3_28_t x_f16 = fix16_mul(norm_fix3_28_from_s16sample((int16_t) out[i]), preprocessing.preamp);
-            /* Apply the biquad filters one by one. */
-            for (int j = 0; j < filter_stages; j++) {
-                x_f16 = bqf_transform(x_f16, &bqf_filters_right[j],
-                    &bqf_filters_mem_right[j]);
+        const bool bypass = packet_silent && settled_right;
+        if (bypass) {
+            for (int i = 1; i < output_samples; i += 2)
+                out[i] = settled_output_right;
+        }
+        else {
+            for (int i = 1; i < samples; i += 2) {
+                fix3_28_t x_f16 = norm_fix3_28_from_s16sample((int16_t) packet_input[i]);
+                if (crossfeed_right.enabled) {
+                    x_f16 = crossfeed_transform(x_f16, norm_fix3_28_from_s16sample((int16_t) packet_input[i-1]),
+                        &crossfeed_right);
+                }
+                /* Apply EQ pre-filter gain to avoid clipping. */
+                block_right[i/2] = fix16_mul(x_f16, preprocessing.preamp);
             }
-            /* Apply post-EQ gain. */
-            x_f16 = fix16_mul( x_f16, preprocessing.postEQGain);
 
-            out[i] = (int32_t) norm_fix3_28_to_s16sample(x_f16);
+            /* Apply the filters one by one. */
+            filter_chain_transform(block_right, samples / 2, bqf_filters_right, bqf_filters_mem_right,
+                filter_stages_right, &fir_right, &bqf_ramp_right);
+            if (loudness_right.enabled)
+                loudness_transform_block(block_right, samples / 2, &loudness_right);
+
+            for (int i = 1; i < samples; i += 2) {
+                /* Apply post-EQ gain. */
+                fix3_28_t x_f16 = fix16_mul(block_right[i/2], preprocessing.postEQGain);
+
+                if (limiter_right.enabled) {
+                    x_f16 = limiter_transform(x_f16, &limiter_right);
+                }
+                limiter_check_clip(x_f16, &limiter_right);
+
+                block_right[i/2] = x_f16;
+            }
+
+#if OUTPUT_OVERSAMPLING == 2
+            /* Interpolate up to the DAC rate. */
+            halfband_interpolate(block_right, samples / 2, output_right, &halfband_right);
+#endif
+            quantize_block(output_right, output_samples / 2, out + 1, 2, &quantizer_right);
+
+            limiter_packet_done(&limiter_right);
+            settled_right = packet_silent && samples && !bqf_ramp_right.remaining &&
+                channel_settled(output_right, output_samples / 2, bqf_filters_mem_right, filter_stages_right, &fir_right,
+                    &loudness_right, &crossfeed_right, &limiter_right, &halfband_right);
+            if (settled_right)
+                settled_output_right = out[output_samples - 1];
         }
 
+        stats_phase_done(&core_stats[1], STATS_FILTER);
+
         // Signal to core 0 that the data has all been transformed
         multicore_fifo_push_blocking(CORE1_READY);
 
         // Wait for Core 0 to finish running its filtering before we apply config updates
+        const uint32_t wait_start = time_us_32();
         multicore_fifo_pop_blocking();
+        trace(TRACE_HANDSHAKE, time_us_32() - wait_start);
+        stats_phase_done(&core_stats[1], STATS_HANDSHAKE);
+
+        if (preprocessing.mid_side & MID_SIDE_DECODE) {
+            for (int i = 0; i < output_samples; i += 2) {
+                const int32_t mid = out[i];
+                const int32_t side = out[i+1];
+                out[i] = saturate_s24sample(mid + side);
+                out[i+1] = saturate_s24sample(mid - side);
+            }
+        }
 
-        i2s_stream_write(&i2s_write_obj, userbuf, samples * 4);
+        i2s_stream_write(&i2s_write_obj, userbuf, output_samples * 4);
+        stats_phase_done(&core_stats[1], STATS_RING_WRITE);
+        stats_packet_done(&core_stats[1]);
     }
 }
 
 void setup() {
+#if OUTPUT_OVERSAMPLING == 2
+    // 307.2MHz is past what the default 1.1V core voltage is good for.
+    vreg_set_voltage(VREG_VOLTAGE_1_20);
+    sleep_ms(10);
+#endif
     set_sys_clock_khz(SYSTEM_FREQ / 1000, true);
     sleep_ms(100);
     stdio_init_all();
@@ -235,6 +496,11 @@ void setup() {
         bqf_memreset(&bqf_filters_mem_left[i]);
         bqf_memreset(&bqf_filters_mem_right[i]);
     }
+#if OUTPUT_OVERSAMPLING == 2
+    halfband_config(&halfband_left);
+    halfband_config(&halfband_right);
+#endif
+    loudness_init(SAMPLING_FREQ);
 
     pico_get_unique_board_id_string(spi_serial_number, 17);
     descriptor_strings[2] = spi_serial_number;
@@ -245,8 +511,8 @@ void setup() {
     uint slice_num_dac = pwm_gpio_to_slice_num(PCM3060_SCKI2_PIN);
     uint chan_num_dac = pwm_gpio_to_channel(PCM3060_SCKI2_PIN);
     pwm_set_phase_correct(slice_num_dac, false);
-    pwm_set_wrap(slice_num_dac, (SYSTEM_FREQ / CODEC_FREQ) - 1);
-    pwm_set_chan_level(slice_num_dac, chan_num_dac, (SYSTEM_FREQ / CODEC_FREQ / 2));
+    pwm_set_wrap(slice_num_dac, CODEC_PWM_WRAP - 1);
+    pwm_set_chan_level(slice_num_dac, chan_num_dac, CODEC_PWM_WRAP / 2);
     pwm_set_enabled(slice_num_dac, true);
 
     gpio_init(AUDIO_POS_SUPPLY_EN_PIN);
@@ -299,7 +565,7 @@ void setup() {
     i2s_write_obj.sck_pin = PCM3060_DAC_SCK_PIN;
     i2s_write_obj.ws_pin = PCM3060_DAC_WS_PIN;
     i2s_write_obj.sd_pin = PCM3060_DAC_SD_PIN;
-    i2s_write_obj.sampling_rate = SAMPLING_FREQ;
+    i2s_write_obj.sampling_rate = OUTPUT_FREQ;
 
     i2s_write_init(&i2s_write_obj);
 }
@@ -344,7 +610,6 @@ void configure_neg_switch_pwm() {
  * shall lie for a thousand years.
  ****************************************************************************/
 
-// todo noop when muted
 
 static const audio_device_config ad_conf = {
     .descriptor = {
@@ -470,7 +735,7 @@ static const audio_device_config ad_conf = {
             .bDescriptorType = DTYPE_Endpoint,
             .bEndpointAddress = 0x01,
             .bmAttributes = 5,
-            .wMaxPacketSize = (uint8_t) 0xC4,
+            .wMaxPacketSize = AUDIO_MAX_PACKET_SIZE,
             .bInterval = 1,
             .bRefresh = 0,
             .bSyncAddr = 0x82,
@@ -585,6 +850,7 @@ static void _as_sync_packet(struct usb_endpoint *ep) {
     buffer->data[0] = feedback;
     buffer->data[1] = feedback >> 8u;
     buffer->data[2] = feedback >> 16u;
+    trace(TRACE_FEEDBACK, feedback);
 
     // keep on truckin'
     usb_grow_transfer(ep->current_transfer, 1);
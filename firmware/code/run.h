@@ -114,6 +114,8 @@ typedef struct _preprocessing_config {
     /// @brief Apply this gain after applying EQ, to set output volume without causing overflow in the EQ calculations.
     fix3_28_t postEQGain;
     int reverse_stereo;
+    /// @brief A combination of mid_side_flags, see configuration_types.h.
+    int mid_side;
 } preprocessing_config;
 
 extern preprocessing_config preprocessing;
@@ -145,9 +147,27 @@ static char *descriptor_strings[] = {
 
 #define PCM_I2C_ADDR 70
 
+// SCKI, the PCM3060 system clock, is SYSTEM_FREQ divided down by the PWM, so the
+// two are picked together to keep the divider a whole number. With the 12MHz
+// crystal no system clock the PLL can make divides into 192fs of 96kHz, so the
+// 2x build runs SCKI at 128fs, 12.288MHz, from 307.2MHz. That needs the core
+// voltage raised and the flash clock divided by 4 rather than 2, see setup()
+// and CMakeLists.txt.
+#if OUTPUT_OVERSAMPLING == 2
+#define SYSTEM_FREQ 307200000
+#define CODEC_FREQ 12288000
+#define CODEC_FS_RATIO 128
+#elif OUTPUT_OVERSAMPLING == 1
 #define SYSTEM_FREQ 230400000
 #define CODEC_FREQ 9216000
-#define SAMPLING_FREQ (CODEC_FREQ / 192)
+#define CODEC_FS_RATIO 192
+#else
+#error "OUTPUT_OVERSAMPLING must be 1 or 2"
+#endif
+#define CODEC_PWM_WRAP ((uint16_t) (SYSTEM_FREQ / CODEC_FREQ))
+_Static_assert(SYSTEM_FREQ % CODEC_FREQ == 0, "SCKI must divide evenly into the system clock");
+#define OUTPUT_FREQ (CODEC_FREQ / CODEC_FS_RATIO)
+#define SAMPLING_FREQ (OUTPUT_FREQ / OUTPUT_OVERSAMPLING)
 
 #define CORE0_READY 19813219
 #define CORE0_ABORTED 91231891
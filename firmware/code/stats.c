@@ -0,0 +1,118 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+
+#include "run.h"
+#include "stats.h"
+
+core_stats_t core_stats[2];
+ring_stats_t ring_stats;
+
+// USB delivers a packet every millisecond.
+const uint32_t stats_packet_cycles = SYSTEM_FREQ / 1000;
+
+#define SYSTICK_MASK 0x00ffffff
+
+/// @brief Cycles on the SysTick of the calling core, it counts down.
+static inline uint32_t now() {
+    return systick_hw->cvr;
+}
+
+static void reset(core_stats_t *stats) {
+    memset(stats->phases, 0, sizeof(stats->phases));
+    for (int i = 0; i < STATS_PHASES; i++) {
+        stats->phases[i].min = UINT32_MAX;
+    }
+    stats->reset = false;
+}
+
+/**
+ * Starts the SysTick of the calling core, so has to be called from the core
+ * the stats are for. It runs from the processor clock and wraps every 2^24
+ * cycles, far longer than any packet.
+ */
+void stats_init(core_stats_t *stats) {
+    systick_hw->csr = 0;
+    systick_hw->rvr = SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;  // processor clock, enabled
+    reset(stats);
+}
+
+void __not_in_flash_func(stats_packet_begin)(core_stats_t *stats) {
+    if (stats->reset) reset(stats);
+    stats->packet_start = stats->phase_start = now();
+}
+
+static void __not_in_flash_func(record)(phase_stats_t *phase, uint32_t cycles) {
+    phase->packets++;
+    phase->total += cycles;
+    if (cycles < phase->min) phase->min = cycles;
+    if (cycles > phase->max) phase->max = cycles;
+    uint32_t bin = cycles / (stats_packet_cycles / STATS_HISTOGRAM_BINS);
+    if (bin >= STATS_HISTOGRAM_BINS) bin = STATS_HISTOGRAM_BINS - 1;
+    phase->histogram[bin]++;
+}
+
+/// @brief Ends the current phase of the packet and starts the next one.
+void __not_in_flash_func(stats_phase_done)(core_stats_t *stats, stats_phase phase) {
+    const uint32_t t = now();
+    record(&stats->phases[phase], (stats->phase_start - t) & SYSTICK_MASK);
+    stats->phase_start = t;
+}
+
+void __not_in_flash_func(stats_packet_done)(core_stats_t *stats) {
+    record(&stats->phases[STATS_PACKET], (stats->packet_start - now()) & SYSTICK_MASK);
+}
+
+void __not_in_flash_func(stats_ring_sample)(uint32_t bytes) {
+    const uint32_t t = time_us_32();
+    if (ring_stats.samples) {
+        const uint32_t elapsed = t - ring_stats.last_sample;
+        ring_stats.weighted_total += (uint64_t) ring_stats.current * elapsed;
+        ring_stats.time += elapsed;
+    }
+    ring_stats.samples++;
+    ring_stats.current = bytes;
+    ring_stats.last_sample = t;
+    if (bytes < ring_stats.min) ring_stats.min = bytes;
+    if (bytes > ring_stats.max) ring_stats.max = bytes;
+    uint32_t bin = bytes / (RINGBUF_LEN_IN_BYTES / RING_HISTOGRAM_BINS);
+    if (bin >= RING_HISTOGRAM_BINS) bin = RING_HISTOGRAM_BINS - 1;
+    ring_stats.histogram[bin]++;
+}
+
+/// @brief Starts collecting again from the current fill.
+void stats_ring_reset() {
+    const uint32_t current = ring_stats.current;
+    memset(&ring_stats, 0, sizeof(ring_stats));
+    ring_stats.min = UINT32_MAX;
+    stats_ring_sample(current);
+}
+
+/**
+ * How long a packet written into the ring with this much ahead of it takes to
+ * reach the DAC, in us. Everything in the ring plays first, then the DMA has up
+ * to a whole buffer queued ahead of the ring as well.
+ */
+uint32_t stats_ring_latency(uint32_t bytes) {
+    const uint32_t bytes_per_second = OUTPUT_FREQ * SAMPLES_PER_FRAME * sizeof(int32_t);
+    return (uint32_t) ((uint64_t) (bytes + SIZEOF_DMA_BUFFER_IN_BYTES) * 1000000 / bytes_per_second);
+}
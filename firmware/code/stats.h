@@ -0,0 +1,96 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Each bin of the histograms covers this fraction of a packet period, the
+// last one also takes everything longer.
+#define STATS_HISTOGRAM_BINS 16
+
+/// @brief The parts of the work on a packet that are timed. Not every core
+///        runs every phase.
+typedef enum _stats_phase {
+    /// @brief The whole packet, from the first phase to the end of the last.
+    STATS_PACKET,
+    /// @brief Core 0: USB buffer into packet_input, with the stereo swap and M/S encode.
+    STATS_COPY_IN,
+    /// @brief Crossfeed, filters, limiter and quantizer for the channel of the core.
+    STATS_FILTER,
+    /// @brief Waiting for the other core to finish its channel.
+    STATS_HANDSHAKE,
+    /// @brief Core 1: M/S decode and the write into the I2S ring buffer.
+    STATS_RING_WRITE,
+    /// @brief Core 0: volume and configuration changes over I2C and in the filters.
+    STATS_CONFIG,
+    STATS_PHASES
+} stats_phase;
+
+typedef struct _phase_stats_t {
+    uint32_t packets;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[STATS_HISTOGRAM_BINS];
+} phase_stats_t;
+
+/// @brief Cycles spent in each phase, each core only ever writes its own.
+typedef struct _core_stats_t {
+    phase_stats_t phases[STATS_PHASES];
+    /// @brief Set by whoever read the stats, the core clears them at the start of
+    ///        its next packet.
+    volatile bool reset;
+    uint32_t packet_start;
+    uint32_t phase_start;
+} core_stats_t;
+
+extern core_stats_t core_stats[2];
+
+// Each bin of the ring buffer histogram covers this fraction of the buffer.
+#define RING_HISTOGRAM_BINS 16
+
+/// @brief How full the I2S ring buffer is, sampled on core 0 by every USB packet
+///        and every DMA interrupt. These all run at the same priority, so
+///        nothing else touches it at the same time.
+typedef struct _ring_stats_t {
+    uint32_t samples;
+    uint32_t min;
+    uint32_t max;
+    uint32_t current;
+    /// @brief Sum of each fill times how many us it lasted, over time.
+    uint64_t weighted_total;
+    uint64_t time;
+    uint32_t last_sample;
+    uint32_t histogram[RING_HISTOGRAM_BINS];
+} ring_stats_t;
+
+extern ring_stats_t ring_stats;
+
+/// @brief Cycles in one packet period, the budget each core has for a packet.
+extern const uint32_t stats_packet_cycles;
+
+void stats_init(core_stats_t *);
+void stats_packet_begin(core_stats_t *);
+void stats_phase_done(core_stats_t *, stats_phase);
+void stats_packet_done(core_stats_t *);
+void stats_ring_sample(uint32_t);
+void stats_ring_reset();
+uint32_t stats_ring_latency(uint32_t);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "trace.h"
+
+trace_ring_t trace_rings[2];
+
+/**
+ * Copies the events of one core out of its ring, starting from a sequence
+ * number, while that core carries on tracing.
+ * @param core The ring to read.
+ * @param first Sequence number of the first event wanted, events that have
+ *        already been overwritten are skipped.
+ * @param events Room for TRACE_CHUNK_EVENTS events.
+ * @param start Set to the sequence number of the first event copied.
+ * @return The number of events copied.
+ */
+uint32_t trace_read(uint8_t core, uint32_t first, trace_event_t *events, uint32_t *start) {
+    const trace_ring_t *ring = &trace_rings[core];
+    const uint32_t head = ring->head;
+    const uint32_t oldest = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+    if ((int32_t) (first - oldest) < 0) first = oldest;
+    if ((int32_t) (head - first) < 0) first = head;
+    uint32_t count = head - first;
+    if (count > TRACE_CHUNK_EVENTS) count = TRACE_CHUNK_EVENTS;
+
+    for (uint32_t i = 0; i < count; i++) {
+        events[i] = ring->events[(first + i) & (TRACE_EVENTS - 1)];
+    }
+
+    // Anything the core wrapped round onto while we were copying, including
+    // the slot it may be writing right now, is dropped from the front.
+    const uint32_t now = ring->head;
+    if (now >= TRACE_EVENTS) {
+        const uint32_t overwritten = now - TRACE_EVENTS + 1;
+        if ((int32_t) (overwritten - first) > 0) {
+            const uint32_t lost = overwritten - first;
+            if (lost >= count) {
+                count = 0;
+            }
+            else {
+                memmove(events, &events[lost], (count - lost) * sizeof(trace_event_t));
+                count -= lost;
+            }
+            first = overwritten;
+        }
+    }
+    *start = first;
+    return count;
+}
@@ -0,0 +1,75 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Events kept per core, must be a power of two. At the half dozen or so events
+// a packet makes this is the last couple of hundred milliseconds.
+#define TRACE_EVENTS 1024
+// Most events one GET_TRACE returns, so they fit in the result buffer.
+#define TRACE_CHUNK_EVENTS 128
+
+typedef enum _trace_type {
+    /// @brief A USB audio packet arrived, the value is its length in bytes.
+    TRACE_PACKET = 1,
+    /// @brief A core finished waiting for the other, the value is the wait in us.
+    TRACE_HANDSHAKE,
+    /// @brief The I2S DMA ran out of data and sent silence, the value is the bytes
+    ///        that were left in the ring buffer.
+    TRACE_UNDERRUN,
+    /// @brief Feedback sent to the host, the value is the rate in 10.14 fixed point.
+    TRACE_FEEDBACK,
+    /// @brief New configuration applied to the running filters.
+    TRACE_CONFIG_APPLY,
+    /// @brief The configuration was written to flash, no audio is processed meanwhile.
+    TRACE_FLASH_SAVE,
+    /// @brief Volume written to the PCM3060, the value is the left register in bits
+    ///        0-7 and the right in 8-15.
+    TRACE_VOLUME,
+} trace_type;
+
+/// @brief The type in the top 8 bits of an event, and a value in the low 24.
+#define TRACE_TYPE(event) ((event) >> 24)
+#define TRACE_VALUE(event) ((event) & 0x00ffffff)
+
+typedef struct _trace_event_t {
+    /// @brief time_us_32() when it happened, the same clock on both cores.
+    uint32_t time;
+    uint32_t event;
+} trace_event_t;
+
+/// @brief Each core only writes its own ring, so recording needs no locks. On
+///        core 0 everything is traced from interrupts of the same priority,
+///        which do not preempt each other.
+typedef struct _trace_ring_t {
+    /// @brief Events written so far, the latest is at (head - 1) % TRACE_EVENTS.
+    volatile uint32_t head;
+    trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+extern trace_ring_t trace_rings[2];
+
+uint32_t trace_read(uint8_t, uint32_t, trace_event_t *, uint32_t *);
+
+#ifndef TEST_TARGET
+static inline void trace(trace_type, uint32_t);
+
+#include "trace.inl"
+#endif
+#endif
@@ -0,0 +1,28 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+
+/// @brief Adds an event to the ring of the calling core, overwriting the oldest.
+static inline void trace(trace_type type, uint32_t value) {
+    trace_ring_t *ring = &trace_rings[get_core_num()];
+    const uint32_t head = ring->head;
+    trace_event_t *event = &ring->events[head & (TRACE_EVENTS - 1)];
+    event->time = time_us_32();
+    event->event = ((uint32_t) type << 24) | (value & 0x00ffffff);
+    ring->head = head + 1;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bqf.h"
+#include "fix16.h"
+#include "configuration_types.h"
+#include "configuration_manager.h"
+
+const char* usage = "Usage: %s [OUTFILE]\n\n"
+    "Designs the Ploopy headphones factory default filters for every supported\n"
+    "sampling frequency and writes them out as a C header to OUTFILE (default stdout).\n";
+
+// The sampling frequencies the firmware can be asked to run at, see _audio_reconfigure in run.c.
+static const unsigned supported_sampling_frequencies[] = { 44100, 48000 };
+
+static const char *filter_type_name(uint8_t type)
+{
+    static const char *names[] = {
+        "LOWPASS", "HIGHPASS", "BANDPASSSKIRT", "BANDPASSPEAK", "NOTCH",
+        "ALLPASS", "PEAKING", "LOWSHELF", "HIGHSHELF", "CUSTOMIIR", "FIR"
+    };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "UNKNOWN";
+}
+
+static void describe_filter(FILE *output, const uint8_t *filter)
+{
+    switch (filter_definition_size(filter))
+    {
+        case sizeof(filter2): {
+            const filter2 *args = (const filter2 *)filter;
+            fprintf(output, "        // %s f0=%g Q=%g\n", filter_type_name(args->type), args->f0, args->Q);
+            break;
+        }
+        case sizeof(filter3): {
+            const filter3 *args = (const filter3 *)filter;
+            fprintf(output, "        // %s f0=%g gain=%gdB Q=%g\n", filter_type_name(args->type), args->f0,
+                args->db_gain, args->Q);
+            break;
+        }
+        default:
+            fprintf(output, "        // %s\n", filter_type_name(*filter));
+            break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+
+    FILE* output = stdout;
+    if (argc == 2)
+    {
+        output = fopen(argv[1], "w");
+        if (!output)
+        {
+            fprintf(stderr, "Cannot open output file '%s'\n", argv[1]);
+            exit(1);
+        }
+    }
+
+    const filter_configuration_tlv *filters = default_filter_configuration();
+    const uint8_t *begin = filters->filters;
+    const uint8_t *end = (const uint8_t *)filters + filters->header.length;
+
+    int stages = 0;
+    for (const uint8_t *ptr = begin; ptr < end; ptr += filter_definition_size(ptr))
+    {
+        if (!filter_definition_size(ptr))
+        {
+            fprintf(stderr, "Unknown filter type %d in the default configuration\n", *ptr);
+            exit(1);
+        }
+        stages++;
+    }
+
+    fprintf(output,
+        "/**\n"
+        " * This file is generated by tools/coeff_gen from default_config in\n"
+        " * configuration_manager.c, do not edit it by hand. Rebuild the\n"
+        " * default_coefficients target in the tools directory after changing the\n"
+        " * default filters.\n"
+        " */\n"
+        "#ifndef DEFAULT_COEFFICIENTS_H\n"
+        "#define DEFAULT_COEFFICIENTS_H\n"
+        "\n"
+        "#include \"bqf.h\"\n"
+        "\n"
+        "#define DEFAULT_FILTER_STAGES %d\n"
+        "\n"
+        "// Checksum of the default filter TLV these tables were generated from, if\n"
+        "// they no longer match the firmware falls back to designing the filters.\n"
+        "#define DEFAULT_FILTER_CHECKSUM 0x%08x\n"
+        "\n"
+        "typedef struct _default_coefficients_t {\n"
+        "    uint32_t fs;\n"
+        "    bqf_coeff_t coefficients[DEFAULT_FILTER_STAGES];\n"
+        "} default_coefficients_t;\n"
+        "\n"
+        "// { a0, a1, a2, b0, b1, b2 } in Q3.28\n"
+        "static const default_coefficients_t default_coefficients[] = {\n",
+        stages, tlv_checksum(&filters->header));
+
+    for (int i = 0; i < sizeof(supported_sampling_frequencies) / sizeof(supported_sampling_frequencies[0]); i++)
+    {
+        const unsigned fs = supported_sampling_frequencies[i];
+        fprintf(output, "    { %u, {\n", fs);
+        for (const uint8_t *ptr = begin; ptr < end; ptr += filter_definition_size(ptr))
+        {
+            bqf_coeff_t c;
+            design_filter(ptr, fs, &c);
+            describe_filter(output, ptr);
+            fprintf(output, "        { %d, %d, %d, %d, %d, %d },\n", c.a0, c.a1, c.a2, c.b0, c.b1, c.b2);
+        }
+        fprintf(output, "    } },\n");
+    }
+
+    fprintf(output, "};\n\n#endif // DEFAULT_COEFFICIENTS_H\n");
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+#include <complex.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const char* usage = "Usage: %s [-s] [-b BLOCK] [-t THREADS] IRFILE INFILE OUTFILE\n\n"
+    "Convolves 16bit stereo PCM data from INFILE with a long FIR filter and writes\n"
+    "24bit stereo PCM to OUTFILE, at the same level as filter_test so the two can be\n"
+    "compared directly.\n\n"
+    "IRFILE holds the filter taps as 32bit floats, the same taps are used for both\n"
+    "channels unless -s is given, then they are interleaved left/right.\n\n"
+    "  -s          IRFILE is stereo\n"
+    "  -b BLOCK    partition size in samples, a power of 2 (default 1024)\n"
+    "  -t THREADS  worker threads (default one per CPU)\n";
+
+#define CHANNELS 2
+#define SAMPLING_FREQ 48000
+
+/**
+ * Uniformly partitioned overlap-save convolution. The filter is cut into
+ * partitions of BLOCK taps, each is transformed once with a 2 * BLOCK point FFT.
+ * Every block of input is transformed once and kept in a frequency domain delay
+ * line, the output of a block is the sum over the partitions of each one times
+ * the input spectrum from that many blocks ago.
+ *
+ * Both channels are real, so they share one complex FFT: left in the real part
+ * and right in the imaginary part. Only the bins up to Nyquist are stored.
+ *
+ * The multiply-accumulate over the partitions is where the time goes for long
+ * filters. Each worker thread takes a contiguous range of the partitions and
+ * sums into its own accumulator, the main thread adds them up once every
+ * worker is done with the block.
+ */
+typedef struct _convolver_t {
+    int block;
+    int fft_size;
+    int bins;
+    int partitions;
+    int threads;
+    /// @brief Slot of the delay line the newest input spectrum goes in.
+    int newest;
+    double complex *twiddle;
+    int *bit_reverse;
+    /// @brief [partition][channel][bin]
+    double complex *filter;
+    /// @brief [slot][channel][bin]
+    double complex *delay_line;
+    /// @brief [thread][channel][bin]
+    double complex *accumulator;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    int stop;
+} convolver_t;
+
+typedef struct _worker_t {
+    convolver_t *convolver;
+    int first;
+    int last;
+    double complex *accumulator;
+} worker_t;
+
+static void fft_init(convolver_t *c)
+{
+    const int n = c->fft_size;
+    c->twiddle = malloc(n / 2 * sizeof(double complex));
+    c->bit_reverse = malloc(n * sizeof(int));
+    for (int k = 0; k < n / 2; k++)
+    {
+        c->twiddle[k] = cexp(-2.0 * M_PI * I * k / n);
+    }
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+        {
+            if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        c->bit_reverse[i] = r;
+    }
+}
+
+/// @brief In place radix 2 FFT, the inverse is unscaled.
+static void fft(const convolver_t *c, double complex *x, int inverse)
+{
+    const int n = c->fft_size;
+    for (int i = 0; i < n; i++)
+    {
+        const int r = c->bit_reverse[i];
+        if (r > i)
+        {
+            const double complex t = x[i];
+            x[i] = x[r];
+            x[r] = t;
+        }
+    }
+    for (int size = 2; size <= n; size *= 2)
+    {
+        const int half = size / 2;
+        const int step = n / size;
+        for (int start = 0; start < n; start += size)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                const double complex w = inverse ? conj(c->twiddle[k * step]) : c->twiddle[k * step];
+                const double complex t = w * x[start + k + half];
+                x[start + k + half] = x[start + k] - t;
+                x[start + k] += t;
+            }
+        }
+    }
+}
+
+/// @brief Splits the spectrum of two real signals packed as real + j * imaginary.
+static void split_spectrum(const convolver_t *c, const double complex *z, double complex *left, double complex *right)
+{
+    const int n = c->fft_size;
+    for (int k = 0; k < c->bins; k++)
+    {
+        const double complex a = z[k];
+        const double complex b = conj(z[(n - k) & (n - 1)]);
+        left[k] = 0.5 * (a + b);
+        right[k] = -0.5 * I * (a - b);
+    }
+}
+
+static double complex *slot(const convolver_t *c, double complex *base, int index, int channel)
+{
+    return base + ((size_t) index * CHANNELS + channel) * c->bins;
+}
+
+static void load_filter(convolver_t *c, const float *taps, int length, int stereo)
+{
+    double complex *z = malloc(c->fft_size * sizeof(double complex));
+    for (int p = 0; p < c->partitions; p++)
+    {
+        memset(z, 0, c->fft_size * sizeof(double complex));
+        for (int i = 0; i < c->block && p * c->block + i < length; i++)
+        {
+            const size_t tap = (size_t) p * c->block + i;
+            const double left = stereo ? taps[2 * tap] : taps[tap];
+            const double right = stereo ? taps[2 * tap + 1] : taps[tap];
+            // The 1 / N of the inverse FFT is folded into the filter.
+            z[i] = (left + I * right) / c->fft_size;
+        }
+        fft(c, z, 0);
+        split_spectrum(c, z, slot(c, c->filter, p, 0), slot(c, c->filter, p, 1));
+    }
+    free(z);
+}
+
+static void accumulate(convolver_t *c, int first, int last, double complex *accumulator)
+{
+    memset(accumulator, 0, CHANNELS * c->bins * sizeof(double complex));
+    for (int p = first; p < last; p++)
+    {
+        const int input = (c->newest + c->partitions - p) % c->partitions;
+        for (int channel = 0; channel < CHANNELS; channel++)
+        {
+            const double complex *x = slot(c, c->delay_line, input, channel);
+            const double complex *h = slot(c, c->filter, p, channel);
+            double complex *y = accumulator + channel * c->bins;
+            for (int k = 0; k < c->bins; k++)
+            {
+                y[k] += x[k] * h[k];
+            }
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *worker = arg;
+    convolver_t *c = worker->convolver;
+    while (1)
+    {
+        pthread_barrier_wait(&c->start);
+        if (c->stop) break;
+        accumulate(c, worker->first, worker->last, worker->accumulator);
+        pthread_barrier_wait(&c->done);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *read_file(const char *name, size_t *size)
+{
+    FILE* file = fopen(name, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open input file '%s'\n", name);
+        exit(1);
+    }
+    fseek(file, 0L, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+    void *data = malloc(*size ? *size : 1);
+    if (fread(data, 1, *size, file) != *size)
+    {
+        fprintf(stderr, "Cannot read input file '%s'\n", name);
+        exit(1);
+    }
+    fclose(file);
+    return data;
+}
+
+int main(int argc, char* argv[])
+{
+    int stereo = 0;
+    int block = 1024;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "sb:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': stereo = 1; break;
+            case 'b': block = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            default:
+                fprintf(stdout, usage, argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 3 || block < 16 || (block & (block - 1)) || threads < 1)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+
+    size_t ir_size, input_size;
+    const float *taps = read_file(argv[optind], &ir_size);
+    const int16_t *in = read_file(argv[optind + 1], &input_size);
+    const int length = ir_size / sizeof(float) / (stereo ? 2 : 1);
+    const size_t frames = input_size / (CHANNELS * sizeof(int16_t));
+    if (!length)
+    {
+        fprintf(stderr, "No filter taps in '%s'\n", argv[optind]);
+        exit(1);
+    }
+
+    FILE* output = fopen(argv[optind + 2], "wb");
+    if (!output)
+    {
+        fprintf(stderr, "Cannot open output file '%s'\n", argv[optind + 2]);
+        exit(1);
+    }
+
+    convolver_t c = { 0 };
+    c.block = block;
+    c.fft_size = 2 * block;
+    c.bins = block + 1;
+    c.partitions = (length + block - 1) / block;
+    c.threads = threads < c.partitions ? threads : c.partitions;
+    c.filter = calloc((size_t) c.partitions * CHANNELS * c.bins, sizeof(double complex));
+    c.delay_line = calloc((size_t) c.partitions * CHANNELS * c.bins, sizeof(double complex));
+    c.accumulator = calloc((size_t) c.threads * CHANNELS * c.bins, sizeof(double complex));
+    fft_init(&c);
+    load_filter(&c, taps, length, stereo);
+
+    // The main thread takes the first share of the partitions itself.
+    worker_t *workers = calloc(c.threads, sizeof(worker_t));
+    pthread_t *thread_ids = calloc(c.threads, sizeof(pthread_t));
+    pthread_barrier_init(&c.start, NULL, c.threads);
+    pthread_barrier_init(&c.done, NULL, c.threads);
+    for (int t = 0; t < c.threads; t++)
+    {
+        workers[t].convolver = &c;
+        workers[t].first = (int) ((long) c.partitions * t / c.threads);
+        workers[t].last = (int) ((long) c.partitions * (t + 1) / c.threads);
+        workers[t].accumulator = c.accumulator + (size_t) t * CHANNELS * c.bins;
+        if (t) pthread_create(&thread_ids[t], NULL, worker_main, &workers[t]);
+    }
+
+    double complex *z = malloc(c.fft_size * sizeof(double complex));
+    double complex *history = calloc(block, sizeof(double complex));
+    uint8_t *out = malloc((size_t) block * CHANNELS * 3);
+
+    const double start = now();
+    for (size_t frame = 0; frame < frames; frame += block)
+    {
+        // Overlap-save: the previous block followed by this one.
+        memcpy(z, history, block * sizeof(double complex));
+        for (int i = 0; i < block; i++)
+        {
+            const size_t n = frame + i;
+            z[block + i] = n < frames ? (in[2 * n] + I * in[2 * n + 1]) / 32768.0 : 0.0;
+        }
+        memcpy(history, z + block, block * sizeof(double complex));
+
+        fft(&c, z, 0);
+        c.newest = (c.newest + 1) % c.partitions;
+        split_spectrum(&c, z, slot(&c, c.delay_line, c.newest, 0), slot(&c, c.delay_line, c.newest, 1));
+
+        pthread_barrier_wait(&c.start);
+        accumulate(&c, workers[0].first, workers[0].last, workers[0].accumulator);
+        pthread_barrier_wait(&c.done);
+
+        for (int t = 1; t < c.threads; t++)
+        {
+            const double complex *partial = workers[t].accumulator;
+            for (int k = 0; k < CHANNELS * c.bins; k++) c.accumulator[k] += partial[k];
+        }
+
+        // Put the two real spectra back together as left + j * right.
+        const double complex *left = c.accumulator;
+        const double complex *right = c.accumulator + c.bins;
+        for (int k = 0; k < c.bins; k++)
+        {
+            z[k] = left[k] + I * right[k];
+        }
+        for (int k = c.bins; k < c.fft_size; k++)
+        {
+            z[k] = conj(left[c.fft_size - k]) + I * conj(right[c.fft_size - k]);
+        }
+        fft(&c, z, 1);
+
+        // Same scaling as filter_test, full scale 16bit input comes out at half 24bit full scale.
+        const int count = frames - frame < (size_t) block ? (int) (frames - frame) : block;
+        for (int i = 0; i < count; i++)
+        {
+            const double sample[CHANNELS] = { creal(z[block + i]), cimag(z[block + i]) };
+            for (int channel = 0; channel < CHANNELS; channel++)
+            {
+                const double scaled = round(sample[channel] * (1 << 22));
+                const int32_t s24 = scaled > 0x7fffff ? 0x7fffff : scaled < -0x800000 ? -0x800000 : (int32_t) scaled;
+                uint8_t *bytes = &out[(i * CHANNELS + channel) * 3];
+                bytes[0] = s24 & 0xff;
+                bytes[1] = (s24 >> 8) & 0xff;
+                bytes[2] = (s24 >> 16) & 0xff;
+            }
+        }
+        fwrite(out, 3, (size_t) count * CHANNELS, output);
+    }
+    const double elapsed = now() - start;
+
+    c.stop = 1;
+    pthread_barrier_wait(&c.start);
+    for (int t = 1; t < c.threads; t++) pthread_join(thread_ids[t], NULL);
+    fclose(output);
+
+    const double audio = (double) frames / SAMPLING_FREQ;
+    fprintf(stderr, "%d taps in %d partitions of %d on %d threads: %.2fs of audio in %.2fs, %.1fx real time\n",
+        length, c.partitions, block, c.threads, audio, elapsed, elapsed > 0 ? audio / elapsed : 0.0);
+    return 0;
+}
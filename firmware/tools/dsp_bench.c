@@ -0,0 +1,374 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bqf.h"
+#include "crossfeed.h"
+#include "fix16.h"
+#include "fir.h"
+#include "halfband.h"
+#include "limiter.h"
+#include "loudness.h"
+#include "quantizer.h"
+
+const char* usage = "Usage: %s [-n SAMPLES] [-j JSONFILE] [-e ENGINE]\n\n"
+    "Times the firmware DSP code, compiled from the same sources, across stage\n"
+    "counts, filter types, input signals and block sizes. Prints ns per sample and\n"
+    "samples per second for each engine and case, and optionally writes the results\n"
+    "as JSON for tracking them over time.\n\n"
+    "  -n SAMPLES   samples to time each case over (default 96000)\n"
+    "  -j JSONFILE  also write the results to JSONFILE, - for stdout and the table\n"
+    "               on stderr\n"
+    "  -e ENGINE    only run the engines whose name starts with ENGINE\n\n"
+    "The numbers are for the machine the benchmark runs on, not the RP2040.\n";
+
+#define FS 48000
+// Samples processed between two readings of the clock, a whole number of every block size.
+#define PASS_SAMPLES 3840
+
+typedef enum { SIGNAL_SILENCE, SIGNAL_NOISE, SIGNAL_SINE, SIGNALS } signal_type;
+static const char *signal_names[SIGNALS] = { "silence", "noise", "sine" };
+
+typedef enum { FILTER_PEAKING, FILTER_LOWPASS, FILTER_HIGHSHELF, FILTER_ALLPASS, FILTER_TYPES } filter_type_t;
+static const char *filter_names[FILTER_TYPES] = { "peaking", "lowpass", "highshelf", "allpass" };
+
+static const int stage_counts[] = { 1, 5, 10, MAX_FILTER_STAGES };
+static const int block_sizes[] = { 16, 48, MAX_BLOCK_SAMPLES };
+static const int fir_taps[] = { 32, 128, FIR_MAX_TAPS };
+
+/// @brief What one case is set up with, the engines ignore what they do not use.
+typedef struct _bench_case_t {
+    const char *engine;
+    int stages;
+    filter_type_t filter;
+    int taps;
+    int mode;
+    signal_type signal;
+    int block;
+} bench_case_t;
+
+typedef void (*engine_fn)(const bench_case_t *, fix3_28_t *, int);
+
+static fix3_28_t source[PASS_SAMPLES];
+static fix3_28_t work[PASS_SAMPLES];
+static fix3_28_t oversampled[2 * MAX_BLOCK_SAMPLES];
+static int32_t quantized[MAX_BLOCK_SAMPLES];
+
+static bqf_coeff_t filters[MAX_FILTER_STAGES];
+static bqf_mem_t memory[MAX_FILTER_STAGES];
+static bqf_ramp_t ramp;
+static fir_filter_t fir;
+static halfband_t halfband;
+static crossfeed_t crossfeed;
+static limiter_t limiter;
+static quantizer_t quantizer;
+
+static FILE *table;
+static FILE *json;
+static int json_results;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_signal(signal_type signal)
+{
+    unsigned seed = 1;
+    for (int n = 0; n < PASS_SAMPLES; n++)
+    {
+        switch (signal)
+        {
+            case SIGNAL_SILENCE:
+                source[n] = 0;
+                break;
+            case SIGNAL_NOISE:
+                seed = seed * 1103515245 + 12345;
+                source[n] = (fix3_28_t)(seed >> 4) - (1 << 27);
+                break;
+            default:
+                // Full scale at the input of the chain, 997Hz so it does not line up with the blocks
+                source[n] = fix3_28_from_dbl(sin(2.0 * M_PI * 997.0 * n / FS));
+                break;
+        }
+    }
+}
+
+/// @brief Spreads the stages over the audio band, alternating boosts and cuts.
+static void make_chain(int stages, filter_type_t filter)
+{
+    for (int j = 0; j < stages; j++)
+    {
+        const double f0 = 30.0 * pow(15000.0 / 30.0, (j + 0.5) / stages);
+        const double gain = j & 1 ? -3.0 : 3.0;
+        switch (filter)
+        {
+            case FILTER_PEAKING:
+                bqf_peaking_config(FS, f0, gain, 1.4, &filters[j]);
+                break;
+            case FILTER_LOWPASS:
+                bqf_lowpass_config(FS, f0, Q_BUTTERWORTH, &filters[j]);
+                break;
+            case FILTER_HIGHSHELF:
+                bqf_highshelf_config(FS, f0, gain, 0.71, &filters[j]);
+                break;
+            default:
+                bqf_allpass_config(FS, f0, 0.71, &filters[j]);
+                break;
+        }
+        bqf_memreset(&memory[j]);
+    }
+}
+
+/// @brief The chain a sample at a time, through every stage before the next sample.
+static void run_bqf_transform(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    for (int n = 0; n < samples; n++)
+    {
+        fix3_28_t x = block[n];
+        for (int j = 0; j < c->stages; j++)
+        {
+            x = bqf_transform(x, &filters[j], &memory[j]);
+        }
+        block[n] = x;
+    }
+}
+
+static void run_filter_chain(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    filter_chain_transform(block, samples, filters, memory, c->stages, &fir, &ramp);
+}
+
+static void run_filter_chain_ramp(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    // The steps are 0 so the coefficients stay put, but every sample pays for them.
+    ramp.remaining = INT_MAX;
+    filter_chain_transform(block, samples, filters, memory, c->stages, &fir, &ramp);
+}
+
+static void run_fir(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    fir_transform_block(block, samples, &fir);
+}
+
+static void run_halfband(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    halfband_interpolate(block, samples, oversampled, &halfband);
+}
+
+static void run_loudness(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    loudness_transform_block(block, samples, &loudness_left);
+}
+
+static void run_crossfeed(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    for (int n = 0; n < samples; n++)
+    {
+        block[n] = crossfeed_transform(block[n], block[samples - 1 - n], &crossfeed);
+    }
+}
+
+static void run_limiter(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    for (int n = 0; n < samples; n++)
+    {
+        block[n] = limiter_transform(block[n], &limiter);
+    }
+    limiter_packet_done(&limiter);
+}
+
+static void run_quantizer(const bench_case_t *c, fix3_28_t *block, int samples)
+{
+    quantize_block(block, samples, quantized, 1, &quantizer);
+}
+
+/// @brief Sets up the state an engine needs for a case, once before timing it.
+static void prepare(const bench_case_t *c)
+{
+    memset(&ramp, 0, sizeof(ramp));
+    memset(&fir, 0, sizeof(fir));
+    if (c->stages)
+    {
+        make_chain(c->stages, c->filter);
+        memcpy(ramp.target, filters, sizeof(filters));
+    }
+    if (c->taps)
+    {
+        float taps[FIR_MAX_TAPS];
+        for (int k = 0; k < c->taps; k++)
+        {
+            taps[k] = 1.0f / c->taps;
+        }
+        fir_config(taps, c->taps, &fir);
+        fir_memreset(&fir);
+    }
+    halfband_config(&halfband);
+    loudness_init(FS);
+    loudness_config(true, 0.0, 1.0);
+    loudness_set_volume(-30 * 256, &loudness_left);
+    crossfeed_config(FS, 700.0, -6.0, 300.0, &crossfeed);
+    crossfeed_memreset(&crossfeed);
+    limiter_config(FS, -0.3, 1000.0, 50.0, &limiter);
+    limiter_reset(&limiter);
+    quantizer_config(c->mode & 3, c->mode >> 2, &quantizer);
+    make_signal(c->signal);
+}
+
+static void report(const bench_case_t *c, double ns_per_sample)
+{
+    char params[64] = "";
+    if (c->stages)
+        snprintf(params, sizeof(params), "%d x %s", c->stages, filter_names[c->filter]);
+    else if (c->taps)
+        snprintf(params, sizeof(params), "%d taps", c->taps);
+    else if (!strcmp(c->engine, "quantize_block"))
+        snprintf(params, sizeof(params), "mode %d shaping %d", c->mode & 3, c->mode >> 2);
+    fprintf(table, "%-24s %-20s %-8s %6d %12.2f %14.0f %10.1f\n", c->engine, params, signal_names[c->signal], c->block,
+        ns_per_sample, 1e9 / ns_per_sample, 1e9 / ns_per_sample / FS);
+
+    if (json)
+    {
+        fprintf(json, "%s\n    {\"engine\": \"%s\", \"stages\": %d, \"filter\": ", json_results++ ? "," : "",
+            c->engine, c->stages);
+        if (c->stages)
+            fprintf(json, "\"%s\"", filter_names[c->filter]);
+        else
+            fprintf(json, "null");
+        fprintf(json, ", \"taps\": %d, \"mode\": %d, \"signal\": \"%s\", \"block\": %d, "
+            "\"ns_per_sample\": %.4f, \"samples_per_sec\": %.0f}",
+            c->taps, c->mode, signal_names[c->signal], c->block, ns_per_sample, 1e9 / ns_per_sample);
+    }
+}
+
+static void bench(const bench_case_t *c, engine_fn engine, long samples)
+{
+    prepare(c);
+    const long passes = (samples + PASS_SAMPLES - 1) / PASS_SAMPLES;
+    double elapsed = 0.0;
+    for (long p = 0; p < passes; p++)
+    {
+        memcpy(work, source, sizeof(work));
+        const double start = now();
+        for (int n = 0; n < PASS_SAMPLES; n += c->block)
+        {
+            engine(c, &work[n], c->block);
+        }
+        elapsed += now() - start;
+    }
+    report(c, elapsed * 1e9 / (passes * PASS_SAMPLES));
+}
+
+#define COUNT(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+int main(int argc, char* argv[])
+{
+    long samples = 96000;
+    const char *json_file = NULL;
+    const char *only = "";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:e:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                samples = atol(optarg);
+                break;
+            case 'j':
+                json_file = optarg;
+                break;
+            case 'e':
+                only = optarg;
+                break;
+            default:
+                fprintf(stdout, usage, argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc || samples <= 0)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+    if (json_file)
+    {
+        json = strcmp(json_file, "-") ? fopen(json_file, "w") : stdout;
+        if (!json)
+        {
+            fprintf(stderr, "Cannot open output file '%s'\n", json_file);
+            exit(1);
+        }
+        fprintf(json, "{\"benchmark\": \"dsp_bench\", \"fs\": %d, \"samples\": %ld, \"results\": [", FS, samples);
+    }
+    // The table goes to stderr when stdout is taken by the JSON.
+    table = json == stdout ? stderr : stdout;
+
+    fprintf(table, "%-24s %-20s %-8s %6s %12s %14s %10s\n", "engine", "case", "signal", "block", "ns/sample",
+        "samples/sec", "x realtime");
+
+    static const struct { const char *name; engine_fn fn; } chain_engines[] = {
+        { "bqf_transform", run_bqf_transform },
+        { "filter_chain_transform", run_filter_chain },
+        { "filter_chain_ramp", run_filter_chain_ramp },
+    };
+    for (int e = 0; e < COUNT(chain_engines); e++)
+    {
+        if (strncmp(chain_engines[e].name, only, strlen(only))) continue;
+        for (int s = 0; s < COUNT(stage_counts); s++)
+            for (int f = 0; f < FILTER_TYPES; f++)
+                for (int signal = 0; signal < SIGNALS; signal++)
+                    for (int b = 0; b < COUNT(block_sizes); b++)
+                    {
+                        const bench_case_t c = { chain_engines[e].name, stage_counts[s], f, 0, 0, signal,
+                            block_sizes[b] };
+                        bench(&c, chain_engines[e].fn, samples);
+                    }
+    }
+
+    if (!strncmp("fir_transform_block", only, strlen(only)))
+    {
+        for (int t = 0; t < COUNT(fir_taps); t++)
+            for (int signal = 0; signal < SIGNALS; signal++)
+                for (int b = 0; b < COUNT(block_sizes); b++)
+                {
+                    const bench_case_t c = { "fir_transform_block", 0, 0, fir_taps[t], 0, signal, block_sizes[b] };
+                    bench(&c, run_fir, samples);
+                }
+    }
+
+    static const struct { const char *name; engine_fn fn; int modes; } engines[] = {
+        { "halfband_interpolate", run_halfband, 1 },
+        { "loudness_transform_block", run_loudness, 1 },
+        { "crossfeed_transform", run_crossfeed, 1 },
+        { "limiter_transform", run_limiter, 1 },
+        // mode in bits 0-1, noise shaping order in bits 2-3
+        { "quantize_block", run_quantizer, 4 },
+    };
+    static const int quantizer_modes[] = {
+        QUANTIZE_TRUNCATE, QUANTIZE_ROUND, QUANTIZE_TPDF_DITHER, QUANTIZE_TPDF_DITHER | (2 << 2)
+    };
+    for (int e = 0; e < COUNT(engines); e++)
+    {
+        if (strncmp(engines[e].name, only, strlen(only))) continue;
+        for (int m = 0; m < engines[e].modes; m++)
+            for (int signal = 0; signal < SIGNALS; signal++)
+                for (int b = 0; b < COUNT(block_sizes); b++)
+                {
+                    const bench_case_t c = { engines[e].name, 0, 0, 0, engines[e].modes > 1 ? quantizer_modes[m] : 0,
+                        signal, block_sizes[b] };
+                    bench(&c, engines[e].fn, samples);
+                }
+    }
+
+    if (json)
+    {
+        fprintf(json, "\n]}\n");
+        fclose(json);
+    }
+    return 0;
+}
@@ -0,0 +1,480 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bqf.h"
+#include "fix16.h"
+#include "fir.h"
+#include "configuration_manager.h"
+
+const char* usage = "Usage: %s [-u] BASELINE\n\n"
+    "Runs the fixed point filter chain of the firmware and a double precision\n"
+    "reference of the same chain over a set of stimuli, for several filter\n"
+    "configurations, and measures SNR, THD+N, the largest deviation and the number\n"
+    "of clipped samples of the firmware output against the reference.\n\n"
+    "The results are checked against BASELINE, it exits with 1 if any of them got\n"
+    "worse. Output that is bit for bit the same as when the baseline was made is\n"
+    "reported as exact. The conversion to 24-bit output samples is checked too,\n"
+    "including that it saturates rather than wraps.\n\n"
+    "  -u  write the results to BASELINE instead of checking them\n";
+
+#define FS 48000
+// The firmware runs each USB packet through the chain as a block, 1ms at 48kHz.
+#define PACKET_FRAMES 48
+// One 24-bit output LSB in Q3.28, the DAC takes +-2.0 as full scale.
+#define OUTPUT_LSB 64.0
+#define FULL_SCALE (1 << 29)
+// Transients are left out of the THD+N.
+#define SETTLE_SAMPLES 4800
+
+// How much worse than the baseline a result may get before it fails. They are
+// printed to 3 decimal places, so this also covers the rounding.
+#define DB_TOLERANCE 0.01
+#define LSB_TOLERANCE 0.01
+
+typedef struct _stimulus_t {
+    const char *name;
+    int samples;
+    /// @brief For sines, the frequency THD+N is measured against, otherwise 0.
+    double frequency;
+} stimulus_t;
+
+static const stimulus_t stimuli[] = {
+    { "impulse", FS / 4, 0 },
+    { "sweep", 2 * FS, 0 },
+    { "multitone", FS, 0 },
+    { "sine_997_-1dB", FS, 997 },
+    { "sine_997_-60dB", FS, 997 },
+    { "sine_100_-90dB", FS, 100 },
+};
+#define STIMULI ((int) (sizeof(stimuli) / sizeof(stimuli[0])))
+
+static const char *configs[] = { "flat", "default", "peaking", "bass", "fir" };
+#define CONFIGS ((int) (sizeof(configs) / sizeof(configs[0])))
+
+typedef struct _result_t {
+    double snr;
+    double thdn;        // NAN when the stimulus is not a sine
+    double max_deviation;
+    int clips;
+    uint32_t hash;
+} result_t;
+
+static bqf_coeff_t filters[MAX_FILTER_STAGES];
+static bqf_mem_t memory[MAX_FILTER_STAGES];
+static int stages;
+static fir_filter_t fir;
+static bqf_ramp_t ramp;
+
+/**
+ * The stimuli are generated at the full resolution of Q3.28 rather than 16
+ * bits, so the low level sines measure the DSP and not the input format.
+ */
+static double make_stimulus(const stimulus_t *s, int n)
+{
+    const double t = (double) n / FS;
+    if (!strcmp(s->name, "impulse"))
+    {
+        return n == 0 || n == FS / 8 ? 0.999 : 0.0;
+    }
+    if (!strcmp(s->name, "sweep"))
+    {
+        // Exponential 20Hz to 20kHz
+        const double duration = (double) s->samples / FS;
+        const double k = log(20000.0 / 20.0);
+        return 0.5 * sin(2.0 * M_PI * 20.0 * duration / k * (exp(t / duration * k) - 1.0));
+    }
+    if (!strcmp(s->name, "multitone"))
+    {
+        // 24 tones spaced evenly in log frequency, with fixed pseudo random phases
+        double x = 0.0;
+        unsigned seed = 7;
+        for (int i = 0; i < 24; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            const double phase = 2.0 * M_PI * (seed >> 8) / (double) (1 << 24);
+            x += sin(2.0 * M_PI * 30.0 * pow(16000.0 / 30.0, i / 23.0) * t + phase);
+        }
+        return x * 0.7 / 24;
+    }
+    const double level = strstr(s->name, "-90dB") ? -90.0 : strstr(s->name, "-60dB") ? -60.0 : -1.0;
+    return pow(10.0, level / 20.0) * sin(2.0 * M_PI * s->frequency * t);
+}
+
+static void make_config(const char *name)
+{
+    memset(memory, 0, sizeof(memory));
+    memset(&fir, 0, sizeof(fir));
+    memset(&ramp, 0, sizeof(ramp));
+    stages = 0;
+    if (!strcmp(name, "default"))
+    {
+        load_config();
+        stages = filter_stages_left;
+        memcpy(filters, bqf_filters_left, sizeof(filters));
+    }
+    else if (!strcmp(name, "peaking"))
+    {
+        for (stages = 0; stages < 10; stages++)
+        {
+            const double f0 = 30.0 * pow(15000.0 / 30.0, stages / 9.0);
+            bqf_peaking_config(FS, f0, stages & 1 ? -6.0 : 6.0, 1.4, &filters[stages]);
+        }
+    }
+    else if (!strcmp(name, "bass"))
+    {
+        // Low and narrow, where the coefficients sit closest to the unit circle
+        bqf_highpass_config(FS, 15.0, Q_BUTTERWORTH, &filters[stages++]);
+        bqf_lowshelf_config(FS, 40.0, 10.0, 0.71, &filters[stages++]);
+        bqf_peaking_config(FS, 25.0, -8.0, 4.0, &filters[stages++]);
+        bqf_peaking_config(FS, 60.0, 4.0, 8.0, &filters[stages++]);
+    }
+    else if (!strcmp(name, "fir"))
+    {
+        // 63 tap Hann windowed low pass at 8kHz, after a peaking filter
+        bqf_peaking_config(FS, 1000.0, -3.0, 1.0, &filters[stages++]);
+        float taps[63];
+        for (int k = 0; k < 63; k++)
+        {
+            const double m = k - 31;
+            const double sinc = m ? sin(2.0 * M_PI * 8000.0 / FS * m) / (M_PI * m) : 2.0 * 8000.0 / FS;
+            taps[k] = sinc * (0.5 - 0.5 * cos(2.0 * M_PI * (k + 1) / 64));
+        }
+        fir_config(taps, 63, &fir);
+        fir.position = 1;
+    }
+}
+
+/// @brief The chain in double precision, with the same coefficients the firmware runs.
+static void reference_chain(const double *input, double *output, int samples)
+{
+    double h[FIR_MAX_TAPS];
+    for (int k = 0; k < fir.taps; k++)
+    {
+        const int folded = k < (fir.taps + 1) / 2 ? k : fir.taps - 1 - k;
+        h[k] = fir.coefficients[folded] / (2.0 * fix16_one);
+    }
+    memcpy(output, input, samples * sizeof(double));
+
+    for (int j = 0; j <= stages; j++)
+    {
+        if (fir.taps && j == fir.position)
+        {
+            double *x = malloc(samples * sizeof(double));
+            memcpy(x, output, samples * sizeof(double));
+            for (int n = 0; n < samples; n++)
+            {
+                double y = 0.0;
+                for (int k = 0; k < fir.taps && k <= n; k++)
+                {
+                    y += h[k] * x[n - k];
+                }
+                output[n] = y;
+            }
+            free(x);
+        }
+        if (j == stages) break;
+
+        const double one = fix16_one;
+        const double b0 = filters[j].b0 / one, b1 = filters[j].b1 / one, b2 = filters[j].b2 / one;
+        const double a1 = filters[j].a1 / one, a2 = filters[j].a2 / one;
+        double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+        for (int n = 0; n < samples; n++)
+        {
+            const double x = output[n];
+            const double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            output[n] = y;
+        }
+    }
+}
+
+/// @brief THD+N in dB of a sine, against a least squares fit of the fundamental and DC.
+static double thdn(const double *y, int samples, double frequency)
+{
+    // Normal equations for y = a sin + b cos + c
+    double m[3][4] = { { 0 } };
+    for (int n = SETTLE_SAMPLES; n < samples; n++)
+    {
+        const double w = 2.0 * M_PI * frequency * n / FS;
+        const double basis[3] = { sin(w), cos(w), 1.0 };
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++) m[r][c] += basis[r] * basis[c];
+            m[r][3] += basis[r] * y[n];
+        }
+    }
+    for (int p = 0; p < 3; p++)
+    {
+        for (int r = p + 1; r < 3; r++)
+        {
+            const double f = m[r][p] / m[p][p];
+            for (int c = p; c < 4; c++) m[r][c] -= f * m[p][c];
+        }
+    }
+    double coefficients[3];
+    for (int r = 2; r >= 0; r--)
+    {
+        double v = m[r][3];
+        for (int c = r + 1; c < 3; c++) v -= m[r][c] * coefficients[c];
+        coefficients[r] = v / m[r][r];
+    }
+
+    double fundamental = 0.0, residual = 0.0;
+    for (int n = SETTLE_SAMPLES; n < samples; n++)
+    {
+        const double w = 2.0 * M_PI * frequency * n / FS;
+        const double f = coefficients[0] * sin(w) + coefficients[1] * cos(w);
+        const double r = y[n] - f - coefficients[2];
+        fundamental += f * f;
+        residual += r * r;
+    }
+    return 10.0 * log10(residual / fundamental);
+}
+
+static result_t run(const char *config, const stimulus_t *s)
+{
+    make_config(config);
+    const int samples = s->samples;
+    fix3_28_t *input = malloc(samples * sizeof(fix3_28_t));
+    double *exact = malloc(samples * sizeof(double));
+    double *reference = malloc(samples * sizeof(double));
+    double *output = malloc(samples * sizeof(double));
+    for (int n = 0; n < samples; n++)
+    {
+        input[n] = fix3_28_from_dbl(make_stimulus(s, n));
+        exact[n] = input[n] / (double) fix16_one;
+    }
+
+    result_t result = { 0 };
+    result.hash = 2166136261u;
+    fix3_28_t block[MAX_BLOCK_SAMPLES];
+    for (int packet = 0; packet < samples; packet += PACKET_FRAMES)
+    {
+        const int frames = packet + PACKET_FRAMES < samples ? PACKET_FRAMES : samples - packet;
+        memcpy(block, &input[packet], frames * sizeof(fix3_28_t));
+        filter_chain_transform(block, frames, filters, memory, stages, &fir, &ramp);
+        for (int n = 0; n < frames; n++)
+        {
+            output[packet + n] = block[n] / (double) fix16_one;
+            if (block[n] >= FULL_SCALE || block[n] <= -FULL_SCALE) result.clips++;
+            // FNV-1a, to tell whether the output changed at all
+            for (int b = 0; b < 4; b++)
+            {
+                result.hash = (result.hash ^ ((uint32_t) block[n] >> (8 * b) & 0xff)) * 16777619u;
+            }
+        }
+    }
+    reference_chain(exact, reference, samples);
+
+    double signal = 0.0, noise = 0.0, max_deviation = 0.0;
+    for (int n = 0; n < samples; n++)
+    {
+        const double error = output[n] - reference[n];
+        signal += reference[n] * reference[n];
+        noise += error * error;
+        if (fabs(error) > max_deviation) max_deviation = fabs(error);
+    }
+    result.snr = noise > 0 ? 10.0 * log10(signal / noise) : 999.0;
+    result.max_deviation = max_deviation * fix16_one / OUTPUT_LSB;
+    result.thdn = s->frequency ? thdn(output, samples, s->frequency) : NAN;
+
+    free(input);
+    free(exact);
+    free(reference);
+    free(output);
+    return result;
+}
+
+/**
+ * The output conversion has exact answers, they are checked as they are
+ * rather than against the baseline. Past +-2.0 it must saturate to the
+ * 24-bit limits, a wrapped sample is a full scale click.
+ */
+static const struct {
+    double input;
+    int32_t expected;
+} conversions[] = {
+    { 0.0, 0 },
+    { 1.0, 0x400000 },
+    { -1.0, -0x400000 },
+    { 2.0 - 1.0 / (1 << 22), 0x7fffff },
+    { 2.0, 0x7fffff },
+    { 3.5, 0x7fffff },
+    { -2.0, -0x800000 },
+    { -3.5, -0x800000 },
+};
+#define CONVERSIONS ((int) (sizeof(conversions) / sizeof(conversions[0])))
+
+/// @brief Runs the output conversion checks, returns the number that failed.
+static int check_conversions(void)
+{
+    int failures = 0;
+    for (int i = 0; i < CONVERSIONS; i++)
+    {
+        const int32_t output = norm_fix3_28_to_s16sample(fix3_28_from_dbl(conversions[i].input));
+        if (output != conversions[i].expected)
+        {
+            printf("output conversion of %.7f gave 0x%06x, expected 0x%06x  REGRESSED\n", conversions[i].input,
+                output & 0xffffff, conversions[i].expected & 0xffffff);
+            failures++;
+        }
+    }
+    if (!failures) printf("output conversion of %d values  ok\n", CONVERSIONS);
+    return failures;
+}
+
+typedef struct _baseline_t {
+    char config[32];
+    char stimulus[32];
+    result_t result;
+} baseline_t;
+
+static int read_baseline(const char *path, baseline_t *baseline, int max)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open baseline file '%s'\n", path);
+        exit(1);
+    }
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) && count < max)
+    {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        baseline_t *b = &baseline[count];
+        char thdn[32];
+        if (sscanf(line, "%31s %31s %lf %31s %lf %d %x", b->config, b->stimulus, &b->result.snr, thdn,
+            &b->result.max_deviation, &b->result.clips, &b->result.hash) != 7)
+        {
+            fprintf(stderr, "Cannot parse baseline line: %s", line);
+            exit(1);
+        }
+        b->result.thdn = strcmp(thdn, "-") ? atof(thdn) : NAN;
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/// @brief Describes how a result compares to its baseline, returns 1 if it got worse.
+static int compare(const result_t *r, const result_t *b, char *status, size_t size)
+{
+    if (r->hash == b->hash)
+    {
+        snprintf(status, size, "exact");
+        return 0;
+    }
+    snprintf(status, size, "REGRESSED");
+    int worse = 0;
+    if (r->snr < b->snr - DB_TOLERANCE)
+    {
+        snprintf(status + strlen(status), size - strlen(status), " snr %.3f<%.3f", r->snr, b->snr);
+        worse = 1;
+    }
+    if (!isnan(b->thdn) && r->thdn > b->thdn + DB_TOLERANCE)
+    {
+        snprintf(status + strlen(status), size - strlen(status), " thd+n %.3f>%.3f", r->thdn, b->thdn);
+        worse = 1;
+    }
+    if (r->max_deviation > b->max_deviation + LSB_TOLERANCE)
+    {
+        snprintf(status + strlen(status), size - strlen(status), " dev %.3f>%.3f", r->max_deviation,
+            b->max_deviation);
+        worse = 1;
+    }
+    if (r->clips > b->clips)
+    {
+        snprintf(status + strlen(status), size - strlen(status), " clips %d>%d", r->clips, b->clips);
+        worse = 1;
+    }
+    if (!worse) snprintf(status, size, "ok");
+    return worse;
+}
+
+int main(int argc, char* argv[])
+{
+    int update = 0;
+    if (argc == 3 && !strcmp(argv[1], "-u"))
+    {
+        update = 1;
+    }
+    else if (argc != 2)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+    const char *path = argv[argc - 1];
+
+    static baseline_t baseline[CONFIGS * STIMULI];
+    const int baselines = update ? 0 : read_baseline(path, baseline, CONFIGS * STIMULI);
+    FILE *output = NULL;
+    if (update)
+    {
+        output = fopen(path, "w");
+        if (!output)
+        {
+            fprintf(stderr, "Cannot open baseline file '%s'\n", path);
+            exit(1);
+        }
+        fprintf(output, "# Generated by dsp_regress -u, see tools/README.md\n"
+            "# config stimulus snr_db thdn_db max_deviation_lsb clips hash\n");
+    }
+
+    printf("%-8s %-16s %10s %10s %10s %6s  %s\n", "config", "stimulus", "SNR dB", "THD+N dB", "max LSB", "clips",
+        update ? "" : "status");
+    int failures = 0;
+    for (int c = 0; c < CONFIGS; c++)
+    {
+        for (int s = 0; s < STIMULI; s++)
+        {
+            const result_t r = run(configs[c], &stimuli[s]);
+            char thdn[32] = "-";
+            if (!isnan(r.thdn)) snprintf(thdn, sizeof(thdn), "%.3f", r.thdn);
+
+            char status[128] = "";
+            if (output)
+            {
+                fprintf(output, "%s %s %.3f %s %.3f %d 0x%08x\n", configs[c], stimuli[s].name, r.snr, thdn,
+                    r.max_deviation, r.clips, r.hash);
+            }
+            else
+            {
+                const baseline_t *b = NULL;
+                for (int i = 0; i < baselines; i++)
+                {
+                    if (!strcmp(baseline[i].config, configs[c]) && !strcmp(baseline[i].stimulus, stimuli[s].name))
+                        b = &baseline[i];
+                }
+                if (b)
+                    failures += compare(&r, &b->result, status, sizeof(status));
+                else
+                    snprintf(status, sizeof(status), "no baseline");
+            }
+            printf("%-8s %-16s %10.3f %10s %10.3f %6d  %s\n", configs[c], stimuli[s].name, r.snr, thdn,
+                r.max_deviation, r.clips, status);
+        }
+    }
+
+    printf("\n");
+    failures += check_conversions();
+
+    if (output)
+    {
+        fclose(output);
+        printf("\nBaseline written to %s\n", path);
+        return 0;
+    }
+    if (failures)
+    {
+        printf("\n%d result%s regressed\n", failures, failures > 1 ? "s" : "");
+        return 1;
+    }
+    printf("\nNo regressions\n");
+    return 0;
+}
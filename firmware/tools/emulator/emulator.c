@@ -0,0 +1,493 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "run.h"
+#include "trace.h"
+
+const char* usage = "Usage: %s [-o OUTFILE] [-f FLASHFILE] [-v VOLUME] [-c COMMANDS] [-r RESPONSES] [-t TRACEFILE]\n"
+    "       [-d PPM] [-w CAPTURE] [-l LOGFILE] {INFILE | -p CAPTURE}\n\n"
+    "Runs the firmware on the PC, with both cores as threads and the USB host, DAC\n"
+    "and flash emulated. INFILE is 48kHz stereo s16le, - for stdin, and is streamed\n"
+    "to the firmware the way a host would, sized by the firmware's feedback.\n\n"
+    "  -o  write what the DAC plays to OUTFILE as s24le, from the first packet on\n"
+    "  -f  keep the flash in FLASHFILE, so saved configurations are there next time\n"
+    "  -v  set the volume to VOLUME dB before streaming\n"
+    "  -c  send the configuration requests in COMMANDS before streaming, as the\n"
+    "      bytes the host would write to the configuration interface\n"
+    "  -r  append the responses to the requests in COMMANDS to RESPONSES\n"
+    "  -t  read the trace off both cores at the end, for trace_decode\n"
+    "  -d  run the DAC clock PPM parts per million fast, or slow if negative\n"
+    "  -p  send the packets in CAPTURE instead, each in the frame it was sent in\n"
+    "  -w  capture the packets sent to CAPTURE, for -p\n"
+    "  -l  log the ring buffer, the packet and the feedback every frame to LOGFILE\n";
+
+// The firmware's main(), renamed when run.c is built for the emulator.
+int firmware_main(void);
+
+// The depth of each of the RP2040's inter-core FIFOs.
+#define FIFO_DEPTH 8
+
+// The scheduler gives up waiting for the cores to go idle after this long. Core 1
+// spins when the ring buffer is full, until the DMA makes room, and the DMA needs
+// the clock to move on.
+#define STALL_TIMEOUT_MS 200
+// Core 0 never goes idle in this long, it has locked up.
+#define HANG_TIMEOUT_MS 10000
+
+typedef enum _core_state {
+    CORE_OFF = 0,
+    CORE_RUNNING,
+    CORE_POP,       // waiting on an empty FIFO
+    CORE_PUSH,      // waiting on a full FIFO
+    CORE_WFI,       // core 0 waiting for an interrupt
+} core_state;
+
+static const char *state_names[] = { "not started", "running", "waiting for the other core to push",
+    "waiting for the other core to pop", "waiting for an interrupt" };
+
+typedef struct _core_t {
+    pthread_t thread;
+    core_state state;
+    void (*entry)(void);
+    /// @brief What the other core pushed, for this one to pop.
+    uintptr_t fifo[FIFO_DEPTH];
+    unsigned int fifo_head;
+    unsigned int fifo_count;
+    systick_hw_t systick;
+} core_t;
+
+pthread_mutex_t emulator_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t emulator_changed = PTHREAD_COND_INITIALIZER;
+
+static core_t cores[2];
+static _Thread_local unsigned int core_num;
+
+static uint64_t now_ns;
+static uint32_t sys_clock_hz = 125000000;
+
+static irq_handler_t irq_handlers[NUM_IRQS];
+static uint32_t enabled_irqs;
+static uint32_t pending_irqs;
+
+static uint32_t stalls;
+
+uint64_t emulator_time_ns(void)
+{
+    return __atomic_load_n(&now_ns, __ATOMIC_RELAXED);
+}
+
+static void set_time(uint64_t ns)
+{
+    __atomic_store_n(&now_ns, ns, __ATOMIC_RELAXED);
+}
+
+static void set_state(core_t *core, core_state state)
+{
+    core->state = state;
+    pthread_cond_broadcast(&emulator_changed);
+}
+
+static bool blocked(const core_t *core, const core_t *other)
+{
+    return (core->state == CORE_POP && !core->fifo_count) ||
+        (core->state == CORE_PUSH && other->fifo_count == FIFO_DEPTH);
+}
+
+/// @brief Neither core can get any further, and nothing outside them can help.
+static bool deadlocked(void)
+{
+    if (cores[1].state == CORE_OFF)
+        return blocked(&cores[0], &cores[1]);
+    return blocked(&cores[0], &cores[1]) && blocked(&cores[1], &cores[0]);
+}
+
+/// @brief Both cores are waiting for the next interrupt or packet.
+static bool idle(void)
+{
+    return cores[0].state == CORE_WFI && !(pending_irqs & enabled_irqs) &&
+        (cores[1].state == CORE_OFF || (cores[1].state == CORE_POP && !cores[1].fifo_count));
+}
+
+static void print_trace(uint8_t core, FILE *output)
+{
+    // The last few events are what led up to it.
+    trace_event_t events[16];
+    uint32_t start;
+    const uint32_t head = trace_rings[core].head;
+    const uint32_t count = trace_read(core, head > 16 ? head - 16 : 0, events, &start);
+    for (uint32_t i = 0; i < count && i < 16; i++)
+    {
+        fprintf(output, "    %10u us  type %u value %u\n", events[i].time, TRACE_TYPE(events[i].event),
+            TRACE_VALUE(events[i].event));
+    }
+}
+
+void emulator_fail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%.3f ms: ", emulator_time_ns() / 1e6);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    for (uint8_t core = 0; core < 2; core++)
+    {
+        fprintf(stderr, "  core %u %s, %u in its FIFO, last traced:\n", core, state_names[cores[core].state],
+            cores[core].fifo_count);
+        print_trace(core, stderr);
+    }
+    exit(2);
+}
+
+void emulator_raise_irq(unsigned int irq)
+{
+    pending_irqs |= 1u << irq;
+    pthread_cond_broadcast(&emulator_changed);
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    pthread_mutex_lock(&emulator_lock);
+    if (enabled)
+        enabled_irqs |= 1u << num;
+    else
+        enabled_irqs &= ~(1u << num);
+    pthread_cond_broadcast(&emulator_changed);
+    pthread_mutex_unlock(&emulator_lock);
+}
+
+/**
+ * Core 0 takes its interrupts here, lowest number first as the NVIC does when
+ * they have the same priority. Each runs to completion before the next.
+ */
+void emulator_wfi(void)
+{
+    pthread_mutex_lock(&emulator_lock);
+    set_state(&cores[0], CORE_WFI);
+    while (!(pending_irqs & enabled_irqs))
+        pthread_cond_wait(&emulator_changed, &emulator_lock);
+    const uint32_t irqs = pending_irqs & enabled_irqs;
+    pending_irqs &= ~irqs;
+    set_state(&cores[0], CORE_RUNNING);
+    pthread_mutex_unlock(&emulator_lock);
+
+    for (unsigned int irq = 0; irq < NUM_IRQS; irq++)
+    {
+        if (irqs & (1u << irq) && irq_handlers[irq])
+            irq_handlers[irq]();
+    }
+}
+
+void multicore_fifo_push_blocking(uintptr_t data)
+{
+    pthread_mutex_lock(&emulator_lock);
+    core_t *self = &cores[core_num];
+    core_t *other = &cores[core_num ^ 1];
+    while (other->fifo_count == FIFO_DEPTH)
+    {
+        set_state(self, CORE_PUSH);
+        pthread_cond_wait(&emulator_changed, &emulator_lock);
+    }
+    other->fifo[(other->fifo_head + other->fifo_count++) % FIFO_DEPTH] = data;
+    set_state(self, CORE_RUNNING);
+    pthread_mutex_unlock(&emulator_lock);
+}
+
+uintptr_t multicore_fifo_pop_blocking(void)
+{
+    pthread_mutex_lock(&emulator_lock);
+    core_t *self = &cores[core_num];
+    while (!self->fifo_count)
+    {
+        set_state(self, CORE_POP);
+        pthread_cond_wait(&emulator_changed, &emulator_lock);
+    }
+    const uintptr_t data = self->fifo[self->fifo_head];
+    self->fifo_head = (self->fifo_head + 1) % FIFO_DEPTH;
+    self->fifo_count--;
+    set_state(self, CORE_RUNNING);
+    pthread_mutex_unlock(&emulator_lock);
+    return data;
+}
+
+static void *core_thread(void *arg)
+{
+    core_num = (unsigned int) (uintptr_t) arg;
+    if (core_num == 0)
+    {
+        firmware_main();
+        emulator_fail("main() returned");
+    }
+    cores[1].entry();
+    emulator_fail("core 1 returned");
+    return NULL;
+}
+
+static void start_core(unsigned int core)
+{
+    set_state(&cores[core], CORE_RUNNING);
+    if (pthread_create(&cores[core].thread, NULL, core_thread, (void *) (uintptr_t) core))
+    {
+        fprintf(stderr, "Cannot start core %u\n", core);
+        exit(1);
+    }
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    pthread_mutex_lock(&emulator_lock);
+    cores[1].entry = entry;
+    start_core(1);
+    pthread_mutex_unlock(&emulator_lock);
+}
+
+uint get_core_num(void)
+{
+    return core_num;
+}
+
+systick_hw_t *emulator_systick(void)
+{
+    core_t *core = &cores[core_num];
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    const uint64_t ns = (uint64_t) cpu.tv_sec * NS_PER_S + cpu.tv_nsec;
+    const uint64_t cycles = ns * (sys_clock_hz / 1000) / 1000000;
+    core->systick.cvr = 0x00ffffff - (cycles & 0x00ffffff);
+    return &core->systick;
+}
+
+uint32_t time_us_32(void)
+{
+    return (uint32_t) (emulator_time_ns() / NS_PER_US);
+}
+
+uint64_t time_us_64(void)
+{
+    return emulator_time_ns() / NS_PER_US;
+}
+
+/**
+ * Moves the clock on without anything else happening meanwhile. The firmware
+ * only sleeps in setup(), before there is anything else to happen.
+ */
+void sleep_us(uint64_t us)
+{
+    set_time(emulator_time_ns() + us * NS_PER_US);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t) ms * 1000);
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+    sys_clock_hz = freq_khz * 1000;
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    return sys_clock_hz;
+}
+
+bool stdio_init_all(void)
+{
+    return true;
+}
+
+static void deadline_after(struct timespec *deadline, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_nsec += (long) ms * 1000000;
+    deadline->tv_sec += deadline->tv_nsec / 1000000000;
+    deadline->tv_nsec %= 1000000000;
+}
+
+/// @brief Waits for both cores to run out of work, with emulator_lock held.
+static void wait_idle(void)
+{
+    struct timespec deadline;
+    deadline_after(&deadline, STALL_TIMEOUT_MS);
+    int waited = 0;
+    while (!idle())
+    {
+        if (deadlocked())
+            emulator_fail("Deadlock, neither core can get any further");
+        if (pthread_cond_timedwait(&emulator_changed, &emulator_lock, &deadline) != ETIMEDOUT)
+            continue;
+        waited += STALL_TIMEOUT_MS;
+        if (cores[0].state == CORE_WFI && !(pending_irqs & enabled_irqs))
+        {
+            // Core 1 is still busy, let the clock run and the DMA drain the ring.
+            stalls++;
+            return;
+        }
+        if (waited >= HANG_TIMEOUT_MS)
+            emulator_fail("Core 0 has not gone idle for %d s", HANG_TIMEOUT_MS / 1000);
+        deadline_after(&deadline, STALL_TIMEOUT_MS);
+    }
+}
+
+/**
+ * Moves the clock on from one event to the next, a USB frame or the DMA
+ * finishing a buffer, whichever is sooner, until the host runs out of input
+ * and the ring buffer has drained.
+ */
+static void run(bool trace)
+{
+    pthread_mutex_lock(&emulator_lock);
+    start_core(0);
+    for (;;)
+    {
+        wait_idle();
+        if (host_finished())
+            break;
+        const uint64_t frame = host_next_frame_ns();
+        const uint64_t dma = dma_next_ns();
+        if (frame == UINT64_MAX && dma == UINT64_MAX)
+            break;
+        if (dma <= frame)
+        {
+            set_time(dma);
+            dma_complete();
+        }
+        else
+        {
+            set_time(frame);
+            host_frame();
+        }
+    }
+    if (trace)
+    {
+        host_request_trace();
+        wait_idle();
+    }
+    pthread_mutex_unlock(&emulator_lock);
+}
+
+static FILE *open_file(const char *path, const char *mode)
+{
+    if (!strcmp(path, "-"))
+        return mode[0] == 'r' ? stdin : stdout;
+    FILE *file = fopen(path, mode);
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        exit(1);
+    }
+    return file;
+}
+
+int main(int argc, char* argv[])
+{
+    emulator_host_t host = { 0 };
+    const char *flash_file = NULL;
+    double drift = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:f:v:c:r:t:d:p:w:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                emulator_dac_output = open_file(optarg, "wb");
+                break;
+            case 'f':
+                flash_file = optarg;
+                break;
+            case 'v':
+                host.set_volume = true;
+                host.volume = (int16_t) (atof(optarg) * 256);
+                break;
+            case 'c':
+                host.commands = open_file(optarg, "rb");
+                break;
+            case 'r':
+                host.responses = open_file(optarg, "ab");
+                break;
+            case 't':
+                host.trace_path = optarg;
+                break;
+            case 'd':
+                drift = atof(optarg);
+                break;
+            case 'p':
+                host.replay = open_file(optarg, "rb");
+                break;
+            case 'w':
+                host.record = open_file(optarg, "wb");
+                break;
+            case 'l':
+                host.log = open_file(optarg, "w");
+                break;
+            default:
+                fprintf(stdout, usage, argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc - (host.replay ? 0 : 1))
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+    if (!host.replay)
+        host.input = open_file(argv[optind], "rb");
+
+    flash_open(flash_file);
+    dac_set_drift(drift);
+    host_init(&host);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run(host.trace_path != NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (emulator_dac_output)
+        fflush(emulator_dac_output);
+    if (host.record)
+        fflush(host.record);
+    if (host.log)
+        fflush(host.log);
+    const double emulated = emulator_time_ns() / 1e9;
+    const double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Emulated %.3f s in %.3f s, %.1fx real time\n", emulated, elapsed, emulated / elapsed);
+    host_report(stdout);
+    printf("Ring buffer: %u to %u bytes, mean %u, over %u DMA transfers\n", emulator_ring.min, emulator_ring.max,
+        emulator_ring.samples ? (uint32_t) (emulator_ring.total / emulator_ring.samples) : 0, emulator_ring.samples);
+    if (emulator_ring.underruns)
+    {
+        printf("Underruns: %u, the first at %.3f ms and the last at %.3f ms\n", emulator_ring.underruns,
+            emulator_ring.first_underrun_ns / 1e6, emulator_ring.last_underrun_ns / 1e6);
+    }
+    else
+    {
+        printf("Underruns: none\n");
+    }
+    if (stalls)
+        printf("Core 1 was still busy when the clock moved on %u times\n", stalls);
+    if (drift)
+        printf("DAC: %.3f Hz, %+g ppm\n", OUTPUT_FREQ * (1 + drift / 1e6), drift);
+    pcm3060_report(stdout);
+
+    // The cores are left waiting where they are.
+    exit(0);
+}
@@ -0,0 +1,105 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * The firmware runs unmodified on two threads, one per core. Interrupts are
+ * taken on the core 0 thread while it waits in __wfi(), one after another like
+ * the same priority interrupts on the RP2040, so the firmware's own locking
+ * assumptions still hold.
+ *
+ * The clock is emulated. It only moves on to the next USB frame or DMA transfer
+ * once both cores have nothing left to do, so the DSP takes no emulated time and
+ * a run does not depend on how busy the machine running it is. Anything that
+ * goes wrong, goes wrong the same way on every run.
+ */
+
+#define NS_PER_US 1000ull
+#define NS_PER_S 1000000000ull
+
+/// @brief Guards everything the cores and the scheduler share.
+extern pthread_mutex_t emulator_lock;
+extern pthread_cond_t emulator_changed;
+
+/// @brief The emulated time, only changed by the scheduler.
+uint64_t emulator_time_ns(void);
+
+/// @brief Marks an interrupt pending on core 0, with emulator_lock held.
+void emulator_raise_irq(unsigned int irq);
+
+/// @brief Prints the message and the state of both cores, and exits.
+void emulator_fail(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+// hardware.c
+typedef struct _emulator_ring_t {
+    uint32_t samples;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t underruns;
+    uint64_t first_underrun_ns;
+    uint64_t last_underrun_ns;
+} emulator_ring_t;
+
+extern emulator_ring_t emulator_ring;
+extern FILE *emulator_dac_output;
+
+void flash_open(const char *path);
+/// @brief When the running DMA channel finishes its buffer, or UINT64_MAX.
+uint64_t dma_next_ns(void);
+/// @brief Plays out the buffer of the running channel and starts the next.
+void dma_complete(void);
+/// @brief Runs the DAC's clock fast or slow by ppm, as its crystal would.
+void dac_set_drift(double ppm);
+void pcm3060_report(FILE *output);
+
+// usb.c
+/**
+ * USB traffic captures start with CAPTURE_MAGIC, followed by a record for each
+ * audio packet: when it was sent, its length and then its payload, all little
+ * endian. The times only matter relative to each other, each packet is sent in
+ * the USB frame its time falls in. tools/usb_capture.py makes one out of the
+ * traffic to a real device.
+ */
+#define CAPTURE_MAGIC 0x42535550 // "PUSB"
+
+typedef struct __attribute__((__packed__)) _capture_record_t {
+    uint64_t time_ns;
+    uint16_t length;
+} capture_record_t;
+
+typedef struct _emulator_host_t {
+    /// @brief s16le stereo to stream, sized by the feedback, or NULL to replay.
+    FILE *input;
+    /// @brief A capture to send the packets of as they were captured.
+    FILE *replay;
+    /// @brief Where to capture the packets sent, if anywhere.
+    FILE *record;
+    /// @brief Where to log the ring buffer each frame, if anywhere.
+    FILE *log;
+    FILE *commands;
+    FILE *responses;
+    const char *trace_path;
+    bool set_volume;
+    int16_t volume;
+} emulator_host_t;
+
+void host_init(const emulator_host_t *host);
+/// @brief When the host starts its next frame, or UINT64_MAX once it has
+///        nothing left to send.
+uint64_t host_next_frame_ns(void);
+void host_frame(void);
+/// @brief True from the first audio packet until the input runs out.
+bool host_streaming(void);
+bool host_finished(void);
+/// @brief Reads the trace off the device, as tools/trace_dump.py does.
+void host_request_trace(void);
+void host_report(FILE *output);
+/// @brief The USB interrupt, runs whatever the host queued for this frame.
+void usb_irq(void);
+
+#endif
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "pico/unique_id.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/vreg.h"
+#include "run.h"
+
+emulator_ring_t emulator_ring = { .min = UINT32_MAX };
+FILE *emulator_dac_output;
+
+/*****************************************************************************
+ * DMA. The I2S state machine is fed by two channels chained to each other,
+ * each plays its half of the buffer at the DAC rate and then interrupts.
+ ****************************************************************************/
+
+typedef struct _dma_channel_t {
+    bool claimed;
+    dma_channel_config config;
+    const volatile void *read_addr;
+    uint32_t transfer_count;
+    bool irq_enabled;
+    bool irq_status;
+} dma_channel_t;
+
+static dma_channel_t channels[NUM_DMA_CHANNELS];
+
+// The channel playing now, and the DAC frames played before it started.
+static int running = -1;
+static uint64_t dac_start_ns;
+static uint64_t dac_frames;
+static bool recording;
+// The DAC's clock, nominal unless it is made to drift.
+static double dac_freq = OUTPUT_FREQ;
+
+bool dma_channel_is_claimed(uint channel)
+{
+    return channels[channel].claimed;
+}
+
+int dma_claim_unused_channel(bool required)
+{
+    for (int channel = 0; channel < NUM_DMA_CHANNELS; channel++)
+    {
+        if (!channels[channel].claimed)
+        {
+            channels[channel].claimed = true;
+            return channel;
+        }
+    }
+    if (required)
+        emulator_fail("No free DMA channels");
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    const dma_channel_config config = { DMA_SIZE_32, channel, true, false };
+    return config;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+    c->transfer_size = size;
+}
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to)
+{
+    c->chain_to = chain_to;
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+    c->read_increment = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+    c->write_increment = incr;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+    const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    channels[channel].config = *config;
+    channels[channel].read_addr = read_addr;
+    channels[channel].transfer_count = transfer_count;
+    if (trigger)
+        dma_channel_start(channel);
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger)
+{
+    channels[channel].read_addr = read_addr;
+    if (trigger)
+        dma_channel_start(channel);
+}
+
+void dma_channel_start(uint channel)
+{
+    if (running < 0)
+    {
+        dac_start_ns = emulator_time_ns();
+        dac_frames = 0;
+    }
+    running = channel;
+}
+
+bool dma_irqn_get_channel_status(uint irq_index, uint channel)
+{
+    return channels[channel].irq_status;
+}
+
+void dma_irqn_acknowledge_channel(uint irq_index, uint channel)
+{
+    channels[channel].irq_status = false;
+}
+
+void dma_irqn_set_channel_enabled(uint irq_index, uint channel, bool enabled)
+{
+    channels[channel].irq_enabled = enabled;
+}
+
+static uint32_t frames(const dma_channel_t *channel)
+{
+    return channel->transfer_count / SAMPLES_PER_FRAME;
+}
+
+uint64_t dma_next_ns(void)
+{
+    if (running < 0)
+        return UINT64_MAX;
+    return dac_start_ns + (uint64_t) ((dac_frames + frames(&channels[running])) * (double) NS_PER_S / dac_freq);
+}
+
+void dac_set_drift(double ppm)
+{
+    dac_freq = OUTPUT_FREQ * (1 + ppm / 1e6);
+}
+
+static void record_ring(void)
+{
+    const uint32_t available = ringbuf_available_data(&i2s_write_obj.ring_buffer);
+    emulator_ring.samples++;
+    emulator_ring.total += available;
+    if (available < emulator_ring.min) emulator_ring.min = available;
+    if (available > emulator_ring.max) emulator_ring.max = available;
+    // The interrupt is about to refill the buffer that just played, see feed_dma().
+    if (available < SIZEOF_HALF_DMA_BUFFER_IN_BYTES)
+    {
+        if (!emulator_ring.underruns)
+            emulator_ring.first_underrun_ns = emulator_time_ns();
+        emulator_ring.last_underrun_ns = emulator_time_ns();
+        emulator_ring.underruns++;
+    }
+}
+
+void dma_complete(void)
+{
+    dma_channel_t *channel = &channels[running];
+    if (host_streaming())
+        recording = true;
+    if (recording && emulator_dac_output)
+    {
+        // s24le, as filter_test writes
+        const int32_t *words = (const int32_t *) channel->read_addr;
+        uint8_t bytes[3 * SIZEOF_HALF_DMA_BUFFER_IN_BYTES / 4];
+        for (uint32_t i = 0; i < channel->transfer_count; i++)
+        {
+            bytes[3 * i] = words[i];
+            bytes[3 * i + 1] = words[i] >> 8;
+            bytes[3 * i + 2] = words[i] >> 16;
+        }
+        fwrite(bytes, 3, channel->transfer_count, emulator_dac_output);
+    }
+    if (host_streaming())
+        record_ring();
+
+    dac_frames += frames(channel);
+    if (channel->irq_enabled)
+    {
+        channel->irq_status = true;
+        emulator_raise_irq(DMA_IRQ_1);
+    }
+    running = channel->config.chain_to != running ? channel->config.chain_to : -1;
+}
+
+/*****************************************************************************
+ * The PCM3060, only its registers.
+ ****************************************************************************/
+
+struct i2c_inst {
+    uint baudrate;
+};
+
+i2c_inst_t i2c0_inst;
+
+static uint8_t pcm3060_registers[128];
+static uint32_t pcm3060_writes;
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop)
+{
+    if (addr != PCM_I2C_ADDR || !len)
+        return -1;
+    // The first byte is the register, the PCM3060 moves on to the next one with each byte after that.
+    for (size_t i = 1; i < len && src[0] + i - 1 < sizeof(pcm3060_registers); i++)
+    {
+        pcm3060_registers[src[0] + i - 1] = src[i];
+    }
+    pcm3060_writes++;
+    return len;
+}
+
+void pcm3060_report(FILE *output)
+{
+    const uint8_t mode = pcm3060_registers[64];
+    fprintf(output, "PCM3060: %u register writes, DAC %s (register 64 = 0x%02x), volume left %.1f dB right %.1f dB\n",
+        pcm3060_writes, mode == 0xE0 ? "on" : mode == 0xF0 ? "in low power mode" : "off", mode,
+        ((int) pcm3060_registers[65] - 255) / 2.0, ((int) pcm3060_registers[66] - 255) / 2.0);
+}
+
+/*****************************************************************************
+ * Flash, written through to a file if there is one.
+ ****************************************************************************/
+
+uint8_t emulator_flash[PICO_FLASH_SIZE_BYTES];
+static FILE *flash_file;
+
+/// @brief Starts off erased, or with what the file holds if it is given.
+void flash_open(const char *path)
+{
+    memset(emulator_flash, 0xff, sizeof(emulator_flash));
+    if (!path)
+        return;
+    flash_file = fopen(path, "r+b");
+    if (flash_file)
+    {
+        if (fread(emulator_flash, 1, sizeof(emulator_flash), flash_file) != sizeof(emulator_flash))
+        {
+            fprintf(stderr, "Flash file '%s' is not %u bytes\n", path, PICO_FLASH_SIZE_BYTES);
+            exit(1);
+        }
+        return;
+    }
+    flash_file = fopen(path, "w+b");
+    if (!flash_file || fwrite(emulator_flash, 1, sizeof(emulator_flash), flash_file) != sizeof(emulator_flash))
+    {
+        fprintf(stderr, "Cannot create flash file '%s'\n", path);
+        exit(1);
+    }
+    fflush(flash_file);
+}
+
+static void flash_write_back(uint32_t offset, size_t count)
+{
+    if (!flash_file)
+        return;
+    fseek(flash_file, offset, SEEK_SET);
+    fwrite(&emulator_flash[offset], 1, count, flash_file);
+    fflush(flash_file);
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    if (flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || flash_offs + count > sizeof(emulator_flash))
+        emulator_fail("Bad flash erase of %zu bytes at 0x%x", count, flash_offs);
+    memset(&emulator_flash[flash_offs], 0xff, count);
+    flash_write_back(flash_offs, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    if (flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || flash_offs + count > sizeof(emulator_flash))
+        emulator_fail("Bad flash program of %zu bytes at 0x%x", count, flash_offs);
+    // Programming can only clear bits.
+    for (size_t i = 0; i < count; i++)
+    {
+        emulator_flash[flash_offs + i] &= data[i];
+    }
+    flash_write_back(flash_offs, count);
+}
+
+/*****************************************************************************
+ * Everything else the firmware sets up but the emulation has no use for.
+ ****************************************************************************/
+
+pio_hw_t pio1_hw;
+
+uint pio_claim_unused_sm(PIO pio, bool required) { return 0; }
+uint pio_add_program(PIO pio, const pio_program_t *program) { return 0; }
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {}
+void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config) {}
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {}
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask) {}
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask) {}
+void pio_gpio_init(PIO pio, uint pin) {}
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) { return 0; }
+
+pio_sm_config pio_get_default_sm_config(void)
+{
+    const pio_sm_config config = { 0 };
+    return config;
+}
+
+void sm_config_set_clkdiv(pio_sm_config *c, float div) {}
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {}
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) {}
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) {}
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs) {}
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) {}
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {}
+
+void gpio_init(uint gpio) {}
+void gpio_set_dir(uint gpio, bool out) {}
+void gpio_put(uint gpio, bool value) {}
+void gpio_set_function(uint gpio, enum gpio_function fn) {}
+void gpio_pull_up(uint gpio) {}
+
+uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1) & 7; }
+uint pwm_gpio_to_channel(uint gpio) { return gpio & 1; }
+void pwm_set_phase_correct(uint slice_num, bool phase_correct) {}
+void pwm_set_wrap(uint slice_num, uint16_t wrap) {}
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {}
+void pwm_set_enabled(uint slice_num, bool enabled) {}
+
+void vreg_set_voltage(enum vreg_voltage voltage) {}
+
+void pico_get_unique_board_id_string(char *id_out, uint len)
+{
+    snprintf(id_out, len, "E0000000000000EE");
+}
+
+void reset_usb_boot(uint32_t gpio_activity_pin_mask, uint32_t disable_interface_mask)
+{
+    printf("%.3f ms: rebooted into the bootloader\n", emulator_time_ns() / 1e6);
+    exit(0);
+}
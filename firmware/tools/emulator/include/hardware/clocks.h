@@ -0,0 +1,14 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_HARDWARE_CLOCKS_H
+#define EMULATOR_HARDWARE_CLOCKS_H
+
+#include "pico/stdlib.h"
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+/// @brief What set_sys_clock_khz() last set.
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#endif
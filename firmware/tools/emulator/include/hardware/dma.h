@@ -0,0 +1,41 @@
+// Stand-in for the pico SDK, see tools/emulator. A started channel plays its
+// buffer at the DAC rate of the emulated clock, then raises its interrupt and
+// starts the channel it is chained to.
+#ifndef EMULATOR_HARDWARE_DMA_H
+#define EMULATOR_HARDWARE_DMA_H
+
+#include "pico/stdlib.h"
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+    uint8_t transfer_size;
+    uint8_t chain_to;
+    bool read_increment;
+    bool write_increment;
+} dma_channel_config;
+
+bool dma_channel_is_claimed(uint channel);
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+    const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_start(uint channel);
+
+bool dma_irqn_get_channel_status(uint irq_index, uint channel);
+void dma_irqn_acknowledge_channel(uint irq_index, uint channel);
+void dma_irqn_set_channel_enabled(uint irq_index, uint channel, bool enabled);
+
+#endif
@@ -0,0 +1,17 @@
+// Stand-in for the pico SDK, see tools/emulator. The flash is an array that
+// can be kept in a file between runs.
+#ifndef EMULATOR_HARDWARE_FLASH_H
+#define EMULATOR_HARDWARE_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+extern uint8_t emulator_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t) emulator_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif
@@ -0,0 +1,26 @@
+// Stand-in for the pico SDK, see tools/emulator. The pins are not modelled.
+#ifndef EMULATOR_HARDWARE_GPIO_H
+#define EMULATOR_HARDWARE_GPIO_H
+
+#include <stdbool.h>
+
+enum gpio_function {
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+};
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+void gpio_init(unsigned int gpio);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_put(unsigned int gpio, bool value);
+void gpio_set_function(unsigned int gpio, enum gpio_function fn);
+void gpio_pull_up(unsigned int gpio);
+
+#endif
@@ -0,0 +1,17 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_HARDWARE_IRQ_H
+#define EMULATOR_HARDWARE_IRQ_H
+
+#include "pico/stdlib.h"
+
+#define USBCTRL_IRQ 5
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+#define NUM_IRQS 32
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+
+#endif
@@ -0,0 +1,55 @@
+// Stand-in for the pico SDK, see tools/emulator. The state machine is not run,
+// the emulated DMA takes the I2S data straight out of its buffers.
+#ifndef EMULATOR_HARDWARE_PIO_H
+#define EMULATOR_HARDWARE_PIO_H
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    volatile uint32_t txf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t pio1_hw;
+#define pio1 (&pio1_hw)
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct {
+    uint32_t clkdiv;
+    uint32_t execctrl;
+    uint32_t shiftctrl;
+    uint32_t pinctrl;
+} pio_sm_config;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+uint pio_claim_unused_sm(PIO pio, bool required);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask);
+void pio_gpio_init(PIO pio, uint pin);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+
+#endif
@@ -0,0 +1,14 @@
+// Stand-in for the pico SDK, see tools/emulator. The PWM outputs are not modelled.
+#ifndef EMULATOR_HARDWARE_PWM_H
+#define EMULATOR_HARDWARE_PWM_H
+
+#include "pico/stdlib.h"
+
+uint pwm_gpio_to_slice_num(uint gpio);
+uint pwm_gpio_to_channel(uint gpio);
+void pwm_set_phase_correct(uint slice_num, bool phase_correct);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+void pwm_set_enabled(uint slice_num, bool enabled);
+
+#endif
@@ -0,0 +1,19 @@
+// Stand-in for the pico SDK, see tools/emulator. Each core's SysTick counts
+// down the CPU time its thread has used, at the RP2040's clock rate.
+#ifndef EMULATOR_HARDWARE_STRUCTS_SYSTICK_H
+#define EMULATOR_HARDWARE_STRUCTS_SYSTICK_H
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t rvr;
+    volatile uint32_t cvr;
+    volatile uint32_t calib;
+} systick_hw_t;
+
+/// @brief Brings the calling core's cvr up to date before it is read.
+systick_hw_t *emulator_systick(void);
+#define systick_hw (emulator_systick())
+
+#endif
@@ -0,0 +1,19 @@
+// Stand-in for the pico SDK, see tools/emulator. Interrupts are only taken
+// while core 0 waits in __wfi(), so disabling them has nothing to do.
+#ifndef EMULATOR_HARDWARE_SYNC_H
+#define EMULATOR_HARDWARE_SYNC_H
+
+#include "pico/stdlib.h"
+
+void emulator_wfi(void);
+#define __wfi() emulator_wfi()
+
+static inline uint32_t save_and_disable_interrupts(void) {
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+    (void) status;
+}
+
+#endif
@@ -0,0 +1,16 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_HARDWARE_VREG_H
+#define EMULATOR_HARDWARE_VREG_H
+
+#include "pico/stdlib.h"
+
+enum vreg_voltage {
+    VREG_VOLTAGE_1_10 = 0b1011,
+    VREG_VOLTAGE_1_15 = 0b1100,
+    VREG_VOLTAGE_1_20 = 0b1101,
+    VREG_VOLTAGE_DEFAULT = VREG_VOLTAGE_1_10,
+};
+
+void vreg_set_voltage(enum vreg_voltage voltage);
+
+#endif
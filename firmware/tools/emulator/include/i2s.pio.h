@@ -0,0 +1,16 @@
+// Stand-in for the header pioasm generates from code/i2s.pio, see tools/emulator.
+// The program is never run, only its length is used.
+#ifndef EMULATOR_I2S_PIO_H
+#define EMULATOR_I2S_PIO_H
+
+#include "hardware/pio.h"
+
+static const uint16_t i2s_write_program_instructions[8] = { 0 };
+
+static const pio_program_t i2s_write_program = {
+    .instructions = i2s_write_program_instructions,
+    .length = 8,
+    .origin = -1,
+};
+
+#endif
@@ -0,0 +1,10 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_PICO_BOOTROM_H
+#define EMULATOR_PICO_BOOTROM_H
+
+#include "pico/stdlib.h"
+
+/// @brief Ends the emulation, as the real one never returns either.
+void reset_usb_boot(uint32_t gpio_activity_pin_mask, uint32_t disable_interface_mask);
+
+#endif
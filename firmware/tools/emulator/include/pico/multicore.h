@@ -0,0 +1,13 @@
+// Stand-in for the pico SDK, see tools/emulator. Core 1 is a thread and the
+// inter-core FIFOs are queues of the same depth as the RP2040's. Their words
+// are pointer sized, since core 0 hands core 1 the address of a buffer.
+#ifndef EMULATOR_PICO_MULTICORE_H
+#define EMULATOR_PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_fifo_push_blocking(uintptr_t data);
+uintptr_t multicore_fifo_pop_blocking(void);
+
+#endif
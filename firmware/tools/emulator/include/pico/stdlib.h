@@ -0,0 +1,43 @@
+// Stand-in for the pico SDK, see tools/emulator. Only what the firmware uses.
+#ifndef EMULATOR_PICO_STDLIB_H
+#define EMULATOR_PICO_STDLIB_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef unsigned int uint;
+
+#define __packed __attribute__((packed))
+#define __aligned(n) __attribute__((aligned(n)))
+#define __unused __attribute__((unused))
+#define __not_in_flash_func(f) f
+#define __no_inline_not_in_flash_func(f) __attribute__((noinline)) f
+#define __time_critical_func(f) f
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+#include "hardware/gpio.h"
+
+// The emulated clock, see emulator.c. It only moves when both cores are idle.
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+bool stdio_init_all(void);
+uint get_core_num(void);
+
+#endif
@@ -0,0 +1,9 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_PICO_UNIQUE_ID_H
+#define EMULATOR_PICO_UNIQUE_ID_H
+
+#include "pico/stdlib.h"
+
+void pico_get_unique_board_id_string(char *id_out, uint len);
+
+#endif
@@ -0,0 +1,175 @@
+// Stand-in for the usb_device library from pico-extras, see tools/emulator.
+// The structures only have the members the firmware uses, the rest are the
+// emulated host's.
+#ifndef EMULATOR_PICO_USB_DEVICE_H
+#define EMULATOR_PICO_USB_DEVICE_H
+
+#include "pico/stdlib.h"
+
+#define USB_DIR_OUT 0x00u
+#define USB_DIR_IN 0x80u
+
+#define USB_REQ_TYPE_TYPE_MASK 0x60u
+#define USB_REQ_TYPE_TYPE_STANDARD 0x00u
+#define USB_REQ_TYPE_TYPE_CLASS 0x20u
+#define USB_REQ_TYPE_TYPE_VENDOR 0x40u
+
+#define USB_REQ_TYPE_RECIPIENT_MASK 0x1fu
+#define USB_REQ_TYPE_RECIPIENT_DEVICE 0x0u
+#define USB_REQ_TYPE_RECIPIENT_INTERFACE 0x1u
+#define USB_REQ_TYPE_RECIPIENT_ENDPOINT 0x2u
+
+#define USB_REQUEST_GET_DESCRIPTOR 0x06
+
+#define USB_DT_ENDPOINT 0x05
+
+#define usb_debug(...) ((void) 0)
+
+struct usb_setup_packet {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} __packed;
+
+struct usb_device_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+} __packed;
+
+struct usb_configuration_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t bNumInterfaces;
+    uint8_t bConfigurationValue;
+    uint8_t iConfiguration;
+    uint8_t bmAttributes;
+    uint8_t bMaxPower;
+} __packed;
+
+struct usb_interface_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bInterfaceNumber;
+    uint8_t bAlternateSetting;
+    uint8_t bNumEndpoints;
+    uint8_t bInterfaceClass;
+    uint8_t bInterfaceSubClass;
+    uint8_t bInterfaceProtocol;
+    uint8_t iInterface;
+} __packed;
+
+struct usb_endpoint_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bEndpointAddress;
+    uint8_t bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t bInterval;
+} __packed;
+
+struct usb_endpoint_descriptor_long {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bEndpointAddress;
+    uint8_t bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t bInterval;
+    uint8_t bRefresh;
+    uint8_t bSyncAddr;
+} __packed;
+
+struct usb_endpoint;
+struct usb_transfer;
+
+typedef void (*usb_transfer_func)(struct usb_endpoint *ep);
+typedef void (*usb_transfer_completed_func)(struct usb_endpoint *ep, struct usb_transfer *transfer);
+
+struct usb_buffer {
+    uint8_t *data;
+    uint16_t data_len;
+    uint16_t data_max;
+    bool valid;
+};
+
+struct usb_transfer_type {
+    usb_transfer_func on_packet;
+    usb_transfer_func on_cancel;
+    uint8_t initial_packet_count;
+    bool sharded;
+};
+
+struct usb_transfer {
+    const struct usb_transfer_type *type;
+    usb_transfer_completed_func on_complete;
+    uint32_t remaining_packets_to_submit;
+    uint32_t remaining_packets_to_handle;
+    bool started;
+    bool completed;
+};
+
+struct usb_endpoint {
+    const struct usb_endpoint_descriptor *descriptor;
+    struct usb_transfer *default_transfer;
+    struct usb_transfer *current_transfer;
+    bool (*setup_request_handler)(struct usb_endpoint *ep, struct usb_setup_packet *setup);
+    /// @brief The packet the host is sending or reading, only valid in on_packet.
+    struct usb_buffer buffer;
+    uint32_t packets_done;
+};
+
+struct usb_interface {
+    const struct usb_interface_descriptor *descriptor;
+    struct usb_endpoint *const *endpoints;
+    uint8_t endpoint_count;
+    bool (*setup_request_handler)(struct usb_interface *interface, struct usb_setup_packet *setup);
+    bool (*set_alternate_handler)(struct usb_interface *interface, uint alt);
+    uint8_t alt;
+};
+
+struct usb_device {
+    const struct usb_device_descriptor *device_descriptor;
+    const struct usb_configuration_descriptor *config_descriptor;
+    struct usb_interface *const *interfaces;
+    uint interface_count;
+    const char *(*get_descriptor_string)(uint index);
+    bool (*setup_request_handler)(struct usb_device *device, struct usb_setup_packet *setup);
+};
+
+struct usb_buffer *usb_current_in_packet_buffer(struct usb_endpoint *ep);
+struct usb_buffer *usb_current_out_packet_buffer(struct usb_endpoint *ep);
+void usb_grow_transfer(struct usb_transfer *transfer, uint packet_count);
+void usb_packet_done(struct usb_endpoint *ep);
+
+struct usb_interface *usb_interface_init(struct usb_interface *interface, const struct usb_interface_descriptor *descriptor,
+    struct usb_endpoint *const *endpoints, uint endpoint_count, bool double_buffered);
+void usb_set_default_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer);
+struct usb_device *usb_device_init(const struct usb_device_descriptor *device_descriptor,
+    const struct usb_configuration_descriptor *config_descriptor, struct usb_interface *const *interfaces,
+    uint interface_count, const char *(*get_descriptor_string)(uint index));
+void usb_device_start(void);
+
+struct usb_endpoint *usb_get_control_in_endpoint(void);
+struct usb_endpoint *usb_get_control_out_endpoint(void);
+void usb_start_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer);
+void usb_start_empty_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer,
+    usb_transfer_completed_func on_complete);
+void usb_start_tiny_control_in_transfer(uint32_t data, uint len);
+void usb_start_control_out_transfer(const struct usb_transfer_type *type);
+void usb_start_empty_control_in_transfer_null_completion(void);
+
+#endif
@@ -0,0 +1,27 @@
+// Stand-in for the usb_device library from pico-extras, see tools/emulator.
+#ifndef EMULATOR_PICO_USB_STREAM_HELPER_H
+#define EMULATOR_PICO_USB_STREAM_HELPER_H
+
+#include "pico/usb_device.h"
+
+struct usb_stream_transfer;
+
+struct usb_stream_transfer_funcs {
+    void (*on_chunk)(uint32_t chunk_len, struct usb_stream_transfer *transfer);
+    void (*on_packet_complete)(struct usb_stream_transfer *transfer);
+};
+
+struct usb_stream_transfer {
+    struct usb_transfer core;
+    struct usb_endpoint *ep;
+    const struct usb_stream_transfer_funcs *funcs;
+    const uint8_t *chunk;
+    uint32_t transfer_length;
+};
+
+void usb_stream_setup_transfer(struct usb_stream_transfer *transfer, const struct usb_stream_transfer_funcs *funcs,
+    const uint8_t *chunk_buffer, uint32_t chunk_size, uint32_t transfer_length, usb_transfer_completed_func on_complete);
+void usb_stream_noop_on_chunk(uint32_t chunk_len, struct usb_stream_transfer *transfer);
+void usb_stream_noop_on_packet_complete(struct usb_stream_transfer *transfer);
+
+#endif
@@ -0,0 +1,7 @@
+// Stand-in for the pico SDK, see tools/emulator.
+#ifndef EMULATOR_PICO_VERSION_H
+#define EMULATOR_PICO_VERSION_H
+
+#define PICO_SDK_VERSION_STRING "emulator"
+
+#endif
@@ -0,0 +1,569 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "pico/usb_device.h"
+#include "pico/usb_stream_helper.h"
+#include "hardware/irq.h"
+#include "run.h"
+#include "configuration_types.h"
+#include "trace.h"
+
+/*****************************************************************************
+ * The device side of the usb_device library. The firmware's handlers are
+ * called straight from the emulated host, a packet at a time.
+ ****************************************************************************/
+
+#define USB_FRAME_NS (NS_PER_S / 1000)
+
+#define AUDIO_OUT_ENDPOINT 0x01
+#define AUDIO_SYNC_ENDPOINT 0x82
+#define CONFIGURATION_OUT_ENDPOINT 0x03
+#define CONFIGURATION_IN_ENDPOINT 0x84
+#define AUDIO_STREAMING_INTERFACE 1
+
+// As big as the device's result buffer, see configuration_manager.c.
+#define RESULT_BUFFER_SIZE 2048
+
+static struct usb_device device;
+static bool device_started;
+static struct usb_endpoint control_in;
+static struct usb_endpoint control_out;
+
+// What the firmware started in answer to the last setup packet.
+static const struct usb_transfer_type *control_out_type;
+
+struct usb_buffer *usb_current_in_packet_buffer(struct usb_endpoint *ep)
+{
+    return &ep->buffer;
+}
+
+struct usb_buffer *usb_current_out_packet_buffer(struct usb_endpoint *ep)
+{
+    return &ep->buffer;
+}
+
+void usb_grow_transfer(struct usb_transfer *transfer, uint packet_count)
+{
+}
+
+void usb_packet_done(struct usb_endpoint *ep)
+{
+    ep->packets_done++;
+}
+
+/// @brief Takes the endpoint descriptors from those that follow the interface's, as the library does.
+struct usb_interface *usb_interface_init(struct usb_interface *interface, const struct usb_interface_descriptor *descriptor,
+    struct usb_endpoint *const *endpoints, uint endpoint_count, bool double_buffered)
+{
+    interface->descriptor = descriptor;
+    interface->endpoints = endpoints;
+    interface->endpoint_count = endpoint_count;
+    interface->alt = 0;
+    const uint8_t *ptr = (const uint8_t *) descriptor + descriptor->bLength;
+    for (uint i = 0; i < endpoint_count; ptr += ptr[0])
+    {
+        if (ptr[1] == USB_DT_ENDPOINT)
+            endpoints[i++]->descriptor = (const struct usb_endpoint_descriptor *) ptr;
+    }
+    return interface;
+}
+
+void usb_set_default_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer)
+{
+    ep->default_transfer = transfer;
+    ep->current_transfer = transfer;
+}
+
+struct usb_device *usb_device_init(const struct usb_device_descriptor *device_descriptor,
+    const struct usb_configuration_descriptor *config_descriptor, struct usb_interface *const *interfaces,
+    uint interface_count, const char *(*get_descriptor_string)(uint index))
+{
+    device.device_descriptor = device_descriptor;
+    device.config_descriptor = config_descriptor;
+    device.interfaces = interfaces;
+    device.interface_count = interface_count;
+    device.get_descriptor_string = get_descriptor_string;
+    return &device;
+}
+
+struct usb_endpoint *usb_get_control_in_endpoint(void)
+{
+    return &control_in;
+}
+
+struct usb_endpoint *usb_get_control_out_endpoint(void)
+{
+    return &control_out;
+}
+
+void usb_start_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer)
+{
+    ep->current_transfer = transfer;
+}
+
+void usb_start_empty_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer,
+    usb_transfer_completed_func on_complete)
+{
+}
+
+void usb_start_tiny_control_in_transfer(uint32_t data, uint len)
+{
+}
+
+void usb_start_control_out_transfer(const struct usb_transfer_type *type)
+{
+    control_out_type = type;
+}
+
+void usb_start_empty_control_in_transfer_null_completion(void)
+{
+}
+
+void usb_stream_setup_transfer(struct usb_stream_transfer *transfer, const struct usb_stream_transfer_funcs *funcs,
+    const uint8_t *chunk_buffer, uint32_t chunk_size, uint32_t transfer_length, usb_transfer_completed_func on_complete)
+{
+    transfer->funcs = funcs;
+    transfer->chunk = chunk_buffer;
+    transfer->transfer_length = transfer_length;
+    transfer->core.on_complete = on_complete;
+}
+
+void usb_stream_noop_on_chunk(uint32_t chunk_len, struct usb_stream_transfer *transfer)
+{
+}
+
+void usb_stream_noop_on_packet_complete(struct usb_stream_transfer *transfer)
+{
+}
+
+/*****************************************************************************
+ * The host. It starts a frame every millisecond and sends as many samples as
+ * the feedback endpoint last asked for, the way the Linux and Windows drivers
+ * do, or replays a capture. Everything it does to the device runs from the USB
+ * interrupt.
+ ****************************************************************************/
+
+static emulator_host_t host;
+static uint64_t next_frame_ns;
+static uint32_t frame_number;
+static bool frame_due;
+static bool enumerated;
+static bool input_done;
+static bool trace_requested;
+
+// The rate the device asked for in 10.14 samples per frame, and the fraction of
+// a sample the host is behind on.
+static uint32_t feedback = 48 << 14;
+static uint32_t feedback_remainder;
+
+static uint32_t packets;
+static uint64_t frames_sent;
+static uint32_t packet_frames[64];
+static uint32_t feedback_reads;
+static uint32_t feedback_values[64];
+static uint64_t feedback_total;
+static uint32_t commands;
+static uint32_t commands_failed;
+
+// The next packet of the capture being replayed, and the frame it is due in
+// counting from the first.
+static capture_record_t replay_record;
+static uint8_t replay_payload[1024];
+static uint64_t replay_start_ns;
+static uint32_t replay_frame;
+static uint32_t replay_idle_frames;
+static uint32_t replay_late;
+
+static struct usb_interface *find_interface(uint8_t number)
+{
+    for (uint i = 0; i < device.interface_count; i++)
+    {
+        if (device.interfaces[i]->descriptor->bInterfaceNumber == number)
+            return device.interfaces[i];
+    }
+    return NULL;
+}
+
+static struct usb_endpoint *find_endpoint(uint8_t address)
+{
+    for (uint i = 0; i < device.interface_count; i++)
+    {
+        const struct usb_interface *interface = device.interfaces[i];
+        for (uint j = 0; j < interface->endpoint_count; j++)
+        {
+            if (interface->endpoints[j]->descriptor->bEndpointAddress == address)
+                return interface->endpoints[j];
+        }
+    }
+    emulator_fail("The device has no endpoint 0x%02x", address);
+}
+
+/// @brief Hands the endpoint a packet, data_len is what the device sent back for an IN endpoint.
+static uint16_t transfer_packet(struct usb_endpoint *ep, uint8_t *data, uint16_t length)
+{
+    ep->buffer.data = data;
+    ep->buffer.data_len = length;
+    ep->buffer.data_max = ep->descriptor->wMaxPacketSize;
+    ep->buffer.valid = true;
+    ep->current_transfer->type->on_packet(ep);
+    ep->buffer.valid = false;
+    return ep->buffer.data_len;
+}
+
+/// @brief Sends a control request with its data stage, returns false if the device stalled it.
+static bool control_request(struct usb_setup_packet *setup, const void *data)
+{
+    control_out_type = NULL;
+    bool handled = false;
+    switch (setup->bmRequestType & USB_REQ_TYPE_RECIPIENT_MASK)
+    {
+        case USB_REQ_TYPE_RECIPIENT_DEVICE:
+            handled = device.setup_request_handler && device.setup_request_handler(&device, setup);
+            break;
+        case USB_REQ_TYPE_RECIPIENT_INTERFACE: {
+            struct usb_interface *interface = find_interface(setup->wIndex & 0xff);
+            handled = interface && interface->setup_request_handler &&
+                interface->setup_request_handler(interface, setup);
+            break;
+        }
+        case USB_REQ_TYPE_RECIPIENT_ENDPOINT: {
+            struct usb_endpoint *ep = find_endpoint(setup->wIndex & 0xff);
+            handled = ep->setup_request_handler && ep->setup_request_handler(ep, setup);
+            break;
+        }
+    }
+    if (handled && control_out_type)
+    {
+        static uint8_t buffer[64];
+        struct usb_transfer transfer = { .type = control_out_type };
+        memcpy(buffer, data, MIN(setup->wLength, sizeof(buffer)));
+        control_out.current_transfer = &transfer;
+        control_out.buffer.data = buffer;
+        control_out.buffer.data_len = setup->wLength;
+        control_out.buffer.data_max = sizeof(buffer);
+        control_out_type->on_packet(&control_out);
+        control_out.current_transfer = NULL;
+    }
+    return handled;
+}
+
+static void set_volume(int16_t volume)
+{
+    // SET_CUR of the volume control of the feature unit, on both channels
+    struct usb_setup_packet setup = {
+        .bmRequestType = USB_DIR_OUT | USB_REQ_TYPE_TYPE_CLASS | USB_REQ_TYPE_RECIPIENT_INTERFACE,
+        .bRequest = AUDIO_REQ_SetCurrent,
+        .wValue = 2 << 8,
+        .wIndex = 2 << 8,
+        .wLength = sizeof(volume),
+    };
+    if (!control_request(&setup, &volume))
+        emulator_fail("The device stalled the volume request");
+}
+
+/**
+ * Writes a request to the configuration interface and reads back the result,
+ * in 64 byte packets as tools/trace_dump.py does. Returns the length read.
+ */
+static size_t configuration_request(const uint8_t *request, uint16_t length, uint8_t *result, size_t max)
+{
+    struct usb_endpoint *out = find_endpoint(CONFIGURATION_OUT_ENDPOINT);
+    struct usb_endpoint *in = find_endpoint(CONFIGURATION_IN_ENDPOINT);
+    uint8_t packet[64];
+    for (uint16_t offset = 0; offset < length; offset += sizeof(packet))
+    {
+        const uint16_t size = MIN(sizeof(packet), length - offset);
+        memcpy(packet, &request[offset], size);
+        transfer_packet(out, packet, size);
+    }
+
+    size_t received = 0;
+    size_t expected = sizeof(tlv_header);
+    while (received < expected)
+    {
+        const uint16_t size = transfer_packet(in, packet, 0);
+        if (!size)
+            break;
+        memcpy(&result[received], packet, MIN(size, max - received));
+        received += MIN(size, max - received);
+        if (received >= sizeof(tlv_header))
+            expected = MIN(((const tlv_header *) result)->length, max);
+    }
+    return received;
+}
+
+static void send_commands(void)
+{
+    static uint8_t request[64 * 1024];
+    static uint8_t result[RESULT_BUFFER_SIZE];
+    size_t length = fread(request, 1, sizeof(request), host.commands);
+    for (size_t offset = 0; offset + sizeof(tlv_header) <= length; )
+    {
+        const tlv_header *header = (const tlv_header *) &request[offset];
+        if (header->length < sizeof(tlv_header) || offset + header->length > length)
+            emulator_fail("Bad request of %u bytes at offset %zu in the commands", header->length, offset);
+        const size_t received = configuration_request(&request[offset], header->length, result, sizeof(result));
+        commands++;
+        if (received < sizeof(tlv_header) || ((const tlv_header *) result)->type != OK)
+            commands_failed++;
+        if (host.responses)
+            fwrite(result, 1, received, host.responses);
+        offset += header->length;
+    }
+}
+
+/// @brief Reads both cores' trace, written in the same format as trace_dump.py.
+static void read_trace(void)
+{
+    FILE *output = fopen(host.trace_path, "wb");
+    if (!output)
+        emulator_fail("Cannot open trace file '%s'", host.trace_path);
+    static uint8_t result[RESULT_BUFFER_SIZE];
+    for (uint8_t core = 0; core < 2; core++)
+    {
+        uint32_t first = 0;
+        for (;;)
+        {
+            const trace_cmd request = { { GET_TRACE, sizeof(trace_cmd) }, core, { 0 }, first };
+            const size_t received = configuration_request((const uint8_t *) &request, sizeof(request), result,
+                sizeof(result));
+            const tlv_header *header = (const tlv_header *) result;
+            if (received < sizeof(tlv_header) + sizeof(trace_tlv) || header->type != OK)
+                emulator_fail("GET_TRACE failed");
+            const trace_tlv *trace = (const trace_tlv *) (result + sizeof(tlv_header));
+            const uint32_t count = (received - sizeof(tlv_header) - sizeof(trace_tlv)) / sizeof(trace_event_t);
+            fwrite(result, 1, received, output);
+            first = trace->first + count;
+            if (!count || first >= trace->head)
+                break;
+        }
+    }
+    fclose(output);
+}
+
+/// @brief SET_INTERFACE to the streaming alternate, then anything asked for on the command line.
+static void enumerate(void)
+{
+    struct usb_interface *streaming = find_interface(AUDIO_STREAMING_INTERFACE);
+    streaming->alt = 1;
+    if (streaming->set_alternate_handler && !streaming->set_alternate_handler(streaming, 1))
+        emulator_fail("The device refused the streaming interface");
+    if (host.set_volume)
+        set_volume(host.volume);
+    if (host.commands)
+        send_commands();
+    enumerated = true;
+}
+
+static void next_replay_record(void)
+{
+    if (fread(&replay_record, sizeof(replay_record), 1, host.replay) != 1)
+    {
+        input_done = true;
+        return;
+    }
+    if (replay_record.length > sizeof(replay_payload) ||
+        fread(replay_payload, 1, replay_record.length, host.replay) != replay_record.length)
+    {
+        emulator_fail("Bad packet of %u bytes in the capture", replay_record.length);
+    }
+}
+
+/**
+ * Takes the next packet from the capture if it is due in this frame, or
+ * overdue, since there is only room for one packet per frame. Returns its
+ * length, or -1 if nothing is due.
+ */
+static int replay_packet(uint8_t *packet)
+{
+    if (!replay_frame)
+        replay_start_ns = replay_record.time_ns;
+    const int64_t due = ((int64_t) (replay_record.time_ns - replay_start_ns) + (int64_t) USB_FRAME_NS / 2) /
+        (int64_t) USB_FRAME_NS;
+    if (due > replay_frame++)
+    {
+        replay_idle_frames++;
+        return -1;
+    }
+    if (due < replay_frame - 1)
+        replay_late++;
+    const uint16_t length = replay_record.length;
+    memcpy(packet, replay_payload, length);
+    next_replay_record();
+    return length;
+}
+
+static void record_packet(const uint8_t *packet, uint16_t length)
+{
+    const capture_record_t record = { emulator_time_ns(), length };
+    fwrite(&record, sizeof(record), 1, host.record);
+    fwrite(packet, 1, length, host.record);
+}
+
+/// @brief Sends this frame's packet, returns the number of samples in it.
+static uint32_t send_audio_packet(void)
+{
+    struct usb_endpoint *ep = find_endpoint(AUDIO_OUT_ENDPOINT);
+    static uint8_t packet[1024];
+    uint16_t length;
+    if (host.replay)
+    {
+        const int replayed = replay_packet(packet);
+        if (replayed < 0)
+            return 0;
+        if (replayed > ep->descriptor->wMaxPacketSize)
+            emulator_fail("Packet of %d bytes in the capture, the endpoint takes %u", replayed,
+                ep->descriptor->wMaxPacketSize);
+        length = replayed;
+    }
+    else
+    {
+        feedback_remainder += feedback;
+        uint32_t frames = feedback_remainder >> 14;
+        feedback_remainder &= (1 << 14) - 1;
+        frames = MIN(frames, ep->descriptor->wMaxPacketSize / 4u);
+
+        frames = fread(packet, 4, frames, host.input);
+        if (feof(host.input) || ferror(host.input))
+            input_done = true;
+        if (!frames)
+            return 0;
+        length = frames * 4;
+    }
+    transfer_packet(ep, packet, length);
+    if (host.record)
+        record_packet(packet, length);
+    const uint32_t frames = length / 4;
+    packets++;
+    frames_sent += frames;
+    packet_frames[MIN(frames, count_of(packet_frames) - 1)]++;
+    return frames;
+}
+
+static void read_feedback(void)
+{
+    struct usb_endpoint *ep = find_endpoint(AUDIO_SYNC_ENDPOINT);
+    uint8_t data[3] = { 0 };
+    if (transfer_packet(ep, data, 0) == 3)
+    {
+        feedback = data[0] | (data[1] << 8) | (data[2] << 16);
+        feedback_reads++;
+        feedback_total += feedback;
+        feedback_values[MIN(feedback >> 14, count_of(feedback_values) - 1)]++;
+    }
+}
+
+void usb_irq(void)
+{
+    if (trace_requested)
+    {
+        trace_requested = false;
+        read_trace();
+    }
+    if (!frame_due)
+        return;
+    frame_due = false;
+    if (!enumerated)
+        enumerate();
+    // Both cores are idle at the start of the frame, so the feedback and the
+    // ring are read before the packet goes to core 1 and are the same every run.
+    const uint32_t ring = ringbuf_available_data(&i2s_write_obj.ring_buffer);
+    // The sync endpoint is polled every 2^bRefresh frames.
+    const struct usb_endpoint_descriptor_long *sync =
+        (const struct usb_endpoint_descriptor_long *) find_endpoint(AUDIO_SYNC_ENDPOINT)->descriptor;
+    if (!input_done && !(frame_number & ((1u << sync->bRefresh) - 1)))
+        read_feedback();
+    const uint32_t frames = input_done ? 0 : send_audio_packet();
+    frame_number++;
+    if (host.log && packets)
+    {
+        fprintf(host.log, "%.3f %u %u %.4f %u\n", emulator_time_ns() / 1e6, ring, frames, feedback / 16384.0,
+            emulator_ring.underruns);
+    }
+}
+
+void usb_device_start(void)
+{
+    device_started = true;
+    // The first frame starts on the next millisecond.
+    next_frame_ns = (emulator_time_ns() / USB_FRAME_NS + 1) * USB_FRAME_NS;
+    irq_set_exclusive_handler(USBCTRL_IRQ, usb_irq);
+    irq_set_enabled(USBCTRL_IRQ, true);
+}
+
+void host_init(const emulator_host_t *config)
+{
+    host = *config;
+    if (host.replay)
+    {
+        uint32_t magic;
+        if (fread(&magic, sizeof(magic), 1, host.replay) != 1 || magic != CAPTURE_MAGIC)
+        {
+            fprintf(stderr, "Not a USB capture\n");
+            exit(1);
+        }
+        next_replay_record();
+    }
+    if (host.record)
+    {
+        const uint32_t magic = CAPTURE_MAGIC;
+        fwrite(&magic, sizeof(magic), 1, host.record);
+    }
+    if (host.log)
+        fprintf(host.log, "# ms ring_bytes packet_samples feedback underruns\n");
+}
+
+uint64_t host_next_frame_ns(void)
+{
+    return device_started && !input_done ? next_frame_ns : UINT64_MAX;
+}
+
+void host_frame(void)
+{
+    next_frame_ns += USB_FRAME_NS;
+    frame_due = true;
+    emulator_raise_irq(USBCTRL_IRQ);
+}
+
+bool host_streaming(void)
+{
+    return packets && !input_done;
+}
+
+bool host_finished(void)
+{
+    return input_done && ringbuf_available_data(&i2s_write_obj.ring_buffer) < SIZEOF_HALF_DMA_BUFFER_IN_BYTES;
+}
+
+void host_request_trace(void)
+{
+    trace_requested = true;
+    emulator_raise_irq(USBCTRL_IRQ);
+}
+
+void host_report(FILE *output)
+{
+    fprintf(output, "USB: %u packets, %" PRIu64 " frames,", packets, frames_sent);
+    for (uint i = 0; i < count_of(packet_frames); i++)
+    {
+        if (packet_frames[i])
+            fprintf(output, " %u of %u", packet_frames[i], i);
+    }
+    fprintf(output, "\nFeedback: read %u times, asking for", feedback_reads);
+    for (uint i = 0; i < count_of(feedback_values); i++)
+    {
+        if (feedback_values[i])
+            fprintf(output, " %u x %u", feedback_values[i], i);
+    }
+    fprintf(output, " samples per frame\n");
+    if (host.replay && feedback_reads)
+    {
+        fprintf(output, "Replay: %u frames without a packet, %u packets sent late, %.3f samples per frame sent "
+            "against %.3f asked for\n", replay_idle_frames, replay_late, (double) frames_sent / replay_frame,
+            feedback_total / 16384.0 / feedback_reads);
+    }
+    if (commands)
+        fprintf(output, "Configuration: %u requests, %u failed\n", commands, commands_failed);
+}
@@ -1,94 +1,1100 @@
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <glob.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "bqf.h"
 #include "fix16.h"
+#include "crossfeed.h"
+#include "limiter.h"
+#include "fir.h"
+#include "quantizer.h"
 #include "configuration_manager.h"
 
-const char* usage = "Usage: %s INFILE OUTFILE\n\n"
-    "Reads 16bit stereo PCM data from INFILE, runs it through the Ploopy headphones\n"
-    "filters then writes it out to OUTFILE.\n";
+const char* usage = "Usage: %s [-w] [-j THREADS] INFILE OUTFILE\n"
+    "       %s [-w] [-j THREADS] -o OUTDIR [-l LISTFILE] [INFILE...]\n\n"
+    "Reads stereo PCM data from INFILE, runs it through the Ploopy headphones\n"
+    "filters then writes it out to OUTFILE as 24bit stereo PCM. Either can be - for\n"
+    "stdin or stdout, so it can sit in a pipeline between two ffmpegs.\n\n"
+    "INFILE is a WAV or RF64 file of 16, 24 or 32bit samples, or 32bit floats, or\n"
+    "raw 16bit samples. OUTFILE is a WAV file, or an RF64 file past 4GB, if its\n"
+    "name ends in .wav or -w is given, and raw 24bit samples otherwise.\n\n"
+    "With -o, filters every INFILE, and every file named in LISTFILE one per line,\n"
+    "into OUTDIR under the same name ending in .pcm, or .wav with -w. Patterns such\n"
+    "as 'music/*.wav' are expanded. The files, and the two channels of each, are\n"
+    "filtered in parallel on THREADS threads, by default one per CPU.\n";
 
-int main(int argc, char* argv[])
+// The firmware filters each USB packet as a block, 1ms of audio at 48kHz.
+#define PACKET_FRAMES 48
+// The files are read and written a second of audio at a time.
+#define CHUNK_FRAMES (1000 * PACKET_FRAMES)
+#define OUTPUT_FRAME_BYTES 6
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+// Sizes that do not fit, RF64 has them in its ds64 chunk.
+#define WAVE_SIZE_UNKNOWN 0xffffffffu
+
+/**
+ * A file read or written on a thread of its own, a chunk at a time, through two
+ * buffers: while one is being filtered, the thread reads the next chunk into
+ * the other or writes the last one out of it. Nothing else is kept, so memory
+ * use does not grow with the length of the audio.
+ */
+typedef struct _stream_t {
+    FILE *file;
+    const char *name;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t size;
+    uint8_t *buffers[2];
+    size_t lengths[2];
+    /// @brief Read and not filtered yet, or filtered and not written yet.
+    bool full[2];
+    /// @brief The buffer the filtering has or gets next.
+    int current;
+    /// @brief Bytes already taken off the file that go at the start of the first chunk.
+    uint8_t prefix[12];
+    size_t prefix_length;
+    /// @brief Nothing more will be written, or read.
+    bool done;
+    bool failed;
+} stream_t;
+
+static void *reader_main(void *arg)
+{
+    stream_t *s = (stream_t *) arg;
+    for (int b = 0; ; b ^= 1)
+    {
+        pthread_mutex_lock(&s->lock);
+        while (s->full[b] && !s->done)
+            pthread_cond_wait(&s->changed, &s->lock);
+        const bool done = s->done;
+        pthread_mutex_unlock(&s->lock);
+        if (done)
+            return NULL;
+
+        memcpy(s->buffers[b], s->prefix, s->prefix_length);
+        const size_t length = s->prefix_length +
+            fread(s->buffers[b] + s->prefix_length, 1, s->size - s->prefix_length, s->file);
+        s->prefix_length = 0;
+
+        pthread_mutex_lock(&s->lock);
+        s->lengths[b] = length;
+        s->full[b] = true;
+        s->failed = ferror(s->file);
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+        // A short chunk is the last one.
+        if (length < s->size)
+            return NULL;
+    }
+}
+
+static void *writer_main(void *arg)
 {
-    if (argc != 3)
+    stream_t *s = (stream_t *) arg;
+    for (int b = 0; ; b ^= 1)
     {
-        fprintf(stdout, usage, argv[0]);
+        pthread_mutex_lock(&s->lock);
+        while (!s->full[b] && !s->done)
+            pthread_cond_wait(&s->changed, &s->lock);
+        if (!s->full[b])
+        {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        const bool failed = fwrite(s->buffers[b], 1, s->lengths[b], s->file) != s->lengths[b];
+
+        pthread_mutex_lock(&s->lock);
+        s->full[b] = false;
+        s->failed |= failed;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static FILE *open_file(const char *name, bool writing)
+{
+    FILE *file;
+    if (!strcmp(name, "-"))
+        file = writing ? stdout : stdin;
+    else
+        file = fopen(name, writing ? "wb" : "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open %s file '%s'\n", writing ? "output" : "input", name);
         exit(1);
     }
+    return file;
+}
+
+/// @brief The file a name stands for, - being stdin or stdout. False if it does not exist.
+static bool identify_file(const char *name, bool writing, struct stat *status)
+{
+    if (!strcmp(name, "-"))
+        return !fstat(writing ? STDOUT_FILENO : STDIN_FILENO, status);
+    return !stat(name, status);
+}
+
+/**
+ * The output is written while the input is still being read, so writing over
+ * the input would truncate it before it had been filtered.
+ */
+static bool same_file(const char *input, const char *output)
+{
+    struct stat in, out;
+    return identify_file(input, false, &in) && identify_file(output, true, &out) && S_ISREG(in.st_mode) &&
+        in.st_dev == out.st_dev && in.st_ino == out.st_ino;
+}
 
-    // Load the input data into a buffer
-    FILE* input = fopen(argv[1], "rb");
-    if (!input) {
-        fprintf(stderr, "Cannot open input file '%s'\n", argv[1]);
+static void stream_start(stream_t *s, FILE *file, const char *name, bool writing, size_t size)
+{
+    s->file = file;
+    s->name = name;
+    s->size = size;
+    s->buffers[0] = malloc(size);
+    s->buffers[1] = malloc(size);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    pthread_create(&s->thread, NULL, writing ? writer_main : reader_main, s);
+}
+
+/// @brief Waits for the next chunk to be read, a short one is the last.
+static size_t stream_read(stream_t *s, const uint8_t **data)
+{
+    pthread_mutex_lock(&s->lock);
+    while (!s->full[s->current])
+        pthread_cond_wait(&s->changed, &s->lock);
+    if (s->failed)
+    {
+        fprintf(stderr, "Cannot read input file '%s'\n", s->name);
         exit(1);
     }
+    *data = s->buffers[s->current];
+    const size_t length = s->lengths[s->current];
+    pthread_mutex_unlock(&s->lock);
+    return length;
+}
 
-    // Get the file size
-    fseek(input , 0L , SEEK_END);
-    size_t input_size = ftell(input);
-    rewind(input);
+/// @brief Hands the chunk from stream_read() back to be read into again.
+static void stream_release(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->full[s->current] = false;
+    s->current ^= 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
 
-    // Allocate our input and output buffers. This could be optimized
-    // we dont need to store the whole input and output files in memory.
-    int samples = input_size / 2;
-    int16_t *in = (int16_t *) calloc(samples, sizeof(int16_t));
-    int32_t *out = (int32_t *) calloc(samples, sizeof(int32_t));
+/// @brief Waits for a buffer to filter the next chunk into.
+static uint8_t *stream_buffer(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->full[s->current])
+        pthread_cond_wait(&s->changed, &s->lock);
+    uint8_t *buffer = s->buffers[s->current];
+    pthread_mutex_unlock(&s->lock);
+    return buffer;
+}
+
+/// @brief Queues the buffer from stream_buffer() to be written.
+static void stream_write(stream_t *s, size_t length)
+{
+    pthread_mutex_lock(&s->lock);
+    s->lengths[s->current] = length;
+    s->full[s->current] = true;
+    s->current ^= 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Waits for a writer to write everything out, and stops a reader that the
+ * audio ended before, when the file has more chunks after its data.
+ */
+static void stream_stop(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->done = true;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    free(s->buffers[0]);
+    free(s->buffers[1]);
+}
+
+typedef enum _sample_format {
+    FORMAT_S16,
+    FORMAT_S24,
+    FORMAT_S32,
+    FORMAT_F32,
+} sample_format;
 
-    fread(in, samples, sizeof(int16_t), input);
-    fclose(input);
+/**
+ * The input. A regular file is mapped and filtered straight out of the page
+ * cache, anything else, such as a pipe, is read through a stream_t.
+ */
+typedef struct _input_t {
+    FILE *file;
+    const char *name;
+    sample_format format;
+    int frame_bytes;
+    /// @brief Bytes of audio left, or UINT64_MAX to read to the end of the file.
+    uint64_t remaining;
+    const uint8_t *map;
+    size_t map_size;
+    /// @brief Where the audio is up to in the mapping.
+    size_t position;
+    /// @brief Pages behind this have been filtered, and can be dropped.
+    size_t released;
+    stream_t stream;
+} input_t;
 
-    // Open the output file.
-    FILE* output = fopen(argv[2], "wb");
-    if (!output)
+static uint32_t read_le(const uint8_t *bytes, int count)
+{
+    uint32_t value = 0;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+static void read_header(input_t *input, void *data, size_t size)
+{
+    if (fread(data, 1, size, input->file) != size)
     {
-        fprintf(stderr, "Cannot open output file '%s'\n", argv[2]);
+        fprintf(stderr, "Input file '%s' ends in its header\n", input->name);
         exit(1);
     }
+}
 
-    // The smaple proccesing code, essentially the same as the
-    // code in the firmware's run.c file.
-    load_config();
+/// @brief Skips over a chunk, with a read rather than a seek so pipes work too.
+static void skip_header(input_t *input, uint64_t size)
+{
+    uint8_t scratch[256];
+    while (size)
+    {
+        const size_t count = size < sizeof(scratch) ? size : sizeof(scratch);
+        read_header(input, scratch, count);
+        size -= count;
+    }
+}
+
+/**
+ * Reads the WAV or RF64 header up to the start of the audio. Anything else is
+ * taken as raw 16bit samples, which the bytes read to tell start with.
+ */
+static void parse_header(input_t *input, uint8_t prefix[12], size_t *prefix_length)
+{
+    input->format = FORMAT_S16;
+    input->frame_bytes = 4;
+    input->remaining = UINT64_MAX;
+    *prefix_length = fread(prefix, 1, 12, input->file);
+    if (*prefix_length < 12 || memcmp(&prefix[8], "WAVE", 4) ||
+        (memcmp(prefix, "RIFF", 4) && memcmp(prefix, "RF64", 4)))
+    {
+        return;
+    }
+    *prefix_length = 0;
+
+    uint64_t ds64_data_size = UINT64_MAX;
+    bool have_format = false;
+    for (;;)
+    {
+        uint8_t chunk[8];
+        read_header(input, chunk, sizeof(chunk));
+        const uint32_t size = read_le(&chunk[4], 4);
+        if (!memcmp(chunk, "ds64", 4) && size >= 16)
+        {
+            uint8_t ds64[16];
+            read_header(input, ds64, sizeof(ds64));
+            ds64_data_size = read_le(&ds64[8], 4) | (uint64_t) read_le(&ds64[12], 4) << 32;
+            skip_header(input, size - sizeof(ds64) + (size & 1));
+        }
+        else if (!memcmp(chunk, "fmt ", 4) && size >= 16)
+        {
+            uint8_t fmt[40] = { 0 };
+            const uint32_t count = size < sizeof(fmt) ? size : sizeof(fmt);
+            read_header(input, fmt, count);
+            skip_header(input, size - count + (size & 1));
+            uint16_t tag = read_le(&fmt[0], 2);
+            const uint16_t channels = read_le(&fmt[2], 2);
+            const uint32_t rate = read_le(&fmt[4], 4);
+            const uint16_t bits = read_le(&fmt[14], 2);
+            // The real format is the first two bytes of the sub format GUID.
+            if (tag == WAVE_FORMAT_EXTENSIBLE && count >= 26)
+                tag = read_le(&fmt[24], 2);
+
+            if (channels == 2 && tag == WAVE_FORMAT_PCM && bits == 16)
+                input->format = FORMAT_S16;
+            else if (channels == 2 && tag == WAVE_FORMAT_PCM && bits == 24)
+                input->format = FORMAT_S24;
+            else if (channels == 2 && tag == WAVE_FORMAT_PCM && bits == 32)
+                input->format = FORMAT_S32;
+            else if (channels == 2 && tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+                input->format = FORMAT_F32;
+            else
+            {
+                fprintf(stderr, "Input file '%s' is %u channels of %u bit samples in format %u, only stereo 16, "
+                    "24 or 32 bit PCM or 32 bit float is supported\n", input->name, channels, bits, tag);
+                exit(1);
+            }
+            input->frame_bytes = 2 * bits / 8;
+            if (rate != SAMPLING_FREQ)
+            {
+                fprintf(stderr, "Input file '%s' is %u Hz, the filters are designed for %u Hz\n", input->name,
+                    rate, SAMPLING_FREQ);
+            }
+            have_format = true;
+        }
+        else if (!memcmp(chunk, "data", 4))
+        {
+            if (!have_format)
+            {
+                fprintf(stderr, "Input file '%s' has no format before its data\n", input->name);
+                exit(1);
+            }
+            input->remaining = size == WAVE_SIZE_UNKNOWN ? ds64_data_size : size;
+            return;
+        }
+        else
+        {
+            skip_header(input, size + (size & 1));
+        }
+    }
+}
+
+static void input_open(input_t *input, const char *name)
+{
+    memset(input, 0, sizeof(*input));
+    input->name = name;
+    input->file = open_file(name, false);
+    uint8_t prefix[12];
+    size_t prefix_length;
+    parse_header(input, prefix, &prefix_length);
+
+    struct stat st;
+    const off_t offset = ftello(input->file) - prefix_length;
+    if (input->file != stdin && !fstat(fileno(input->file), &st) && S_ISREG(st.st_mode) && st.st_size > offset)
+    {
+        input->map_size = st.st_size;
+        input->map = mmap(NULL, input->map_size, PROT_READ, MAP_PRIVATE, fileno(input->file), 0);
+        if (input->map != MAP_FAILED)
+        {
+            madvise((void *) input->map, input->map_size, MADV_SEQUENTIAL);
+            input->position = offset;
+            return;
+        }
+        input->map = NULL;
+    }
+    memcpy(input->stream.prefix, prefix, prefix_length);
+    input->stream.prefix_length = prefix_length;
+    stream_start(&input->stream, input->file, name, false, CHUNK_FRAMES * input->frame_bytes);
+}
+
+static fix3_28_t decode_sample(const uint8_t *bytes, sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_S16:
+            return norm_fix3_28_from_s16sample((int16_t) read_le(bytes, 2));
+        case FORMAT_S24:
+            // The sign goes in the top bit, then comes back down.
+            return (int32_t) (read_le(bytes, 3) << 8) >> 3;
+        case FORMAT_S32:
+            return (int32_t) read_le(bytes, 4) >> 3;
+        case FORMAT_F32:
+        default: {
+            const uint32_t bits = read_le(bytes, 4);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            // Q3.28 holds up to 8, a float may hold anything.
+            return fix3_28_from_dbl(fmax(-7.99, fmin(value, 7.99)));
+        }
+    }
+}
+
+/// @brief Reads the next chunk as Q3.28 samples, returns the frames read, fewer than a chunk at the end.
+static int input_read(input_t *input, fix3_28_t *samples)
+{
+    const uint8_t *data;
+    size_t length;
+    if (input->map)
+    {
+        data = input->map + input->position;
+        length = input->map_size - input->position;
+        if (length > (size_t) CHUNK_FRAMES * input->frame_bytes)
+            length = (size_t) CHUNK_FRAMES * input->frame_bytes;
+    }
+    else
+    {
+        length = stream_read(&input->stream, &data);
+    }
+    if (length > input->remaining)
+        length = input->remaining;
+    const int frames = length / input->frame_bytes;
+
+    const int sample_bytes = input->frame_bytes / 2;
+    for (int i = 0; i < 2 * frames; i++)
+    {
+        samples[i] = decode_sample(&data[i * sample_bytes], input->format);
+    }
+    input->remaining -= (uint64_t) frames * input->frame_bytes;
+
+    if (input->map)
+    {
+        // Drop the pages filtered, they will not be needed again.
+        input->position += (size_t) frames * input->frame_bytes;
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t release = input->position / page * page;
+        if (release > input->released)
+        {
+            madvise((void *) (input->map + input->released), release - input->released, MADV_DONTNEED);
+            input->released = release;
+        }
+    }
+    else
+    {
+        stream_release(&input->stream);
+    }
+    return frames;
+}
+
+static void input_close(input_t *input)
+{
+    if (input->map)
+        munmap((void *) input->map, input->map_size);
+    else
+        stream_stop(&input->stream);
+    if (input->file != stdin)
+        fclose(input->file);
+}
+
+/**
+ * The output. A WAV header goes in front of the audio, with a JUNK chunk the
+ * size of a ds64 chunk, so that once the length is known the header can be
+ * rewritten as RF64 in place if the audio is past 4GB. If the output cannot be
+ * seeked back to, it keeps the sizes marked unknown.
+ */
+typedef struct _output_t {
+    FILE *file;
+    const char *name;
+    bool wav;
+    uint64_t data_size;
+    stream_t stream;
+} output_t;
+
+#define WAV_HEADER_SIZE 80
+
+static void write_le(uint8_t *bytes, uint64_t value, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        bytes[i] = value >> (8 * i);
+    }
+}
+
+/// @brief The header for data_size bytes of audio, or for an unknown amount if it is UINT64_MAX.
+static void wav_header(uint8_t header[WAV_HEADER_SIZE], uint64_t data_size)
+{
+    const bool unknown = data_size == UINT64_MAX;
+    const uint64_t riff_size = unknown ? WAVE_SIZE_UNKNOWN : WAV_HEADER_SIZE - 8 + data_size;
+    const bool rf64 = !unknown && riff_size >= WAVE_SIZE_UNKNOWN;
+    memset(header, 0, WAV_HEADER_SIZE);
+    memcpy(&header[0], rf64 ? "RF64" : "RIFF", 4);
+    write_le(&header[4], rf64 ? WAVE_SIZE_UNKNOWN : riff_size, 4);
+    memcpy(&header[8], "WAVE", 4);
+    memcpy(&header[12], rf64 ? "ds64" : "JUNK", 4);
+    write_le(&header[16], 28, 4);
+    if (rf64)
+    {
+        write_le(&header[20], riff_size, 8);
+        write_le(&header[28], data_size, 8);
+        write_le(&header[36], data_size / OUTPUT_FRAME_BYTES, 8);
+    }
+    memcpy(&header[48], "fmt ", 4);
+    write_le(&header[52], 16, 4);
+    write_le(&header[56], WAVE_FORMAT_PCM, 2);
+    write_le(&header[58], 2, 2);
+    write_le(&header[60], SAMPLING_FREQ, 4);
+    write_le(&header[64], SAMPLING_FREQ * OUTPUT_FRAME_BYTES, 4);
+    write_le(&header[68], OUTPUT_FRAME_BYTES, 2);
+    write_le(&header[70], 24, 2);
+    memcpy(&header[72], "data", 4);
+    write_le(&header[76], rf64 || unknown ? WAVE_SIZE_UNKNOWN : data_size, 4);
+}
+
+static bool has_wav_extension(const char *name)
+{
+    const size_t length = strlen(name);
+    if (length < 4)
+        return false;
+    char extension[5];
+    for (int i = 0; i < 5; i++)
+    {
+        extension[i] = tolower((unsigned char) name[length - 4 + i]);
+    }
+    return !strcmp(extension, ".wav");
+}
+
+static void output_open(output_t *output, const char *name, bool wav)
+{
+    memset(output, 0, sizeof(*output));
+    output->name = name;
+    output->file = open_file(name, true);
+    output->wav = wav || has_wav_extension(name);
+    if (output->wav)
+    {
+        uint8_t header[WAV_HEADER_SIZE];
+        // Unknown until the end, and left that way on a pipe.
+        wav_header(header, UINT64_MAX);
+        fwrite(header, 1, sizeof(header), output->file);
+    }
+    stream_start(&output->stream, output->file, name, true, CHUNK_FRAMES * OUTPUT_FRAME_BYTES);
+}
+
+static uint8_t *output_buffer(output_t *output)
+{
+    return stream_buffer(&output->stream);
+}
+
+static void output_write(output_t *output, int frames)
+{
+    output->data_size += (uint64_t) frames * OUTPUT_FRAME_BYTES;
+    stream_write(&output->stream, (size_t) frames * OUTPUT_FRAME_BYTES);
+}
+
+static void output_close(output_t *output)
+{
+    stream_stop(&output->stream);
+    bool failed = output->stream.failed;
+    if (output->wav && !fseeko(output->file, 0, SEEK_SET))
+    {
+        uint8_t header[WAV_HEADER_SIZE];
+        wav_header(header, output->data_size);
+        failed |= fwrite(header, 1, sizeof(header), output->file) != sizeof(header);
+    }
+    failed |= fflush(output->file) != 0;
+    if (output->file != stdout)
+        failed |= fclose(output->file) != 0;
+    if (failed)
+    {
+        fprintf(stderr, "Cannot write output file '%s'\n", output->name);
+        exit(1);
+    }
+}
+
+static fix3_28_t preamp;
+
+/**
+ * Everything the filtering of one channel changes as it goes. Each file gets a
+ * copy of the firmware's globals once the configuration is loaded, so files
+ * can be filtered side by side, and the channels of one file independently of
+ * each other, as the two cores of the headphones do.
+ */
+typedef struct _channel_t {
+    int stages;
+    bqf_coeff_t filters[MAX_FILTER_STAGES];
+    bqf_mem_t mem[MAX_FILTER_STAGES];
+    bqf_ramp_t ramp;
+    fir_filter_t fir;
+    crossfeed_t crossfeed;
+    limiter_t limiter;
+    quantizer_t quantizer;
+} channel_t;
+
+static void channel_init(channel_t *c, int channel)
+{
+    c->stages = channel ? filter_stages_right : filter_stages_left;
+    memcpy(c->filters, channel ? bqf_filters_right : bqf_filters_left, sizeof(c->filters));
+    memcpy(c->mem, channel ? bqf_filters_mem_right : bqf_filters_mem_left, sizeof(c->mem));
+    c->ramp = channel ? bqf_ramp_right : bqf_ramp_left;
+    c->fir = channel ? fir_right : fir_left;
+    c->crossfeed = channel ? crossfeed_right : crossfeed_left;
+    c->limiter = channel ? limiter_right : limiter_left;
+    c->quantizer = channel ? quantizer_right : quantizer_left;
+}
+
+/**
+ * The sample processing, essentially the same as the code in the firmware's
+ * run.c file. Filters one channel of a chunk of interleaved samples a packet at
+ * a time, and packs it into its place in the 24bit output.
+ */
+static void filter_channel(channel_t *c, int channel, const fix3_28_t *in, int frames, uint8_t *out)
+{
+    fix3_28_t block[MAX_BLOCK_SAMPLES];
+    int32_t quantized[PACKET_FRAMES];
 
-    for (int i = 0; i < samples; i++)
+    for (int frame = 0; frame < frames; frame += PACKET_FRAMES)
     {
-        out[i] = in[i];
+        const int packet_frames = frames - frame < PACKET_FRAMES ? frames - frame : PACKET_FRAMES;
+        const fix3_28_t *packet = &in[2 * frame];
+
+        for (int n = 0; n < packet_frames; n++)
+        {
+            fix3_28_t x_f16 = packet[2 * n + channel];
+            if (c->crossfeed.enabled)
+            {
+                x_f16 = crossfeed_transform(x_f16, packet[2 * n + !channel], &c->crossfeed);
+            }
+            block[n] = fix16_mul(x_f16, preamp);
+        }
+
+        filter_chain_transform(block, packet_frames, c->filters, c->mem, c->stages, &c->fir, &c->ramp);
+
+        if (c->limiter.enabled)
+        {
+            for (int n = 0; n < packet_frames; n++)
+            {
+                block[n] = limiter_transform(block[n], &c->limiter);
+            }
+        }
+
+        quantize_block(block, packet_frames, quantized, 1, &c->quantizer);
+
+        for (int n = 0; n < packet_frames; n++)
+        {
+            write_le(&out[(frame + n) * OUTPUT_FRAME_BYTES + 3 * channel], quantized[n], 3);
+        }
     }
+}
+
+/*****************************************************************************
+ * A work stealing thread pool. Each worker has a deque of tasks: it pushes and
+ * pops its own at the tail, newest first, and when it runs out it steals the
+ * oldest from the head of another's. A worker waiting for a task it pushed
+ * works on whatever else there is meanwhile.
+ ****************************************************************************/
+
+typedef struct _task_t {
+    void (*run)(void *arg);
+    void *arg;
+    bool done;
+} task_t;
+
+typedef struct _deque_t {
+    task_t **tasks;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int tail;
+} deque_t;
 
-    const fix3_28_t preamp = fix3_28_from_flt(0.92f);
+typedef struct _pool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int threads;
+    pthread_t *ids;
+    deque_t *deques;
+    bool stop;
+} pool_t;
 
-    for (int i = 0; i < samples; i ++)
+static pool_t pool;
+static _Thread_local int worker_id;
+
+/// @brief Queues a task on a worker's deque, with the pool locked.
+static void pool_push_to(int worker, task_t *task)
+{
+    deque_t *d = &pool.deques[worker];
+    task->done = false;
+    d->tasks[d->tail++ % d->capacity] = task;
+    pthread_cond_broadcast(&pool.changed);
+}
+
+/// @brief Queues a task on the calling worker's own deque.
+static void pool_push(task_t *task)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool_push_to(worker_id, task);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief The newest task on the caller's deque, or else the oldest on another's, with the pool locked.
+static task_t *pool_take(void)
+{
+    deque_t *own = &pool.deques[worker_id];
+    if (own->tail != own->head)
+        return own->tasks[--own->tail % own->capacity];
+    for (int i = 1; i < pool.threads; i++)
     {
-        // Left channel filter
-        fix3_28_t x_f16 = fix16_mul(norm_fix3_28_from_s16sample((int16_t) out[i]), preamp);
+        deque_t *victim = &pool.deques[(worker_id + i) % pool.threads];
+        if (victim->tail != victim->head)
+            return victim->tasks[victim->head++ % victim->capacity];
+    }
+    return NULL;
+}
 
-        for (int j = 0; j < filter_stages; j++)
+/// @brief Runs tasks until the one given is done, or until the pool stops if it is NULL.
+static void pool_wait(task_t *until)
+{
+    pthread_mutex_lock(&pool.lock);
+    while (until ? !until->done : !pool.stop)
+    {
+        task_t *task = pool_take();
+        if (!task)
         {
-            x_f16 = bqf_transform(x_f16, &bqf_filters_left[j],
-                &bqf_filters_mem_left[j]);
+            pthread_cond_wait(&pool.changed, &pool.lock);
+            continue;
         }
+        pthread_mutex_unlock(&pool.lock);
+        task->run(task->arg);
+        pthread_mutex_lock(&pool.lock);
+        task->done = true;
+        pthread_cond_broadcast(&pool.changed);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void *pool_worker_main(void *arg)
+{
+    worker_id = (int) (intptr_t) arg;
+    pool_wait(NULL);
+    return NULL;
+}
+
+/// @brief Starts the workers, the calling thread is worker 0. Each deque has room for capacity tasks.
+static void pool_start(int threads, unsigned int capacity)
+{
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+    pool.threads = threads;
+    pool.ids = calloc(threads, sizeof(pthread_t));
+    pool.deques = calloc(threads, sizeof(deque_t));
+    for (int t = 0; t < threads; t++)
+    {
+        pool.deques[t].tasks = calloc(capacity, sizeof(task_t *));
+        pool.deques[t].capacity = capacity;
+    }
+    worker_id = 0;
+    for (int t = 1; t < threads; t++)
+    {
+        pthread_create(&pool.ids[t], NULL, pool_worker_main, (void *) (intptr_t) t);
+    }
+}
+
+static void pool_stop(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+    for (int t = 1; t < pool.threads; t++)
+    {
+        pthread_join(pool.ids[t], NULL);
+    }
+}
+
+/*****************************************************************************
+ * Filtering files. Each file is a task, which splits the right channel of
+ * every chunk off as a task of its own while it filters the left.
+ ****************************************************************************/
+
+typedef struct _job_t {
+    task_t task;
+    const char *input_name;
+    const char *output_name;
+    bool wav;
+    channel_t channels[2];
+    uint64_t frames;
+} job_t;
+
+typedef struct _channel_task_t {
+    task_t task;
+    channel_t *channel;
+    const fix3_28_t *in;
+    int frames;
+    uint8_t *out;
+} channel_task_t;
+
+static void run_right_channel(void *arg)
+{
+    channel_task_t *right = (channel_task_t *) arg;
+    filter_channel(right->channel, 1, right->in, right->frames, right->out);
+}
+
+static void run_job(void *arg)
+{
+    job_t *job = (job_t *) arg;
+    input_t input;
+    output_t output;
+    input_open(&input, job->input_name);
+    output_open(&output, job->output_name, job->wav);
+    channel_init(&job->channels[0], 0);
+    channel_init(&job->channels[1], 1);
+
+    fix3_28_t *samples = malloc(2 * CHUNK_FRAMES * sizeof(fix3_28_t));
+    channel_task_t right = { .task = { run_right_channel, &right }, .channel = &job->channels[1], .in = samples };
+    int frames;
+    do
+    {
+        frames = input_read(&input, samples);
+        uint8_t *out = output_buffer(&output);
+        right.frames = frames;
+        right.out = out;
+        pool_push(&right.task);
+        filter_channel(&job->channels[0], 0, samples, frames, out);
+        pool_wait(&right.task);
+        output_write(&output, frames);
+        job->frames += frames;
+    } while (frames == CHUNK_FRAMES);
+
+    free(samples);
+    input_close(&input);
+    output_close(&output);
+}
+
+/// @brief OUTDIR/NAME.pcm or .wav for INDIR/NAME.EXT.
+static char *batch_output_name(const char *directory, const char *input, bool wav)
+{
+    const char *name = strrchr(input, '/') ? strrchr(input, '/') + 1 : input;
+    const char *dot = strrchr(name, '.');
+    const int length = dot && dot != name ? (int) (dot - name) : (int) strlen(name);
+    char *output = malloc(strlen(directory) + length + 6);
+    sprintf(output, "%s/%.*s%s", directory, length, name, wav ? ".wav" : ".pcm");
+    return output;
+}
 
-        out[i] = (int32_t) norm_fix3_28_to_s16sample(x_f16);
+typedef struct _name_list_t {
+    char **names;
+    int count;
+    int capacity;
+} name_list_t;
 
-        // Right channel filter
-        i++;
-        x_f16 = fix16_mul(norm_fix3_28_from_s16sample((int16_t) out[i]), preamp);
+static void add_name(name_list_t *list, const char *name)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->names = realloc(list->names, list->capacity * sizeof(char *));
+    }
+    list->names[list->count++] = strdup(name);
+}
+
+/// @brief Adds the files a pattern matches, for patterns quoted to get them past the shell.
+static void add_pattern(name_list_t *list, const char *pattern)
+{
+    glob_t matches;
+    if (!strpbrk(pattern, "*?[") || glob(pattern, 0, NULL, &matches))
+    {
+        add_name(list, pattern);
+        return;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+    {
+        add_name(list, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+}
 
-        for (int j = 0; j < filter_stages; j++)
+static void add_list_file(name_list_t *list, const char *path)
+{
+    FILE *file = !strcmp(path, "-") ? stdin : fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open list file '%s'\n", path);
+        exit(1);
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0])
+            add_pattern(list, line);
+    }
+    if (file != stdin)
+        fclose(file);
+}
+
+static int compare_outputs(const void *a, const void *b)
+{
+    return strcmp((*(const job_t **) a)->output_name, (*(const job_t **) b)->output_name);
+}
+
+typedef struct _file_id_t {
+    dev_t device;
+    ino_t inode;
+    const char *name;
+} file_id_t;
+
+static int compare_file_ids(const void *a, const void *b)
+{
+    const file_id_t *x = (const file_id_t *) a, *y = (const file_id_t *) b;
+    if (x->device != y->device)
+        return x->device < y->device ? -1 : 1;
+    return x->inode < y->inode ? -1 : x->inode > y->inode;
+}
+
+/// @brief Exits if any output of the batch is one of its inputs, it would be truncated before it was read.
+static void check_outputs_against_inputs(const job_t *jobs, int count)
+{
+    file_id_t *inputs = calloc(count, sizeof(file_id_t));
+    int files = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct stat status;
+        if (identify_file(jobs[i].input_name, false, &status) && S_ISREG(status.st_mode))
+            inputs[files++] = (file_id_t) { status.st_dev, status.st_ino, jobs[i].input_name };
+    }
+    qsort(inputs, files, sizeof(file_id_t), compare_file_ids);
+    for (int i = 0; i < count; i++)
+    {
+        struct stat status;
+        if (!identify_file(jobs[i].output_name, true, &status))
+            continue;
+        const file_id_t output = { status.st_dev, status.st_ino, jobs[i].output_name };
+        const file_id_t *input = bsearch(&output, inputs, files, sizeof(file_id_t), compare_file_ids);
+        if (input)
         {
-            x_f16 = bqf_transform(x_f16, &bqf_filters_right[j],
-                &bqf_filters_mem_right[j]);
+            fprintf(stderr, "The output of '%s' would be written over '%s', filter into another directory\n",
+                jobs[i].input_name, input->name);
+            exit(1);
         }
+    }
+    free(inputs);
+}
 
-        out[i] = (int32_t) norm_fix3_28_to_s16sample(x_f16);
-        //printf("%08x\n", out[i]);
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    bool wav = false;
+    const char *directory = NULL;
+    name_list_t inputs = { 0 };
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "wj:o:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                wav = true;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                directory = optarg;
+                break;
+            case 'l':
+                add_list_file(&inputs, optarg);
+                break;
+            default:
+                fprintf(stdout, usage, argv[0], argv[0]);
+                exit(1);
+        }
+    }
+
+    int count;
+    job_t *jobs;
+    if (directory)
+    {
+        for (int i = optind; i < argc; i++)
+        {
+            add_pattern(&inputs, argv[i]);
+        }
+        count = inputs.count;
+        jobs = calloc(count, sizeof(job_t));
+        job_t **sorted = calloc(count, sizeof(job_t *));
+        for (int i = 0; i < count; i++)
+        {
+            if (!strcmp(inputs.names[i], "-"))
+            {
+                fprintf(stderr, "stdin cannot be filtered in a batch\n");
+                exit(1);
+            }
+            jobs[i].input_name = inputs.names[i];
+            jobs[i].output_name = batch_output_name(directory, inputs.names[i], wav);
+            sorted[i] = &jobs[i];
+        }
+        // Two inputs of the same name in different directories would write over each other.
+        qsort(sorted, count, sizeof(job_t *), compare_outputs);
+        for (int i = 1; i < count; i++)
+        {
+            if (!strcmp(sorted[i - 1]->output_name, sorted[i]->output_name))
+            {
+                fprintf(stderr, "'%s' and '%s' would both be written to '%s'\n", sorted[i - 1]->input_name,
+                    sorted[i]->input_name, sorted[i]->output_name);
+                exit(1);
+            }
+        }
+        free(sorted);
+        check_outputs_against_inputs(jobs, count);
+    }
+    else
+    {
+        if (optind != argc - 2 || inputs.count)
+        {
+            fprintf(stdout, usage, argv[0], argv[0]);
+            exit(1);
+        }
+        count = 1;
+        jobs = calloc(1, sizeof(job_t));
+        jobs[0].input_name = argv[optind];
+        jobs[0].output_name = argv[optind + 1];
+        if (same_file(jobs[0].input_name, jobs[0].output_name))
+        {
+            fprintf(stderr, "'%s' and '%s' are the same file, filter into another one\n", jobs[0].input_name,
+                jobs[0].output_name);
+            exit(1);
+        }
     }
+    if (!count)
+    {
+        fprintf(stderr, "No input files\n");
+        exit(1);
+    }
+    if (threads < 1)
+        threads = 1;
 
-    // Write out the processed audio.
-    for (int i=0; i<samples; i++) {
-        fwrite(&out[i], 3, sizeof(int8_t), output);
+    load_config();
+    preamp = fix3_28_from_flt(0.92f);
+
+    // Each file can have the right channel of a chunk queued on top of it.
+    pool_start(threads, 2 * count + 2);
+    const double start = now();
+    for (int i = 0; i < count; i++)
+    {
+        jobs[i].wav = wav;
+        jobs[i].task.run = run_job;
+        jobs[i].task.arg = &jobs[i];
+    }
+    pthread_mutex_lock(&pool.lock);
+    for (int i = 0; i < count; i++)
+    {
+        pool_push_to(i % threads, &jobs[i].task);
     }
-    fclose(output);
+    pthread_mutex_unlock(&pool.lock);
+    uint64_t frames = 0;
+    for (int i = 0; i < count; i++)
+    {
+        pool_wait(&jobs[i].task);
+        frames += jobs[i].frames;
+    }
+    pool_stop();
 
-    free(in);
-    free(out);
+    if (directory)
+    {
+        const double elapsed = now() - start;
+        const double audio = (double) frames / SAMPLING_FREQ;
+        printf("%d files, %.1f s of audio in %.1f s on %d threads, %.0fx real time\n", count, audio, elapsed,
+            threads, audio / elapsed);
+    }
 }
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bqf.h"
+#include "fix16.h"
+#include "fir.h"
+#include "halfband.h"
+#include "configuration_manager.h"
+
+const char* usage = "Usage: %s [PACKETS]\n\n"
+    "Times the FIR block convolution and the factory default biquad chain on one\n"
+    "channel, the way each core of the Ploopy headphones runs them, and reports\n"
+    "how many FIR taps fit in real time alongside the biquads at 48kHz. Also times\n"
+    "the 2x output interpolator used when the firmware is built with\n"
+    "OUTPUT_OVERSAMPLING_2X.\n\n"
+    "The numbers are for the machine the benchmark runs on, not the RP2040.\n";
+
+// One USB packet per millisecond at 48kHz.
+#define PACKET_FRAMES 48
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static fix3_28_t block[MAX_BLOCK_SAMPLES];
+static fir_filter_t fir;
+
+static void fill_block(unsigned *seed)
+{
+    for (int n = 0; n < PACKET_FRAMES; n++)
+    {
+        *seed = *seed * 1103515245 + 12345;
+        block[n] = (fix3_28_t)(*seed >> 4) - (1 << 27);
+    }
+}
+
+/// @brief Seconds taken to interpolate one packet to twice the rate.
+static double time_halfband(int packets)
+{
+    static halfband_t halfband;
+    static fix3_28_t oversampled[2 * MAX_BLOCK_SAMPLES];
+    unsigned seed = 1;
+    halfband_config(&halfband);
+
+    double elapsed = 0.0;
+    for (int p = 0; p < packets; p++)
+    {
+        fill_block(&seed);
+        const double start = now();
+        halfband_interpolate(block, PACKET_FRAMES, oversampled, &halfband);
+        elapsed += now() - start;
+    }
+    return elapsed / packets;
+}
+
+/// @brief Seconds taken to filter one packet.
+static double time_chain(int packets, int stages, int taps)
+{
+    unsigned seed = 1;
+    fir.taps = taps;
+    fir.position = 0;
+    for (int k = 0; k < (taps + 1) / 2; k++)
+    {
+        fir.coefficients[k] = 2 * (fix16_one / (taps + 1));
+    }
+    fir_memreset(&fir);
+
+    double elapsed = 0.0;
+    for (int p = 0; p < packets; p++)
+    {
+        fill_block(&seed);
+        const double start = now();
+        filter_chain_transform(block, PACKET_FRAMES, bqf_filters_left, bqf_filters_mem_left, stages, &fir,
+            &bqf_ramp_left);
+        elapsed += now() - start;
+    }
+    return elapsed / packets;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+    const int packets = argc == 2 ? atoi(argv[1]) : 20000;
+    if (packets <= 0)
+    {
+        fprintf(stderr, "PACKETS must be a positive number\n");
+        exit(1);
+    }
+
+    load_config();
+    const int stages = filter_stages_left;
+
+    const double chain = time_chain(packets, stages, 0);
+    printf("biquad chain: %d stages, %.2f us per packet\n", stages, chain * 1e6);
+
+    // 5 multiplies per biquad against one per pair of half band taps.
+    const double halfband = time_halfband(packets);
+    printf("2x interpolator: %.2f us per packet, %.0f%% of the chain, %d against %d multiplies per sample\n\n",
+        halfband * 1e6, 100.0 * halfband / chain, HALFBAND_PAIRS, 5 * stages);
+
+    printf("%6s %14s %14s %16s\n", "taps", "us/packet", "load %", "taps*samples/ms");
+    double best_rate = 0.0;
+    for (int taps = 16; taps <= FIR_MAX_TAPS; taps *= 2)
+    {
+        const double fir_time = time_chain(packets, 0, taps);
+        const double rate = taps * PACKET_FRAMES / (fir_time * 1e3);
+        if (rate > best_rate) best_rate = rate;
+        // A packet holds 1ms of audio, so the time per packet in ms is the share of one core.
+        printf("%6d %14.2f %14.2f %16.0f\n", taps, fir_time * 1e6, (chain + fir_time) * 1e5, rate);
+    }
+
+    // What is left of the millisecond after the biquads, spent on FIR taps.
+    const double spare = 1e-3 - chain;
+    printf("\nmax taps per channel at 48kHz alongside the biquads: %.0f (limited to %d)\n",
+        spare > 0 ? spare * 1e3 * best_rate / PACKET_FRAMES : 0.0, FIR_MAX_TAPS);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bqf.h"
+#include "fix16.h"
+#include "configuration_types.h"
+#include "configuration_manager.h"
+#include "filter_response.h"
+
+const char* usage = "Usage: %s [CONFIGFILE]\n\n"
+    "Works out the headroom the Ploopy headphones filter chains need from their\n"
+    "frequency response. Reports the peak gain after each stage, the largest safe\n"
+    "preamp and a stage order that keeps the peak inside the chain lower.\n\n"
+    "CONFIGFILE holds a SET_CONFIGURATION TLV as it would be sent to the device,\n"
+    "without it the factory default configuration is used.\n";
+
+// Q3.28 overflows at 8.0, and norm_fix3_28_to_s16sample() clips at 2.0.
+#define CHAIN_HEADROOM_DB 18.0618
+#define OUTPUT_HEADROOM_DB 6.0206
+
+static double preamp_db = 0.0;
+static double post_eq_db = 0.0;
+
+static void read_preprocessing(const tlv_header *config)
+{
+    const uint8_t *ptr = config->value;
+    const uint8_t *end = (const uint8_t *)config + config->length;
+    while (ptr + sizeof(tlv_header) <= end)
+    {
+        const tlv_header *tlv = (const tlv_header *)ptr;
+        if (tlv->type == PREPROCESSING_CONFIGURATION && tlv->length == sizeof(preprocessing_configuration_tlv))
+        {
+            const preprocessing_configuration_tlv *preprocessing = (const preprocessing_configuration_tlv *)tlv;
+            preamp_db = 20.0 * log10(1.0 + preprocessing->preamp);
+            post_eq_db = 20.0 * log10(1.0 + preprocessing->postEQGain);
+        }
+        if (tlv->length < sizeof(tlv_header)) break;
+        ptr += tlv->length;
+    }
+}
+
+static void report(const char *name, const bqf_coeff_t *filters, int stages)
+{
+    gain_staging_t staging;
+    analyse_gain_staging(filters, stages, SAMPLING_FREQ, &staging);
+
+    printf("%s channel, %d stages\n", name, stages);
+    printf("  stage  peak after (dB)\n");
+    for (int j = 0; j < stages; j++)
+    {
+        printf("  %5d  %+8.2f\n", j, staging.stage_peak[j]);
+    }
+
+    const double safe_preamp = fmin(CHAIN_HEADROOM_DB - staging.chain_peak,
+        OUTPUT_HEADROOM_DB - staging.output_peak - post_eq_db);
+    printf("  Peak inside the chain %+.2f dB, at the output %+.2f dB\n", staging.chain_peak, staging.output_peak);
+    printf("  Largest safe preamp %+.2f dB, configured %+.2f dB (%s)\n", safe_preamp, preamp_db,
+        preamp_db <= safe_preamp ? "ok" : "may clip");
+
+    printf("  Suggested order:");
+    for (int n = 0; n < stages; n++)
+    {
+        printf(" %d", staging.order[n]);
+    }
+    printf("\n  Peak inside the chain in that order %+.2f dB\n\n", staging.ordered_chain_peak);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+
+    load_config();
+
+    static uint8_t config[4096];
+    if (argc == 2)
+    {
+        FILE* input = fopen(argv[1], "rb");
+        if (!input)
+        {
+            fprintf(stderr, "Cannot open config file '%s'\n", argv[1]);
+            exit(1);
+        }
+        size_t size = fread(config, 1, sizeof(config), input);
+        fclose(input);
+
+        tlv_header *header = (tlv_header *)config;
+        if (size < sizeof(tlv_header) || header->length > size || !validate_configuration(header))
+        {
+            fprintf(stderr, "'%s' is not a valid configuration\n", argv[1]);
+            exit(1);
+        }
+        apply_configuration(header);
+        read_preprocessing(header);
+    }
+    else
+    {
+        read_preprocessing(default_configuration_tlv());
+    }
+
+    report("Left", bqf_filters_left, filter_stages_left);
+    report("Right", bqf_filters_right, filter_stages_right);
+    return 0;
+}
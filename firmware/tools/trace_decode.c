@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "configuration_types.h"
+#include "trace.h"
+
+const char* usage = "Usage: %s [-s] INFILE\n\n"
+    "Turns the events saved by trace_dump.py into a timeline of both cores, marking\n"
+    "late packets and underruns, followed by a summary.\n\n"
+    "  -s  only print the summary\n";
+
+// USB sends a packet every millisecond, anything this late is flagged.
+#define LATE_PACKET_US 1500
+
+typedef struct _event_t {
+    uint8_t core;
+    uint32_t sequence;
+    int64_t time;   // us since the first event
+    uint32_t event;
+} event_t;
+
+static const char *type_name(uint8_t type)
+{
+    static const char *names[] = {
+        "?", "packet", "handshake", "UNDERRUN", "feedback", "config", "flash save", "volume"
+    };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "?";
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const event_t *x = a, *y = b;
+    if (x->time != y->time) return x->time < y->time ? -1 : 1;
+    if (x->core != y->core) return x->core - y->core;
+    return x->sequence < y->sequence ? -1 : x->sequence > y->sequence;
+}
+
+static void describe(const event_t *e, char *text, size_t size)
+{
+    const uint32_t value = TRACE_VALUE(e->event);
+    switch (TRACE_TYPE(e->event))
+    {
+        case TRACE_PACKET:
+            snprintf(text, size, "%u bytes", value);
+            break;
+        case TRACE_HANDSHAKE:
+            snprintf(text, size, "waited %uus", value);
+            break;
+        case TRACE_UNDERRUN:
+            snprintf(text, size, "%u bytes left in the ring", value);
+            break;
+        case TRACE_FEEDBACK:
+            snprintf(text, size, "%.4f samples/frame", value / 16384.0);
+            break;
+        case TRACE_VOLUME:
+            // 255 is 0dB, each step down is 0.5dB
+            snprintf(text, size, "left %.1fdB right %.1fdB", ((int) (value & 0xff) - 255) / 2.0,
+                ((int) (value >> 8 & 0xff) - 255) / 2.0);
+            break;
+        default:
+            text[0] = '\0';
+            break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int summary_only = 0;
+    if (argc == 3 && !strcmp(argv[1], "-s"))
+    {
+        summary_only = 1;
+    }
+    else if (argc != 2)
+    {
+        fprintf(stdout, usage, argv[0]);
+        exit(1);
+    }
+
+    FILE *input = fopen(argv[argc - 1], "rb");
+    if (!input)
+    {
+        fprintf(stderr, "Cannot open input file '%s'\n", argv[argc - 1]);
+        exit(1);
+    }
+    fseek(input, 0, SEEK_END);
+    const long size = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (!data || fread(data, 1, size, input) != (size_t) size)
+    {
+        fprintf(stderr, "Cannot read input file '%s'\n", argv[argc - 1]);
+        exit(1);
+    }
+    fclose(input);
+
+    // Every chunk is an OK result with one TRACE TLV in it. The same events can
+    // turn up in more than one chunk, they are told apart by sequence number.
+    event_t *events = malloc(sizeof(event_t) * (size / sizeof(trace_event_t) + 1));
+    int count = 0;
+    int have_reference = 0;
+    uint32_t reference = 0;
+    uint32_t next_sequence[2] = { 0, 0 };
+    for (long offset = 0; offset + sizeof(tlv_header) <= size; )
+    {
+        const tlv_header *result = (const tlv_header *) &data[offset];
+        if (result->length < sizeof(tlv_header) || offset + result->length > size)
+        {
+            fprintf(stderr, "Truncated result at offset %ld\n", offset);
+            exit(1);
+        }
+        const trace_tlv *trace = (const trace_tlv *) result->value;
+        if (result->type == OK && result->length >= sizeof(tlv_header) + sizeof(trace_tlv) &&
+            trace->header.type == TRACE && trace->core < 2)
+        {
+            const int chunk = (trace->header.length - sizeof(trace_tlv)) / sizeof(trace_event_t);
+            const uint8_t *chunk_events = (const uint8_t *) trace + sizeof(trace_tlv);
+            for (int i = 0; i < chunk; i++)
+            {
+                trace_event_t event;
+                memcpy(&event, &chunk_events[i * sizeof(trace_event_t)], sizeof(event));
+                const uint32_t sequence = trace->first + i;
+                if (next_sequence[trace->core] && (int32_t) (sequence - next_sequence[trace->core]) < 0) continue;
+                next_sequence[trace->core] = sequence + 1;
+                if (!have_reference)
+                {
+                    reference = event.time;
+                    have_reference = 1;
+                }
+                event_t *e = &events[count++];
+                e->core = trace->core;
+                e->sequence = sequence;
+                // time_us_32() wraps every 71 minutes, far longer than the rings last
+                e->time = (int32_t) (event.time - reference);
+                e->event = event.event;
+            }
+        }
+        offset += result->length;
+    }
+    if (!count)
+    {
+        fprintf(stderr, "No trace events in '%s'\n", argv[argc - 1]);
+        exit(1);
+    }
+    qsort(events, count, sizeof(event_t), compare_events);
+
+    int counts[256] = { 0 };
+    int late_packets = 0;
+    int64_t last_packet = -1;
+    int64_t longest_gap = 0;
+    uint32_t longest_wait[2] = { 0, 0 };
+    const int64_t start = events[0].time;
+
+    if (!summary_only)
+    {
+        printf("%10s  %-5s  %-10s\n", "ms", "core", "event");
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const event_t *e = &events[i];
+        const uint8_t type = TRACE_TYPE(e->event);
+        const char *note = "";
+        counts[type]++;
+        if (type == TRACE_PACKET)
+        {
+            if (last_packet >= 0)
+            {
+                const int64_t gap = e->time - last_packet;
+                if (gap > longest_gap) longest_gap = gap;
+                if (gap > LATE_PACKET_US)
+                {
+                    late_packets++;
+                    note = "  <-- late";
+                }
+            }
+            last_packet = e->time;
+        }
+        if (type == TRACE_HANDSHAKE && TRACE_VALUE(e->event) > longest_wait[e->core])
+        {
+            longest_wait[e->core] = TRACE_VALUE(e->event);
+        }
+        if (type == TRACE_UNDERRUN)
+        {
+            note = "  <-- underrun";
+        }
+        if (!summary_only)
+        {
+            char text[64];
+            describe(e, text, sizeof(text));
+            printf("%10.3f  %-5d  %-10s  %s%s\n", (e->time - start) / 1000.0, e->core, type_name(type), text, note);
+        }
+    }
+
+    printf("\n%d events over %.1fms\n", count, (events[count - 1].time - start) / 1000.0);
+    for (int type = TRACE_PACKET; type <= TRACE_VOLUME; type++)
+    {
+        printf("  %-10s  %d\n", type_name(type), counts[type]);
+    }
+    printf("Late packets: %d, longest gap %.3fms\n", late_packets, longest_gap / 1000.0);
+    printf("Longest handshake wait: core 0 %uus, core 1 %uus\n", longest_wait[0], longest_wait[1]);
+    return counts[TRACE_UNDERRUN] ? 2 : 0;
+}
@@ -0,0 +1,54 @@
+#!/usr/bin/python3
+import struct
+import sys
+import usb.core
+from usb.util import *
+
+PLOOPY_VID = 0x2e8a
+PLOOPY_PID = 0xfedd
+
+# See configuration_types.h
+OK = 0
+GET_TRACE = 16
+TRACE = 0x406
+
+CONFIGURATION_INTERFACE = 2
+CONFIGURATION_OUT = 0x03
+CONFIGURATION_IN = 0x84
+
+def command(dev, type, body):
+    dev.write(CONFIGURATION_OUT, struct.pack('<HH', type, 4 + len(body)) + body)
+    result = bytes(dev.read(CONFIGURATION_IN, 64))
+    type, length = struct.unpack_from('<HH', result)
+    while len(result) < length:
+        result += bytes(dev.read(CONFIGURATION_IN, 64))
+    if type != OK:
+        raise RuntimeError(f"GET_TRACE failed with {type}")
+    return result
+
+if len(sys.argv) != 2:
+    print(f"Usage: {sys.argv[0]} OUTFILE\n\n"
+        "Reads the events both cores of the headphones traced recently and writes\n"
+        "them to OUTFILE, for trace_decode to turn into a timeline.")
+    sys.exit(1)
+
+dev = usb.core.find(idVendor=PLOOPY_VID, idProduct=PLOOPY_PID)
+if dev is None:
+    print("No Ploopy headphones found.")
+    sys.exit(1)
+claim_interface(dev, CONFIGURATION_INTERFACE)
+
+with open(sys.argv[1], 'wb') as output:
+    for core in range(2):
+        first = 0
+        while True:
+            result = command(dev, GET_TRACE, struct.pack('<B3xI', core, first))
+            _, _, start, head, _ = struct.unpack_from('<HHB3xIII', result, 4)
+            count = (len(result) - 24) // 8
+            output.write(result)
+            first = start + count
+            if count == 0 or first >= head:
+                break
+        print(f"core {core}: {head} events traced")
+
+release_interface(dev, CONFIGURATION_INTERFACE)
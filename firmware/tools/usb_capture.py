@@ -0,0 +1,71 @@
+#!/usr/bin/python3
+import struct
+import sys
+
+# See emulator/emulator.h
+CAPTURE_MAGIC = 0x42535550
+
+AUDIO_OUT = 0x01
+USB_FRAME_NS = 1000000
+
+# pcap link type of a usbmon capture with the isochronous descriptors in it
+LINKTYPE_USB_LINUX_MMAPPED = 220
+USBMON_HEADER = struct.Struct('<QBBBBHbbqiiII8siiII')
+ISO_DESCRIPTOR = struct.Struct('<iIII')
+URB_ISOCHRONOUS = 0
+
+def packets(pcap):
+    magic, = struct.unpack('<I', pcap.read(4))
+    if magic not in (0xa1b2c3d4, 0xa1b23c4d):
+        raise RuntimeError("not a pcap file, save it as pcap rather than pcapng")
+    _, _, _, _, _, linktype = struct.unpack('<HHiIII', pcap.read(20))
+    if linktype != LINKTYPE_USB_LINUX_MMAPPED:
+        raise RuntimeError(f"link type {linktype}, capture it from a usbmon interface")
+    while True:
+        header = pcap.read(16)
+        if len(header) < 16:
+            return
+        _, _, length, _ = struct.unpack('<IIII', header)
+        yield pcap.read(length)
+
+def audio_out(pcap, device):
+    """Yields the time in ns and the payload of each audio packet sent to the device.
+
+    usbmon only timestamps each URB, so the packets in it are put a frame apart,
+    the last one in the frame the URB completed in."""
+    submitted = {}
+    for packet in packets(pcap):
+        (id, type, xfer_type, epnum, devnum, busnum, _, _, ts_sec, ts_usec, _, _, _, _, _, _, _,
+            ndesc) = USBMON_HEADER.unpack_from(packet)
+        if xfer_type != URB_ISOCHRONOUS or epnum != AUDIO_OUT:
+            continue
+        if device is not None and (busnum, devnum) != device:
+            continue
+        descriptors = [ISO_DESCRIPTOR.unpack_from(packet, USBMON_HEADER.size + i * ISO_DESCRIPTOR.size)
+            for i in range(ndesc)]
+        data = packet[USBMON_HEADER.size + ndesc * ISO_DESCRIPTOR.size:]
+        if chr(type) == 'S':
+            submitted[id] = [data[offset:offset + length] for _, offset, length, _ in descriptors]
+        elif chr(type) == 'C' and id in submitted:
+            payloads = submitted.pop(id)
+            time = ts_sec * 1000000000 + ts_usec * 1000
+            for i, (status, _, _, _) in enumerate(descriptors[:len(payloads)]):
+                if status == 0:
+                    yield time - (len(payloads) - 1 - i) * USB_FRAME_NS, payloads[i]
+
+if len(sys.argv) not in (3, 4):
+    print(f"Usage: {sys.argv[0]} INFILE OUTFILE [BUS.DEVICE]\n\n"
+        "Takes the audio packets sent to the headphones out of INFILE, a pcap file\n"
+        "captured from usbmon with tcpdump or Wireshark, and writes them to OUTFILE\n"
+        "for the emulator to replay with -p. Give BUS.DEVICE, as lsusb shows them, if\n"
+        "more than one audio device was streaming.")
+    sys.exit(1)
+
+device = tuple(int(n) for n in sys.argv[3].split('.')) if len(sys.argv) == 4 else None
+count = 0
+with open(sys.argv[1], 'rb') as pcap, open(sys.argv[2], 'wb') as output:
+    output.write(struct.pack('<I', CAPTURE_MAGIC))
+    for time, payload in audio_out(pcap, device):
+        output.write(struct.pack('<QH', time, len(payload)) + payload)
+        count += 1
+print(f"{count} packets")